@@ -0,0 +1,254 @@
+/*
+ * Activation.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      激活函数的向量化实现： ReLU、LeakyReLU、Sigmoid、Tanh、GELU（tanh 近似）。
+ *      1、运行时检测CPU指令集， AVX2 每次处理8个数， exp 使用 Cephes 的多项式近似（相对误差约 1e-7）；
+ *         不支持时（或非x86平台）使用 std::exp / std::tanh；
+ *      2、只有元素个数不少于 parallelThreshold() 时才用 OpenMP 按块并行， 单行的推理不会创建线程；
+ *      3、既可以作为单独的层（INetLayer_Activation）， 也可以作为 Affine 等层计算之后的 epilogue。
+ */
+
+#ifndef LC_DEEPLEARNING_ACTIVATION_HPP_
+#define LC_DEEPLEARNING_ACTIVATION_HPP_
+
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include "../utility/Timer.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LC_ACTIVATION_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace LC {
+
+class Activation {
+public:
+	enum Type {
+		IDENTITY = 0, RELU, LEAKY_RELU, SIGMOID, TANH, GELU
+	};
+	static const size_t PARALLEL_CHUNK = 1 << 14;  ///< 并行时每个任务处理的元素个数
+
+	/**
+	 * loadNetStructure 中的层名
+	 */
+	static Type parse(const std::string& name) {
+		if (name == "Identity")
+			return IDENTITY;
+		if (name == "ReLU")
+			return RELU;
+		if (name == "LeakyReLU")
+			return LEAKY_RELU;
+		if (name == "Sigmoid")
+			return SIGMOID;
+		if (name == "Tanh")
+			return TANH;
+		if (name == "GELU")
+			return GELU;
+		throw std::string("unsupported activation: ") + name;
+	}
+
+	static const char* name(Type type) {
+		static const char* names[] = { "Identity", "ReLU", "LeakyReLU", "Sigmoid", "Tanh", "GELU" };
+		return names[type];
+	}
+
+	static bool isActivation(const std::string& name) {
+		return name == "Identity" || name == "ReLU" || name == "LeakyReLU" || name == "Sigmoid" || name == "Tanh"
+				|| name == "GELU";
+	}
+
+	/**
+	 * 元素个数不少于该值时才并行， 默认 1 << 18
+	 */
+	static size_t parallelThreshold() {
+		return parallel_threshold();
+	}
+
+	static void setParallelThreshold(size_t n) {
+		parallel_threshold() = n;
+	}
+
+	static bool simdSupported() {
+#ifdef LC_ACTIVATION_SIMD_X86
+		static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+	/**
+	 * 原地计算 data[0, n) 的激活值
+	 * @param alpha LeakyReLU 负半轴的斜率
+	 */
+	static void apply(Type type, float* data, size_t n, float alpha = 0.01f) {
+		if (type == IDENTITY || n == 0)
+			return;
+		if (n < parallel_threshold()) {
+			apply_serial(type, data, n, alpha);
+			return;
+		}
+		const long num_chunks = (long) ((n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK);
+#pragma omp parallel for
+		for (long c = 0; c < num_chunks; ++c) {
+			const size_t begin = c * PARALLEL_CHUNK;
+			apply_serial(type, data + begin, std::min<size_t>(n - begin, size_t(PARALLEL_CHUNK)), alpha);  // 传值， 不 ODR-use 类内的常量
+		}
+	}
+
+	static void apply_serial(Type type, float* data, size_t n, float alpha = 0.01f) {
+		size_t i = 0;
+#ifdef LC_ACTIVATION_SIMD_X86
+		if (simdSupported())
+			i = apply_avx2(type, data, n, alpha);
+#endif
+		for (; i < n; ++i)
+			data[i] = scalar(type, data[i], alpha);
+	}
+
+	static inline float scalar(Type type, float x, float alpha = 0.01f) {
+		switch (type) {
+		case RELU:
+			return x < 0 ? 0 : x;
+		case LEAKY_RELU:
+			return x < 0 ? alpha * x : x;
+		case SIGMOID:
+			return 1.0f / (1.0f + std::exp(-x));
+		case TANH:
+			return std::tanh(x);
+		case GELU:
+			return 0.5f * x * (1.0f + std::tanh(GELU_C * (x + 0.044715f * x * x * x)));
+		default:
+			return x;
+		}
+	}
+
+	/**
+	 * 比较 SIMD 与标量实现的误差和速度
+	 */
+	static void testActivation(size_t n = 1 << 20, int repeat = 20) {
+		std::cout << "\n---test LC::Activation, avx2: " << simdSupported() << std::endl;
+		std::vector<float> x(n), y(n), ref(n);
+		for (size_t i = 0; i < n; ++i)
+			x[i] = 20.0f * i / n - 10.0f;
+		const Type types[] = { RELU, LEAKY_RELU, SIGMOID, TANH, GELU };
+		for (int t = 0; t < 5; ++t) {
+			float max_diff = 0;
+			for (size_t i = 0; i < n; ++i)
+				ref[i] = scalar(types[t], x[i]);
+			y = x;
+			apply(types[t], y.data(), n);
+			for (size_t i = 0; i < n; ++i)
+				max_diff = std::max(max_diff, std::abs(y[i] - ref[i]));
+			LC::TimerAccurate timer;
+			for (int r = 0; r < repeat; ++r) {
+				y = x;
+				apply(types[t], y.data(), n);
+			}
+			const double t_simd = timer.getElapsedTimeAndRestart();
+			for (int r = 0; r < repeat; ++r) {
+				y = x;
+				for (size_t i = 0; i < n; ++i)
+					y[i] = scalar(types[t], y[i]);
+			}
+			const double t_scalar = timer.getElapsedTimeAndRestart();
+			std::cout << name(types[t]) << ": max abs diff " << max_diff << "; " << n * repeat / t_simd / 1e6
+					<< " M/sec (scalar " << n * repeat / t_scalar / 1e6 << " M/sec)" << std::endl;
+		}
+	}
+
+private:
+	static constexpr float GELU_C = 0.7978845608f;  ///< sqrt(2 / pi)
+
+	static size_t& parallel_threshold() {
+		static size_t threshold = 1 << 18;
+		return threshold;
+	}
+
+#ifdef LC_ACTIVATION_SIMD_X86
+	/**
+	 * Cephes expf： x = n * ln2 + r， exp(r) 用5次多项式， 再乘 2^n
+	 */
+	__attribute__((target("avx2,fma")))
+	static inline __m256 exp_avx2(__m256 x) {
+		x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-87.3f)), _mm256_set1_ps(88.3f));
+		__m256 n = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(1.44269504088896341f), _mm256_set1_ps(0.5f)));
+		x = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+		x = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), x);
+		__m256 p = _mm256_set1_ps(1.9875691500E-4f);
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(1.3981999507E-3f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(8.3334519073E-3f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(4.1665795894E-2f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(1.6666665459E-1f));
+		p = _mm256_fmadd_ps(p, x, _mm256_set1_ps(5.0000001201E-1f));
+		p = _mm256_fmadd_ps(p, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+		const __m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+		return _mm256_mul_ps(p, _mm256_castsi256_ps(pow2n));
+	}
+
+	/**
+	 * tanh(x) = sign(x) * (1 - e) / (1 + e)， e = exp(-2|x|)
+	 */
+	__attribute__((target("avx2,fma")))
+	static inline __m256 tanh_avx2(__m256 x) {
+		const __m256 sign_mask = _mm256_set1_ps(-0.0f);
+		const __m256 e = exp_avx2(_mm256_mul_ps(_mm256_andnot_ps(sign_mask, x), _mm256_set1_ps(-2.0f)));
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 t = _mm256_div_ps(_mm256_sub_ps(one, e), _mm256_add_ps(one, e));
+		return _mm256_or_ps(t, _mm256_and_ps(x, sign_mask));
+	}
+
+	/**
+	 * 处理前 n / 8 * 8 个数， 返回处理的个数
+	 */
+	__attribute__((target("avx2,fma")))
+	static size_t apply_avx2(Type type, float* data, size_t n, float alpha) {
+		const size_t m = n / 8 * 8;
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 alpha_v = _mm256_set1_ps(alpha);
+		for (size_t i = 0; i < m; i += 8) {
+			const __m256 x = _mm256_loadu_ps(data + i);
+			__m256 y;
+			switch (type) {
+			case RELU:
+				y = _mm256_max_ps(x, zero);
+				break;
+			case LEAKY_RELU:
+				y = _mm256_blendv_ps(x, _mm256_mul_ps(x, alpha_v), _mm256_cmp_ps(x, zero, _CMP_LT_OQ));
+				break;
+			case SIGMOID:
+				y = _mm256_div_ps(one, _mm256_add_ps(one, exp_avx2(_mm256_sub_ps(zero, x))));
+				break;
+			case TANH:
+				y = tanh_avx2(x);
+				break;
+			case GELU: {
+				const __m256 x3 = _mm256_mul_ps(_mm256_mul_ps(x, x), x);
+				const __m256 u = _mm256_mul_ps(_mm256_set1_ps(GELU_C), _mm256_fmadd_ps(_mm256_set1_ps(0.044715f), x3, x));
+				y = _mm256_mul_ps(_mm256_mul_ps(half, x), _mm256_add_ps(one, tanh_avx2(u)));
+				break;
+			}
+			default:
+				y = x;
+				break;
+			}
+			_mm256_storeu_ps(data + i, y);
+		}
+		return m;
+	}
+#endif
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_ACTIVATION_HPP_ */
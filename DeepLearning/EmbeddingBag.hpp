@@ -0,0 +1,323 @@
+/*
+ * EmbeddingBag.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      一次计算一个 batch 中所有 bag 的 embedding， 与 SparseEmbedding_sum / mean / mean_div_n 的结果相同：
+ *      1、表按行存储（MatRowMajor、MappedWeights 映射的表或 QuantizedRows）， 每个 embedding 是连续的内存；
+ *         SparseEmbedding_* 使用列优先的 Mat， m.row(id) 的每个数相隔整个表的行数；
+ *      2、bag 用 CSR 格式描述： 第 b 个 bag 为 indices[offsets[b], offsets[b + 1])， weights 为空时权重都是1；
+ *      3、累加第 j 个 id 时预取第 j + PREFETCH_DISTANCE 个 id 的行（跨越 bag 的边界）， 累加使用 AVX2；
+ *      4、结果直接写入 FeedForwardNet 的输入矩阵（第 b 行， 从 col_offset 开始的 cols 列）， 与 MatInputLoader 一样拼接。
+ *
+ *      用法：
+ *      std::vector<size_t> offsets = { 0, 3, 5 };  // 2 个 bag
+ *      std::vector<long long> ids = { 1, 7, 9, 2, 7 };
+ *      Eigen::Index col = 0;
+ *      col = LC::EmbeddingBag::forward(user_table, LC::EmbeddingBag::SUM, offsets, ids, std::vector<float>(), input, col);
+ *      col = LC::EmbeddingBag::forward(item_table, LC::EmbeddingBag::MEAN_DIV_N, offsets2, ids2, weights2, input, col);
+ *      net.forward_mutableInput(input);
+ */
+
+#ifndef LC_DEEPLEARNING_EMBEDDINGBAG_HPP_
+#define LC_DEEPLEARNING_EMBEDDINGBAG_HPP_
+
+#include "FeedForwardNet.hpp"
+#include "Embedding.hpp"
+#include "../utility/Random.hpp"
+#include <stdexcept>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LC_EMBEDDINGBAG_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace LC {
+
+class EmbeddingBag {
+public:
+	enum Combiner {
+		SUM, MEAN, MEAN_DIV_N  ///< MEAN 除以权重绝对值之和， MEAN_DIV_N 除以 id 的个数
+	};
+	static const size_t PREFETCH_DISTANCE = 8;
+
+	/**
+	 * 与 SparseEmbeddingFactory::get 相同的名字， 空字符串为 mean_div_n
+	 */
+	static Combiner parseCombiner(const std::string& combiner) {
+		const std::string f = LC::Str::toLowerCase(combiner);
+		if (f == "mean_div_n" || f.empty())
+			return MEAN_DIV_N;
+		if (f == "mean")
+			return MEAN;
+		if (f == "sum")
+			return SUM;
+		throw std::invalid_argument("unsupported EmbeddingBag combiner: " + combiner);
+	}
+
+	/**
+	 * 行优先、行间隔为 table.outerStride() 的 float 表， 可以是 MatRowMajor 或 Eigen::Map<const MatRowMajor>（不复制）
+	 * @param offsets num_bags + 1 个数， 第 b 个 bag 为 indices[offsets[b], offsets[b + 1])
+	 * @param weights 为NULL时权重都是1
+	 * @param out 第 b 个 bag 的第 c 个数写入 out[b * ors + c * ocs]
+	 */
+	template<typename KeyType>
+	static void forward(const Eigen::Ref<const MatRowMajor>& table, Combiner combiner, const size_t* offsets,
+			size_t num_bags, const KeyType* indices, const float* weights, float* out, Eigen::Index ors,
+			Eigen::Index ocs) {
+		forwardTable(FloatTable(table), combiner, offsets, num_bags, indices, weights, out, ors, ocs);
+	}
+
+	template<typename KeyType>
+	static void forward(const QuantizedRows& table, Combiner combiner, const size_t* offsets, size_t num_bags,
+			const KeyType* indices, const float* weights, float* out, Eigen::Index ors, Eigen::Index ocs) {
+		forwardTable(QuantizedTable(table), combiner, offsets, num_bags, indices, weights, out, ors, ocs);
+	}
+
+	/**
+	 * 写入 input 的前 offsets.size() - 1 行、 [col_offset, col_offset + table.cols()) 列， 返回下一个 col_offset
+	 */
+	template<typename Table, typename KeyType>
+	static Eigen::Index forward(const Table& table, Combiner combiner, const std::vector<size_t>& offsets,
+			const std::vector<KeyType>& indices, const std::vector<float>& weights, Mat& input,
+			Eigen::Index col_offset) {
+		const Eigen::Index cols = table.cols();
+		const size_t num_bags = checkBatch(offsets, indices, weights, input, col_offset, cols);
+		forward(table, combiner, offsets.data(), num_bags, indices.data(), weights.empty() ? NULL : weights.data(),
+				input.data() + col_offset * input.rows(), 1, input.rows());
+		return col_offset + cols;
+	}
+
+	/**
+	 * acc[0, n) += w * row[0, n)
+	 */
+	static inline void axpy(const float* row, float w, float* acc, size_t n) {
+		size_t c = 0;
+#ifdef LC_EMBEDDINGBAG_SIMD_X86
+		if (simdSupported())
+			c = axpy_avx2(row, w, acc, n);
+#endif
+		for (; c < n; ++c)
+			acc[c] += w * row[c];
+	}
+
+	/**
+	 * 任意的表， 需要提供：
+	 * size_t cols() const；
+	 * bool valid(KeyType id) const；             id 是否可以查询
+	 * void prefetchRow(KeyType id) const；
+	 * void axpyRow(KeyType id, float w, float* acc) const；   acc[0, cols) += w * embedding(id)
+	 * 空的 bag 查询 id 为0的 embedding。 参数与 forward 相同
+	 */
+	template<typename Table, typename KeyType>
+	static void forwardTable(const Table& table, Combiner combiner, const size_t* offsets, size_t num_bags,
+			const KeyType* indices, const float* weights, float* out, Eigen::Index ors, Eigen::Index ocs) {
+		const size_t cols = table.cols();
+		const size_t end = offsets[num_bags];
+		for (size_t j = 0; j < end; ++j)
+			if (!table.valid(indices[j]))
+				throw std::invalid_argument("EmbeddingBag: id out of range: " + LC::Str::num2str((long long) indices[j]));
+		const size_t prefetch_distance = PREFETCH_DISTANCE;  // std::min 按引用传参， 复制一份， 不需要类外定义
+		for (size_t j = 0; j < std::min(end, prefetch_distance); ++j)
+			table.prefetchRow(indices[j]);
+
+		std::vector<float>& acc = thread_buffer();
+		acc.resize(cols);
+		for (size_t b = 0; b < num_bags; ++b) {
+			std::fill(acc.begin(), acc.end(), 0.0f);
+			const size_t begin = offsets[b], bag_end = offsets[b + 1];
+			float scale = 1.0f;
+			if (begin == bag_end) {
+				table.axpyRow(0, 1.0f, acc.data());  // 与 SparseEmbedding_* 相同， 空的 bag 为第0行
+			} else {
+				float abs_weights = 0;
+				for (size_t j = begin; j < bag_end; ++j) {
+					if (j + PREFETCH_DISTANCE < end)
+						table.prefetchRow(indices[j + PREFETCH_DISTANCE]);
+					const float w = weights != NULL ? weights[j] : 1.0f;
+					table.axpyRow(indices[j], w, acc.data());
+					abs_weights += std::abs(w);
+				}
+				if (combiner == MEAN && abs_weights > 0)
+					scale = 1.0f / abs_weights;
+				else if (combiner == MEAN_DIV_N)
+					scale = 1.0f / (bag_end - begin);
+			}
+			float* o = out + b * ors;
+			for (size_t c = 0; c < cols; ++c)
+				o[c * ocs] = acc[c] * scale;
+		}
+	}
+
+	template<typename Table, typename KeyType>
+	static Eigen::Index forwardTable(const Table& table, Combiner combiner, const std::vector<size_t>& offsets,
+			const std::vector<KeyType>& indices, const std::vector<float>& weights, Mat& input,
+			Eigen::Index col_offset) {
+		const size_t num_bags = checkBatch(offsets, indices, weights, input, col_offset, table.cols());
+		forwardTable(table, combiner, offsets.data(), num_bags, indices.data(), weights.empty() ? NULL : weights.data(),
+				input.data() + col_offset * input.rows(), 1, input.rows());
+		return col_offset + table.cols();
+	}
+
+	/**
+	 * 与 SparseEmbedding_sum / SparseEmbedding_mean_div_n 比较结果和速度
+	 */
+	static void testEmbeddingBag(int rows = 500000, int cols = 64, int num_bags = 256, int ids_per_bag = 20, int repeat =
+			20) {
+		std::cout << "\n---test LC::EmbeddingBag" << std::endl;
+		const Mat colMajor = Mat::Random(rows, cols);
+		const MatRowMajor rowMajor = colMajor;
+		const QuantizedRows fp16(WEIGHT_FP16, rowMajor.data(), rows, cols);
+
+		LC::RandomUniform<int, float> rnd(22);
+		rnd.set_param_i(0, rows - 1);
+		rnd.set_param_f(0.5f, 2.0f);
+		std::vector<size_t> offsets(1, 0);
+		std::vector<long long> ids;
+		std::vector<float> weights;
+		std::vector<std::vector<std::pair<long long, float> > > bags(num_bags);
+		for (int b = 0; b < num_bags; ++b) {
+			const int n = b % 7 == 0 ? 0 : ids_per_bag;  // 包含空的 bag
+			for (int j = 0; j < n; ++j) {
+				ids.push_back(rnd.randi());
+				weights.push_back(rnd.randf());
+				bags[b].push_back(std::make_pair(ids.back(), weights.back()));
+			}
+			offsets.push_back(ids.size());
+		}
+
+		const Combiner combiners[] = { SUM, MEAN_DIV_N };
+		const char* names[] = { "sum", "mean_div_n" };
+		for (int k = 0; k < 2; ++k) {
+			SparseEmbeddingFactory<long long, float>::SparseEmbeddingFunc legacy;
+			if (combiners[k] == SUM)
+				legacy = SparseEmbedding_sum<long long, float>();
+			else
+				legacy = SparseEmbedding_mean_div_n<long long, float>();
+			Mat expected(num_bags, cols), input(num_bags, cols + 8), input16(num_bags, cols);
+			LC::TimerAccurate timer;
+			for (int r = 0; r < repeat; ++r)
+				for (int b = 0; b < num_bags; ++b)
+					expected.row(b) = legacy(bags[b], colMajor);
+			const double t_legacy = timer.getElapsedTimeAndRestart();
+			for (int r = 0; r < repeat; ++r)
+				forward(rowMajor, combiners[k], offsets, ids, weights, input, 8);
+			const double t_bag = timer.getElapsedTimeAndRestart();
+			for (int r = 0; r < repeat; ++r)
+				forward(fp16, combiners[k], offsets, ids, weights, input16, 0);
+			const double t_fp16 = timer.getElapsedTimeAndRestart();
+			std::cout << names[k] << ": max abs diff " << (input.rightCols(cols) - expected).cwiseAbs().maxCoeff()
+					<< " (fp16: " << (input16 - expected).cwiseAbs().maxCoeff() << "); SparseEmbedding: "
+					<< t_legacy / repeat * 1e6 << " us/batch; EmbeddingBag: " << t_bag / repeat * 1e6
+					<< " us/batch; fp16: " << t_fp16 / repeat * 1e6 << " us/batch" << std::endl;
+		}
+	}
+
+private:
+	class FloatTable {
+		const float* data;
+		Eigen::Index rows_, cols_, stride;
+	public:
+		explicit FloatTable(const Eigen::Ref<const MatRowMajor>& m) :
+				data(m.data()), rows_(m.rows()), cols_(m.cols()), stride(m.outerStride()) {
+		}
+
+		inline size_t rows() const {
+			return rows_;
+		}
+
+		inline size_t cols() const {
+			return cols_;
+		}
+
+		template<typename KeyType>
+		inline bool valid(KeyType id) const {
+			return id >= 0 && (size_t) id < (size_t) rows_;
+		}
+
+		inline void prefetchRow(size_t r) const {
+#ifdef __GNUC__
+			const char* p = (const char*) (data + r * stride);
+			for (size_t i = 0; i < cols_ * sizeof(float); i += 64)
+				__builtin_prefetch(p + i, 0, 1);
+#endif
+		}
+
+		inline void axpyRow(size_t r, float w, float* acc) const {
+			axpy(data + r * stride, w, acc, cols_);
+		}
+	};
+
+	class QuantizedTable {
+		const QuantizedRows& table;
+	public:
+		explicit QuantizedTable(const QuantizedRows& table) :
+				table(table) {
+		}
+
+		inline size_t rows() const {
+			return table.rows();
+		}
+
+		inline size_t cols() const {
+			return table.cols();
+		}
+
+		template<typename KeyType>
+		inline bool valid(KeyType id) const {
+			return id >= 0 && (size_t) id < table.rows();
+		}
+
+		inline void prefetchRow(size_t r) const {
+			table.prefetchRow(r);
+		}
+
+		inline void axpyRow(size_t r, float w, float* acc) const {
+			table.axpyRow(r, w, acc);
+		}
+	};
+
+	template<typename KeyType>
+	static size_t checkBatch(const std::vector<size_t>& offsets, const std::vector<KeyType>& indices,
+			const std::vector<float>& weights, const Mat& input, Eigen::Index col_offset, Eigen::Index cols) {
+		if (offsets.empty() || offsets.back() != indices.size() || (!weights.empty() && weights.size() != indices.size()))
+			throw std::invalid_argument("EmbeddingBag: offsets, indices and weights do not match");
+		const size_t num_bags = offsets.size() - 1;
+		if ((Eigen::Index) num_bags > input.rows() || col_offset + cols > input.cols())
+			throw std::invalid_argument("EmbeddingBag: input matrix is too small");
+		return num_bags;
+	}
+
+	static std::vector<float>& thread_buffer() {
+		static thread_local std::vector<float> buffer;
+		return buffer;
+	}
+
+	static bool simdSupported() {
+#ifdef LC_EMBEDDINGBAG_SIMD_X86
+		static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+		return supported;
+#else
+		return false;
+#endif
+	}
+
+#ifdef LC_EMBEDDINGBAG_SIMD_X86
+	/**
+	 * acc += w * row 的前 n / 8 * 8 个数， 返回处理的个数
+	 */
+	__attribute__((target("avx2,fma")))
+	static size_t axpy_avx2(const float* row, float w, float* acc, size_t n) {
+		const size_t m = n / 8 * 8;
+		const __m256 wv = _mm256_set1_ps(w);
+		for (size_t c = 0; c < m; c += 8)
+			_mm256_storeu_ps(acc + c, _mm256_fmadd_ps(wv, _mm256_loadu_ps(row + c), _mm256_loadu_ps(acc + c)));
+		return m;
+	}
+#endif
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_EMBEDDINGBAG_HPP_ */
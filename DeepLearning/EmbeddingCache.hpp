@@ -0,0 +1,360 @@
+/*
+ * EmbeddingCache.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      sparse embedding 结果的缓存， 用于同一个 bag（如用户的历史行为）在一次请求的几百个候选中重复计算的场景：
+ *      1、key 为 bag 中 (id, weight) 序列的 MurmurHash3_x64_128（128位）、 表的地址和维数、 combiner；
+ *      2、容量固定， 用 CLOCK 算法淘汰（近似 LRU， 命中时只设置一个标记）；
+ *      3、两种作用域： RequestScope 在当前线程上创建一个只在本次请求中有效的小缓存（无竞争），
+ *         跨请求共享的缓存由调用者创建并传给 CachedSparseEmbedding， 用 mutex 保护；
+ *      4、bindGeneration 绑定 ModelSelector::getModelGeneration()， 切换模型后第一次访问时自动清空，
+ *         旧模型中的表即使与新模型的表地址相同也不会命中。
+ *      CachedSparseEmbedding 与 SparseEmbeddingFactory::get 返回的函数签名相同， 可以直接替换。
+ *
+ *      用法：
+ *      LC::EmbeddingCache shared(100000);
+ *      shared.bindGeneration(&ms.getModelGeneration());
+ *      LC::CachedSparseEmbedding<long long, float> embed("mean", &shared);
+ *      // 每个请求， 容量至少为请求中不同 bag 的个数（1个用户 bag + 每个候选的 bag）， 否则会被淘汰后重算
+ *      LC::EmbeddingCache::RequestScope scope(num_candidates + 1);
+ *      for (candidate ...)
+ *          input.segment(...) = embed(user_history, table);
+ */
+
+#ifndef LC_DEEPLEARNING_EMBEDDINGCACHE_HPP_
+#define LC_DEEPLEARNING_EMBEDDINGCACHE_HPP_
+
+#include "Embedding.hpp"
+#include "../utility/HashMurmur3.hpp"
+#include "../utility/Random.hpp"
+#include <stdint.h>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace LC {
+
+class EmbeddingCache {
+public:
+	struct Key {
+		uint64_t hash[2];
+		const void* table;
+		uint64_t tag;  ///< 表的维数与 combiner 等
+
+		inline bool operator==(const Key& k) const {
+			return hash[0] == k.hash[0] && hash[1] == k.hash[1] && table == k.table && tag == k.tag;
+		}
+	};
+
+	struct Stats {
+		unsigned long long hits;
+		unsigned long long misses;
+		unsigned long long evictions;
+		unsigned long long invalidations;  ///< 因为模型切换而清空的次数
+
+		Stats() :
+				hits(0), misses(0), evictions(0), invalidations(0) {
+		}
+
+		double hitRate() const {
+			return hits + misses > 0 ? (double) hits / (hits + misses) : 0;
+		}
+
+		string toString() const {
+			std::stringstream ss;
+			ss << "hits: " << hits << "; misses: " << misses << "; hit rate: " << hitRate() << "; evictions: "
+					<< evictions << "; invalidations: " << invalidations;
+			return ss.str();
+		}
+	};
+
+	explicit EmbeddingCache(size_t capacity = 4096) :
+			capacity(std::max<size_t>(capacity, 1)), hand(0), generation(NULL), seen_generation(0) {
+		slots.reserve(this->capacity);
+		index.reserve(this->capacity);
+	}
+
+	/**
+	 * 绑定模型的版本号（如 ModelSelector::getModelGeneration()）， 版本号变化后第一次访问时清空缓存
+	 */
+	void bindGeneration(const std::atomic<unsigned long long>* g) {
+		std::unique_lock<std::mutex> lock(mutex);
+		generation = g;
+		seen_generation = g != NULL ? g->load() : 0;
+	}
+
+	/**
+	 * @param tag 区分同一个表上不同的计算方式， 如 combiner 的 hash
+	 */
+	template<typename KeyType, typename WeightType>
+	static Key makeKey(const std::vector<std::pair<KeyType, WeightType> >& kvs, const Mat& table, uint64_t tag) {
+		// pair 中可能有填充的字节， 逐个复制为两个 uint64_t 后再计算 hash
+		static thread_local std::vector<uint64_t> buffer;
+		buffer.resize(kvs.size() * 2);
+		for (size_t i = 0; i < kvs.size(); ++i) {
+			uint64_t id = 0, w = 0;
+			std::memcpy(&id, &kvs[i].first, std::min(sizeof(KeyType), sizeof(uint64_t)));
+			std::memcpy(&w, &kvs[i].second, std::min(sizeof(WeightType), sizeof(uint64_t)));
+			buffer[2 * i] = id;
+			buffer[2 * i + 1] = w;
+		}
+		Key key;
+		LC::Murmur3::MurmurHash3_x64_128(buffer.data(), (int) (buffer.size() * sizeof(uint64_t)), 0x5EED, key.hash);
+		key.table = &table;
+		key.tag = tag ^ ((uint64_t) table.rows() << 32) ^ (uint64_t) table.cols();
+		return key;
+	}
+
+	bool find(const Key& key, RowVec& value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		checkGeneration();
+		std::unordered_map<Key, size_t, KeyHasher>::iterator it = index.find(key);
+		if (it == index.end()) {
+			++stats.misses;
+			return false;
+		}
+		++stats.hits;
+		slots[it->second].referenced = true;
+		value = slots[it->second].value;
+		return true;
+	}
+
+	void insert(const Key& key, const RowVec& value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		checkGeneration();
+		std::unordered_map<Key, size_t, KeyHasher>::iterator it = index.find(key);
+		if (it != index.end()) {
+			slots[it->second].value = value;
+			slots[it->second].referenced = true;
+			return;
+		}
+		size_t s;
+		if (slots.size() < capacity) {
+			s = slots.size();
+			slots.push_back(Slot());
+		} else {
+			// CLOCK： 跳过并清除最近访问过的， 淘汰第一个没有访问过的
+			while (slots[hand].referenced) {
+				slots[hand].referenced = false;
+				hand = (hand + 1) % capacity;
+			}
+			s = hand;
+			hand = (hand + 1) % capacity;
+			index.erase(slots[s].key);
+			++stats.evictions;
+		}
+		slots[s].key = key;
+		slots[s].value = value;
+		slots[s].referenced = false;
+		index[key] = s;
+	}
+
+	void clear() {
+		std::unique_lock<std::mutex> lock(mutex);
+		clear_locked();
+	}
+
+	size_t size() {
+		std::unique_lock<std::mutex> lock(mutex);
+		return slots.size();
+	}
+
+	Stats getStats() {
+		std::unique_lock<std::mutex> lock(mutex);
+		return stats;
+	}
+
+	void resetStats() {
+		std::unique_lock<std::mutex> lock(mutex);
+		stats = Stats();
+	}
+
+	class RequestScope;
+
+	/**
+	 * 当前线程的请求级缓存， 没有 RequestScope 时为NULL
+	 */
+	static EmbeddingCache*& current() {
+		static thread_local EmbeddingCache* cache = NULL;
+		return cache;
+	}
+
+private:
+	struct Slot {
+		Key key;
+		RowVec value;
+		bool referenced;
+	};
+
+	struct KeyHasher {
+		inline size_t operator()(const Key& k) const {
+			return k.hash[0] ^ k.tag;
+		}
+	};
+
+	const size_t capacity;
+	std::vector<Slot> slots;
+	std::unordered_map<Key, size_t, KeyHasher> index;
+	size_t hand;  ///< CLOCK 的指针
+	const std::atomic<unsigned long long>* generation;
+	unsigned long long seen_generation;
+	Stats stats;
+	std::mutex mutex;
+
+	EmbeddingCache(const EmbeddingCache&);
+	EmbeddingCache& operator=(const EmbeddingCache&);
+
+	void checkGeneration() {
+		if (generation == NULL)
+			return;
+		const unsigned long long g = generation->load();
+		if (g != seen_generation) {
+			clear_locked();
+			seen_generation = g;
+			++stats.invalidations;
+		}
+	}
+
+	void clear_locked() {
+		slots.clear();
+		index.clear();
+		hand = 0;
+	}
+};
+
+/**
+ * 本线程上的请求级缓存， 析构时恢复之前的缓存（可以嵌套）；
+ * 默认容量按一个用户 bag 加约500个候选 bag 的请求设置， 候选更多时应传入候选数 + 1
+ */
+class EmbeddingCache::RequestScope {
+	EmbeddingCache cache;
+	EmbeddingCache* previous;
+
+	RequestScope(const RequestScope&);
+	RequestScope& operator=(const RequestScope&);
+public:
+	explicit RequestScope(size_t capacity = 1024) :
+			cache(capacity), previous(current()) {
+		current() = &cache;
+	}
+
+	~RequestScope() {
+		current() = previous;
+	}
+
+	inline EmbeddingCache& get() {
+		return cache;
+	}
+};
+
+/**
+ * 带缓存的 sparse embedding： 依次查找当前线程的请求级缓存（EmbeddingCache::RequestScope）和共享的缓存，
+ * 都没有时计算， 并写入两个缓存
+ */
+template<typename KeyType = long long, typename WeightType = float>
+class CachedSparseEmbedding {
+public:
+	typedef typename SparseEmbeddingFactory<KeyType, WeightType>::SparseEmbeddingFunc SparseEmbeddingFunc;
+
+	/**
+	 * @param combiner 参见 SparseEmbeddingFactory::get
+	 * @param shared 跨请求共享的缓存， 为NULL时只使用请求级缓存
+	 */
+	CachedSparseEmbedding(const std::string& combiner, EmbeddingCache* shared = NULL) :
+			func(SparseEmbeddingFactory<KeyType, WeightType>::get(combiner)), shared(shared), tag(hashTag(combiner)) {
+	}
+
+	CachedSparseEmbedding(const SparseEmbeddingFunc& func, const std::string& name, EmbeddingCache* shared = NULL) :
+			func(func), shared(shared), tag(hashTag(name)) {
+	}
+
+	RowVec operator()(const std::vector<std::pair<KeyType, WeightType> >& kvs, const Mat& m) const {
+		EmbeddingCache* request = EmbeddingCache::current();
+		if (request == NULL && shared == NULL)
+			return func(kvs, m);
+		const EmbeddingCache::Key key = EmbeddingCache::makeKey(kvs, m, tag);
+		RowVec value;
+		if (request != NULL && request->find(key, value))
+			return value;
+		if (shared != NULL && shared->find(key, value)) {
+			if (request != NULL)
+				request->insert(key, value);
+			return value;
+		}
+		value = func(kvs, m);
+		if (request != NULL)
+			request->insert(key, value);
+		if (shared != NULL)
+			shared->insert(key, value);
+		return value;
+	}
+
+	/**
+	 * 模拟一次请求中同一个用户 bag 与 num_candidates 个候选 bag 的计算， 比较有无缓存的速度
+	 */
+	static void testEmbeddingCache(int rows = 100000, int cols = 32, int num_requests = 50, int num_candidates = 500,
+			int history = 100) {
+		std::cout << "\n---test LC::EmbeddingCache" << std::endl;
+		const Mat table = Mat::Random(rows, cols);
+		LC::RandomUniform<int, float> rnd(24);
+		rnd.set_param_i(0, rows - 1);
+		EmbeddingCache shared(10000);
+		std::atomic<unsigned long long> generation(0);
+		shared.bindGeneration(&generation);
+		CachedSparseEmbedding<long long, float> cached("mean_div_n", &shared);
+		SparseEmbeddingFunc plain = SparseEmbeddingFactory<long long, float>::get("mean_div_n");
+
+		float max_diff = 0;
+		double t_plain = 0, t_cached = 0;
+		for (int r = 0; r < num_requests; ++r) {
+			if (r == num_requests / 2)
+				generation.fetch_add(1);  // 模拟 ModelSelector 切换模型
+			std::vector<std::pair<long long, float> > user;
+			for (int i = 0; i < history; ++i)
+				user.push_back(std::make_pair((long long) rnd.randi(), 1.0f));
+			std::vector<std::vector<std::pair<long long, float> > > items(num_candidates);
+			for (int c = 0; c < num_candidates; ++c)
+				items[c].push_back(std::make_pair((long long) rnd.randi() % 1000, 1.0f));  // 候选来自较小的集合， 跨请求可以命中
+
+			Mat expected(num_candidates, 2 * cols), actual(num_candidates, 2 * cols);
+			LC::TimerAccurate timer;
+			for (int c = 0; c < num_candidates; ++c) {
+				expected.block(c, 0, 1, cols) = plain(user, table);
+				expected.block(c, cols, 1, cols) = plain(items[c], table);
+			}
+			t_plain += timer.getElapsedTimeAndRestart();
+			{
+				EmbeddingCache::RequestScope scope(num_candidates + 1);
+				for (int c = 0; c < num_candidates; ++c) {
+					actual.block(c, 0, 1, cols) = cached(user, table);
+					actual.block(c, cols, 1, cols) = cached(items[c], table);
+				}
+				if (r + 1 == num_requests)
+					std::cout << "request cache: " << scope.get().getStats().toString() << std::endl;
+			}
+			t_cached += timer.getElapsedTimeAndRestart();
+			max_diff = std::max(max_diff, (expected - actual).cwiseAbs().maxCoeff());
+		}
+		std::cout << "shared cache: " << shared.getStats().toString() << std::endl;
+		std::cout << "max abs diff: " << max_diff << "; no cache: " << t_plain / num_requests * 1e6
+				<< " us/request; cached: " << t_cached / num_requests * 1e6 << " us/request" << std::endl;
+	}
+
+private:
+	SparseEmbeddingFunc func;
+	EmbeddingCache* shared;
+	uint64_t tag;
+
+	static uint64_t hashTag(const std::string& name) {
+		uint64_t h[2];
+		const std::string lower = LC::Str::toLowerCase(name);
+		LC::Murmur3::MurmurHash3_x64_128(lower.data(), (int) lower.size(), 0, h);
+		return h[0];
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_EMBEDDINGCACHE_HPP_ */
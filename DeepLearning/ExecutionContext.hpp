@@ -0,0 +1,204 @@
+/*
+ * ExecutionContext.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      FeedForwardNet 的多线程执行环境， 用于离线打分等大 batch 的场景：
+ *      1、拥有一个 ThreadPool， 把 batch 的行切分为 row_threads 段并行计算， 每个线程有自己的 Workspace，
+ *         每段再按 tile_rows 行一块调用 forward_noalloc， 工作区大小与总行数无关；
+ *      2、gemm_threads 为每段内 Eigen 分块 GEMM（以及 Activation 中 OpenMP 循环）的线程数，
+ *         总线程数为 row_threads * gemm_threads。 只在定义 LC_EIGEN_PARALLELIZE 并用 -fopenmp 编译时有效（见 gemmParallelSupported）。
+ *         线程数通过 omp_set_num_threads 只设置在执行计算的线程上， 计算结束后恢复，
+ *         不会影响同一进程中其他线程（如在线服务）的并行度； 不要调用全局的 Eigen::setNbThreads， 否则会覆盖这里的设置。
+ *      在线服务通常每个请求很小， 应直接在服务线程中调用 forward_noalloc， 而不是使用本类。
+ *      运行期间不要修改 net 的层； 修改后先调用 net.prepare()。
+ *
+ *      用法：
+ *      LC::ExecutionContext ctx(net, 8);  // 8 个线程按行切分
+ *      Mat output;
+ *      ctx.forward(input, output);        // 与 net.forward(input) 结果相同
+ *      ctx.forward(input, output, 4);     // 本次调用中每段的 GEMM 用 4 个线程
+ */
+
+#ifndef LC_DEEPLEARNING_EXECUTIONCONTEXT_HPP_
+#define LC_DEEPLEARNING_EXECUTIONCONTEXT_HPP_
+
+#include "FeedForwardNet.hpp"
+#include "../utility/ThreadPool.hpp"
+#include <mutex>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace LC {
+
+class ExecutionContext {
+public:
+	/**
+	 * 在当前线程上设置 OpenMP（Eigen GEMM）的线程数， 析构时恢复； 没有 OpenMP 时什么也不做
+	 */
+	class GemmThreadsScope {
+		int previous;
+
+		GemmThreadsScope(const GemmThreadsScope&);
+		GemmThreadsScope& operator=(const GemmThreadsScope&);
+	public:
+		explicit GemmThreadsScope(int num_threads) :
+				previous(0) {
+#ifdef _OPENMP
+			previous = omp_get_max_threads();
+			omp_set_num_threads(std::max(num_threads, 1));
+#else
+			(void) num_threads;
+#endif
+		}
+
+		~GemmThreadsScope() {
+#ifdef _OPENMP
+			omp_set_num_threads(previous);
+#endif
+		}
+	};
+
+	/**
+	 * @param row_threads 线程池的线程数， 为0时使用 CPU 核数
+	 * @param gemm_threads 默认每段 GEMM 的线程数， 可以在 forward 中为单次调用指定
+	 * @param tile_rows 每次 forward_noalloc 的最大行数， 决定每个线程工作区的大小
+	 * @param min_rows_per_thread 每段的最少行数， 小 batch 不会切分到所有线程
+	 */
+	explicit ExecutionContext(FeedForwardNet& net, unsigned int row_threads = 0, int gemm_threads = 1,
+			Eigen::Index tile_rows = 4096, Eigen::Index min_rows_per_thread = 256) :
+			net(net), pool(row_threads), gemm_threads(std::max(gemm_threads, 1)), tile_rows(
+					std::max<Eigen::Index>(tile_rows, 1)), min_rows_per_thread(std::max<Eigen::Index>(min_rows_per_thread, 1)), states(
+					pool.size()) {
+		net.prepare();
+	}
+
+	/**
+	 * Eigen 的 GEMM 是否可以多线程（LC_EIGEN_PARALLELIZE + -fopenmp）， 否则 gemm_threads 不起作用
+	 */
+	static bool gemmParallelSupported() {
+#ifdef EIGEN_HAS_OPENMP
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	inline unsigned int rowThreads() const {
+		return pool.size();
+	}
+
+	inline int gemmThreads() const {
+		return gemm_threads;
+	}
+
+	/**
+	 * 与 net.forward(input) 结果相同； input 可以是 Mat 或 MatRowMajor。
+	 * 同一时刻只执行一个调用， 多个线程同时调用时依次执行
+	 * @param gemm_threads 本次调用中每段 GEMM 的线程数， 为0时使用构造时的设置
+	 */
+	template<typename Derived>
+	void forward(const Eigen::MatrixBase<Derived>& input, Mat& output, int gemm_threads = 0) {
+		std::unique_lock<std::mutex> lock(call_mutex);
+		const Eigen::Index rows = input.rows(), cols = input.cols();
+		output.resize(rows, net.outputWidth(cols));
+		if (rows == 0)
+			return;
+		const int threads_per_task = gemm_threads > 0 ? gemm_threads : this->gemm_threads;
+		const size_t num_tasks = std::max<size_t>(1,
+				std::min<size_t>(pool.size(), (size_t) (rows / min_rows_per_thread)));
+		std::vector<std::future<void> > futures;
+		for (size_t t = 0; t < num_tasks; ++t) {
+			const Eigen::Index begin = rows * t / num_tasks;
+			const Eigen::Index end = rows * (t + 1) / num_tasks;
+			ThreadState* state = &states[t];
+			futures.push_back(pool.submit([this, &input, &output, state, begin, end, threads_per_task]() {
+				GemmThreadsScope scope(threads_per_task);
+				run(input, output, *state, begin, end);
+			}));
+		}
+		for (size_t t = 0; t < futures.size(); ++t)
+			futures[t].wait();
+		for (size_t t = 0; t < futures.size(); ++t)
+			futures[t].get();
+	}
+
+	template<typename Derived>
+	Mat forward(const Eigen::MatrixBase<Derived>& input, int gemm_threads = 0) {
+		Mat output;
+		forward(input, output, gemm_threads);
+		return output;
+	}
+
+	/**
+	 * 随机生成网络， 比较 forward 与 net.forward 的结果， 并输出不同 row_threads 和 gemm_threads 下的吞吐
+	 */
+	static void testExecutionContext(int rows = 20000, int input_width = 256, int repeat = 3) {
+		std::cout << "\n---test LC::ExecutionContext, cores: " << ThreadPool::default_num_threads()
+				<< "; eigen gemm parallel: " << gemmParallelSupported() << std::endl;
+		FeedForwardNet net;
+		const int widths[] = { input_width, 512, 256, 1 };
+		for (int l = 0; l + 1 < 4; ++l) {
+			net.addAffine(Mat::Random(widths[l], widths[l + 1]), RowVec::Random(widths[l + 1]));
+			if (l + 2 < 4)
+				net.addReLU();
+		}
+		const Mat input = Mat::Random(rows, input_width);
+		LC::TimerAccurate timer;
+		const Mat expected = net.forward(input);
+		std::cout << "net.forward: " << rows / timer.getElapsedTime() << " rows/sec" << std::endl;
+
+		const unsigned int cores = ThreadPool::default_num_threads();
+		for (unsigned int row_threads = 1; row_threads <= std::max(cores, 2u); row_threads *= 2) {
+			ExecutionContext ctx(net, row_threads);
+			Mat output;
+			ctx.forward(input, output);
+			const float max_diff = (output - expected).cwiseAbs().maxCoeff();
+			const int gemm_options[] = { 1, (int) std::max(cores / row_threads, 1u) };
+			for (int g = 0; g < (gemm_options[1] > 1 ? 2 : 1); ++g) {
+				timer.getElapsedTimeAndRestart();
+				for (int r = 0; r < repeat; ++r)
+					ctx.forward(input, output, gemm_options[g]);
+				std::cout << "row threads: " << row_threads << "; gemm threads: " << gemm_options[g] << "; "
+						<< (double) rows * repeat / timer.getElapsedTime() << " rows/sec; max abs diff: " << max_diff
+						<< std::endl;
+			}
+		}
+	}
+
+private:
+	struct ThreadState {
+		FeedForwardNet::Workspace ws;
+		ColVec input;  ///< 一个 tile 的输入（列优先）， 容量只增不减
+	};
+
+	FeedForwardNet& net;
+	ThreadPool pool;
+	const int gemm_threads;
+	const Eigen::Index tile_rows;
+	const Eigen::Index min_rows_per_thread;
+	std::vector<ThreadState> states;  ///< 按段的序号使用， 段数不超过线程数
+	std::mutex call_mutex;
+
+	ExecutionContext(const ExecutionContext&);
+	ExecutionContext& operator=(const ExecutionContext&);
+
+	template<typename Derived>
+	void run(const Eigen::MatrixBase<Derived>& input, Mat& output, ThreadState& state, Eigen::Index begin,
+			Eigen::Index end) {
+		const Eigen::Index cols = input.cols();
+		for (Eigen::Index r = begin; r < end; r += tile_rows) {
+			const Eigen::Index n = std::min(tile_rows, end - r);
+			if (state.input.size() < n * cols)
+				state.input.resize(n * cols);
+			Eigen::Map<Mat> tile(state.input.data(), n, cols);
+			tile = input.middleRows(r, n);
+			output.middleRows(r, n) = net.forward_noalloc(tile.data(), n, cols, state.ws);
+		}
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_EXECUTIONCONTEXT_HPP_ */
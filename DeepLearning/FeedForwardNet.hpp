@@ -1,18 +1,26 @@
 #pragma once
 #ifndef HAS_INCLUDE_EIGEN
 #define HAS_INCLUDE_EIGEN
+#ifndef LC_EIGEN_PARALLELIZE  // 定义 LC_EIGEN_PARALLELIZE 并用 -fopenmp 编译时 Eigen 的 GEMM 可以多线程， 见 ExecutionContext
 #define EIGEN_DONT_PARALLELIZE
+#endif
 #include <Eigen/Core>
 #endif
 
 #include <vector>
 
 #include <iostream>
+#include <sstream>
+#include <cstdlib>
 #include <utility>
 #include <map>
+#include <functional>
 
 #include "../IO/BinaryIO.hpp"
 #include "../utility/StringUtil.hpp"
+#include "../utility/Timer.hpp"
+#include "QuantizedWeights.hpp"
+#include "Activation.hpp"
 
 using std::vector;
 using std::string;
@@ -41,8 +49,9 @@ class INetLayer_Affine: public INetLayer {  //Affine和 AffineBatchNorm的逻辑
 public:
 	Mat W;
 	RowVec b;
-	INetLayer_Affine(const Mat& W, const RowVec& b) :
-			W(W), b(b) {
+	bool relu;  ///< 为true时输出再经过ReLU， 由 FeedForwardNet::fuseLayers 合并后面的 ReLU 层得到
+	INetLayer_Affine(const Mat& W, const RowVec& b, bool relu = false) :
+			W(W), b(b), relu(relu) {
 	}
 
 	virtual Mat& forward(Mat& input) {
@@ -55,6 +64,8 @@ public:
 		std::cout<<"input: "<<input<<std::endl;
 #endif
 		input = (input * W).rowwise() + b;
+		if (relu)
+			input = input.cwiseMax(Scalar(0));
 #ifdef LCDebug2
 		std::cout<<"output: "<<input<<std::endl;
 		std::cout<<"~~\n"<<std::endl;
@@ -96,15 +107,8 @@ public:
 	INetLayer_ReLU() {
 	}
 
-	static Mat& relu(Mat& input) {
-		const unsigned int sizeInput = input.rows() * input.cols();
-		Scalar* data = input.data();
-#pragma omp parallel for
-		for (unsigned int i = 0; i < sizeInput; ++i) {
-			if (data[i] < 0)
-				data[i] = 0;
-		}
-
+	static Mat& relu(Mat& input) {  // 向量化， 元素个数不少于 Activation::parallelThreshold() 时才并行
+		Activation::apply(Activation::RELU, input.data(), input.size());
 		return input;
 	}
 
@@ -113,13 +117,7 @@ public:
 		std::cout<<"----ReLU:"<<std::endl;
 		std::cout<<"input: "<<input<<std::endl;
 #endif
-		const unsigned int sizeInput = input.rows() * input.cols();
-		Scalar* data = input.data();
-#pragma omp parallel for
-		for (unsigned int i = 0; i < sizeInput; ++i) {
-			if (data[i] < 0)
-				data[i] = 0;
-		}
+		relu(input);
 #ifdef LCDebug2
 		std::cout<<"output: "<<input<<std::endl;
 		std::cout<<"~~\n"<<std::endl;
@@ -129,6 +127,23 @@ public:
 
 };
 
+/**
+ * ReLU 之外的激活函数： LeakyReLU、Sigmoid、Tanh、GELU， 见 Activation
+ */
+class INetLayer_Activation: public INetLayer {
+public:
+	Activation::Type type;
+	float alpha;  ///< LeakyReLU 负半轴的斜率
+	INetLayer_Activation(Activation::Type type, float alpha = 0.01f) :
+			type(type), alpha(alpha) {
+	}
+
+	virtual Mat& forward(Mat& input) {
+		Activation::apply(type, input.data(), input.size(), alpha);
+		return input;
+	}
+};
+
 class INetLayer_Residual_AffineReLU: public INetLayer {
 public:
 	Mat W;
@@ -146,19 +161,133 @@ public:
 
 };
 
+/**
+ * 低精度权重的 Affine 层， 由 FeedForwardNet::quantizeWeights 从 INetLayer_Affine 转换得到。
+ * Wt 保存 W 的转置（每行一个输出通道， INT8 时每个通道单独的 scale）， 计算时用 float 或 int32 累加
+ */
+class INetLayer_QuantizedAffine: public INetLayer {
+public:
+	QuantizedRows Wt;
+	RowVec b;
+	bool relu;
+	INetLayer_QuantizedAffine(const Mat& W, const RowVec& b, bool relu, WeightType type) :
+			Wt(type, W.data(), W.cols(), W.rows()), b(b), relu(relu) {  // 列优先的 W 就是行优先的 W 的转置
+	}
+
+	/**
+	 * out = in * W， in 为 rows x Wt.cols()， out 为 rows x Wt.rows()， 都是列优先
+	 */
+	inline void multiply(const Scalar* in, Eigen::Index rows, Scalar* out) const {
+		Wt.matmul(in, rows, 1, rows, out, 1, rows);
+	}
+
+	virtual Mat& forward(Mat& input) {
+		if (input.cols() != (Eigen::Index) Wt.cols())
+			throw string("QuantizedAffine: input width does not match W");
+		Mat out(input.rows(), Wt.rows());
+		multiply(input.data(), input.rows(), out.data());
+		out.rowwise() += b;
+		if (relu)
+			out = out.cwiseMax(Scalar(0));
+		input.swap(out);
+		return input;
+	}
+};
+
+/**
+ * FeedForwardNet::fuseLayers 的统计： 每个被合并掉的层都少了一次对整个激活值的遍历
+ */
+struct FusionReport {
+	unsigned int layers_before;
+	unsigned int layers_after;
+	unsigned int folded_batchnorm;  ///< 折叠进相邻 Affine 的 W、b， 或与相邻 BatchNorm 合并
+	unsigned int merged_relu;       ///< 合并为 Affine 的 ReLU， 或多余的 ReLU
+	unsigned int collapsed_affine;  ///< 合并的相邻 Affine
+	Scalar max_abs_diff;            ///< 与合并前的网络在随机输入上的最大输出差值， -1 为没有验证
+
+	FusionReport() :
+			layers_before(0), layers_after(0), folded_batchnorm(0), merged_relu(0), collapsed_affine(0), max_abs_diff(-1) {
+	}
+
+	inline unsigned int passes_removed() const {
+		return layers_before - layers_after;
+	}
+
+	string toString() const {
+		std::stringstream ss;
+		ss << "layers: " << layers_before << " -> " << layers_after << " (" << passes_removed()
+				<< " passes removed; batchnorm folded: " << folded_batchnorm << ", relu merged: " << merged_relu
+				<< ", affine collapsed: " << collapsed_affine << ")";
+		if (max_abs_diff >= 0)
+			ss << "; max abs diff: " << max_abs_diff;
+		return ss.str();
+	}
+};
+
 /////////////////////////////////////////////////////////////
 class FeedForwardNet {
 public:
 	vector<INetLayer*> layers;
 
+	/**
+	 * forward_noalloc 使用的工作区： 两块交替使用（ping-pong）的激活值缓冲区。
+	 * 容量只增不减， 容量足够时 forward_noalloc 不再分配内存； 不是线程安全的， 每个线程各用一个
+	 */
+	class Workspace {
+	public:
+		ColVec ping, pong;  // Eigen 的内存是对齐的
+
+		void reserve(Eigen::Index size) {
+			if (ping.size() < size)
+				ping.resize(size);
+			if (pong.size() < size)
+				pong.resize(size);
+		}
+
+		inline Scalar* buffer(int i) {
+			return i == 0 ? ping.data() : pong.data();
+		}
+	};
+
+	/**
+	 * 合并后的一步计算， 每一步只遍历一次激活值：
+	 * AFFINE:    out = relu?(((in * W + b) * bn_W) + bn_b)， 合并了紧随其后的 BatchNorm 和 ReLU， W 为NULL时使用量化的 Wq
+	 * RESIDUAL:  out = relu(in * W + b) + in
+	 * BATCHNORM: 原地计算 relu?(in * bn_W + bn_b)， 前面不是 Affine 的 BatchNorm
+	 * RELU:      原地计算 relu(in)， 前面不能合并的 ReLU
+	 * ACTIVATION: 原地计算 activation(in)， 前面不能合并的 INetLayer_Activation
+	 * 前四种之后紧随的 INetLayer_Activation 作为 epilogue 的最后一步（activation）。
+	 * 运算顺序与逐层 forward 相同， 结果一致
+	 */
+	struct FusedStep {
+		enum Kind {
+			AFFINE, RESIDUAL, BATCHNORM, RELU, ACTIVATION
+		};
+		Kind kind;
+		const Mat* W;
+		const QuantizedRows* Wq;
+		const RowVec* b;
+		const RowVec* bn_W;  ///< 为NULL时没有 BatchNorm
+		const RowVec* bn_b;
+		RowVec zero_b;  ///< BATCHNORM 的 b
+		bool relu;
+		Activation::Type activation;  ///< 最后计算的激活函数
+		float alpha;
+		unsigned int num_layers;  ///< 合并的层数
+	};
+
 	static string extractVarName(const string& varStr) { //"W=f256x128"    -->  "W"
 		return LC::Str::split(varStr, '=')[0];
 	}
 
-	static std::pair<unsigned int, unsigned int> extractRowsAndCols(const string& varStr) { //"W=f256x128"    -->  (256,128)
+	static char extractElementType(const string& varStr) { //"W=f256x128"    -->  'f'
+		return LC::Str::split(varStr, '=')[1][0];
+	}
+
+	static std::pair<unsigned int, unsigned int> extractRowsAndCols(const string& varStr, bool floatOnly = true) { //"W=f256x128"    -->  (256,128)
 
 		string WStr = LC::Str::split(varStr, '=')[1]; //W=f2x2-->  f2x2
-		if (WStr[0] != 'f')
+		if (floatOnly && WStr[0] != 'f')
 			throw string("feed forward net only support float matrix now");
 		WStr = WStr.substr(1);
 		int rows = 1, cols = 1;
@@ -176,17 +305,11 @@ public:
 	}
 
 	static Mat loadOneMat_from_binaryFile(LC::BinaryFileIO& bf, std::pair<unsigned int, unsigned int> rc) {
-		unsigned int rows = rc.first;
-		unsigned int cols = rc.second;
-		Mat m(rows, cols);
-		for (unsigned int r = 0; r < rows; r++) {
-			for (unsigned int c = 0; c < cols; c++) {
-				m(r, c) = bf.readBinaryNumber<float>();
-//				std::cout << m(r, c) <<",";
-			}
-//			throw "asdf";
-//			std::cout<<std::endl;
-		}
+		// 文件中按行存储， 一次读入整个矩阵后再转为列优先
+		MatRowMajor m(rc.first, rc.second);
+		bf.read((char*) m.data(), sizeof(float) * m.size());
+		if (!bf)
+			throw string("unexpected end of file when loading matrix");
 		return m;
 	}
 
@@ -217,12 +340,123 @@ public:
 		return map_varName2Mat;
 	}
 
-	std::string loadNetStructure(const std::string& filename, bool printVerboseInfo = false) {
+	/**
+	 * 加载 embedding 表并按行量化， 不保留完整的 fp32 矩阵。 文件中每个变量的元素类型：
+	 * 'f'： 与 loadLookUps 相同的 float， 加载时量化为 type；
+	 * 'h' / 'b'： 行优先的 fp16 / bf16；
+	 * 'q'： 每行先是一个 float 的 scale， 再是 cols 个 int8。
+	 * 后三种由 saveQuantizedLookUps 生成， 按文件中的类型加载， 忽略 type
+	 */
+	static std::map<string, QuantizedRows> loadQuantizedLookUps(const std::string& filename, WeightType type) {
+		LC::BinaryFileIO bf(filename.c_str());
+		std::string info;
+		std::getline(bf, info);
+		std::vector<string> vars = LC::Str::split(info, '&');
+		cout << "\n-------- Loading quantized embedding lookups: " << filename << endl;
+		cout << "vars:" << info << endl;
+		std::map<string, QuantizedRows> tables;
+		for (unsigned int i = 0; i < vars.size(); ++i) {
+			const string& varStr = vars[i];
+			if (varStr.size() < 3)
+				continue;  // maybe the last one is empty
+			cout << "\tloading " << varStr << endl;
+			const char elementType = extractElementType(varStr);
+			const std::pair<unsigned int, unsigned int> rc = extractRowsAndCols(varStr, false);
+			if (elementType == 'f') {
+				QuantizedRows table(type, rc.first, rc.second);
+				std::vector<float> row(rc.second);
+				for (unsigned int r = 0; r < rc.first; ++r) {
+					bf.read((char*) row.data(), sizeof(float) * rc.second);
+					table.setRow(r, row.data());
+				}
+				tables[extractVarName(varStr)] = table;
+			} else {
+				const WeightType stored = QuantizedRows::parseWeightType(string(1, elementType));
+				QuantizedRows table(stored, rc.first, rc.second);
+				std::vector<int8_t> q(rc.second);
+				std::vector<uint16_t> h(rc.second);
+				for (unsigned int r = 0; r < rc.first; ++r) {
+					if (stored == WEIGHT_INT8) {
+						const float scale = bf.readBinaryNumber<float>();
+						bf.read((char*) q.data(), rc.second);
+						table.setRowInt8(r, scale, q.data());
+					} else {
+						bf.read((char*) h.data(), sizeof(uint16_t) * rc.second);
+						table.setRowHalf(r, h.data());
+					}
+				}
+				tables[extractVarName(varStr)] = table;
+			}
+			if (!bf)
+				throw string("unexpected end of file: ") + filename;
+		}
+		cout << endl;
+		return tables;
+	}
+
+	/**
+	 * 保存为 loadQuantizedLookUps 可以直接加载的文件， FP32 的表保存为 'f'
+	 */
+	static void saveQuantizedLookUps(const std::string& filename, const std::map<string, QuantizedRows>& tables) {
+		LC::BinaryFileIO bf(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		std::stringstream info;
+		for (std::map<string, QuantizedRows>::const_iterator it = tables.begin(); it != tables.end(); ++it)
+			info << it->first << "=" << QuantizedRows::typeChar(it->second.type()) << it->second.rows() << "x"
+					<< it->second.cols() << "&";
+		bf << info.str() << "\n";
+		for (std::map<string, QuantizedRows>::const_iterator it = tables.begin(); it != tables.end(); ++it) {
+			const QuantizedRows& t = it->second;
+			std::vector<float> row(t.cols());
+			for (size_t r = 0; r < t.rows(); ++r) {
+				if (t.type() == WEIGHT_INT8) {
+					bf.writeBinaryNumber<float>(t.scale(r));
+					bf.write((const char*) t.int8Row(r), t.cols());
+				} else if (t.type() == WEIGHT_FP32) {
+					t.dequantizeRow(r, row.data());
+					bf.writeBinaryNumbers(row.data(), row.size());
+				} else {
+					bf.write((const char*) t.halfRow(r), sizeof(uint16_t) * t.cols());
+				}
+			}
+		}
+	}
+
+	/**
+	 * 量化 loadLookUps 加载的表， 打印每个表的内存和误差
+	 */
+	static std::map<string, QuantizedRows> quantizeLookUps(const std::map<string, Mat>& lookUps, WeightType type,
+			bool printReport = true) {
+		std::map<string, QuantizedRows> tables;
+		for (std::map<string, Mat>::const_iterator it = lookUps.begin(); it != lookUps.end(); ++it) {
+			const MatRowMajor m = it->second;
+			QuantizedRows table(type, m.data(), m.rows(), m.cols());
+			if (printReport)
+				cout << "quantize " << it->first << ": " << table.drift(m.data()).toString() << endl;
+			tables[it->first] = table;
+		}
+		return tables;
+	}
+
+	/**
+	 * @param fuse 为true时加载后调用 fuseLayers 合并可以合并的层， 并打印统计和验证结果
+	 */
+	std::string loadNetStructure(const std::string& filename, bool printVerboseInfo = false, bool fuse = false) {
 		std::cout << "\n-------- Loading feed forward net: " << filename << std::endl;
 		LC::BinaryFileIO bf(filename.c_str());
 		std::string info;
 		std::getline(bf, info);
+		parseNetStructure(info, [&bf](const string& varStr) {
+			return loadOneMat_from_binaryFile(bf, extractRowsAndCols(varStr));
+		}, printVerboseInfo, fuse);
+		return info;
+	}
 
+	/**
+	 * 按文件头 info（如 "Affine&W=f256x128&b=f128|ReLU|..."）添加各层， 参数矩阵按出现的顺序由 loadMat(varStr) 提供，
+	 * loadNetStructure 从文件中依次读取， MappedWeights::loadNet 从 mmap 的文件中复制
+	 */
+	void parseNetStructure(const std::string& info, const std::function<Mat(const string&)>& loadMat,
+			bool printVerboseInfo = false, bool fuse = false) {
 		std::vector<string> layerStrs = LC::Str::split(info, '|');
 		for (unsigned int idx = 0; idx < layerStrs.size(); ++idx) {  // layers
 			std::string layerStr = layerStrs[idx];
@@ -244,8 +478,8 @@ public:
 			if (layerName.compare("Affine") == 0 || layerName.compare("Affine_BatchNorm") == 0) {  //
 				if (layerParams.size() - 1 != 2)
 					throw string("Affine or Affine_BatchNorm Layer should have two parameters");
-				Mat W = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[1]));
-				Mat bMat = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[2]));
+				Mat W = loadMat(layerParams[1]);
+				Mat bMat = loadMat(layerParams[2]);
 				RowVec b = bMat;
 				this->addAffine(W, b);
 
@@ -259,11 +493,19 @@ public:
 
 			} else if (layerName.compare("ReLU") == 0) {
 				this->addReLU();
+			} else if (Activation::isActivation(layerName)) {  // LeakyReLU&alpha=0.2 | Sigmoid | Tanh | GELU
+				float alpha = 0.01f;
+				for (unsigned int p = 1; p < layerParams.size(); ++p) {
+					std::vector<string> kv = LC::Str::split(layerParams[p], '=');
+					if (kv.size() == 2 && kv[0] == "alpha")
+						alpha = std::atof(kv[1].c_str());
+				}
+				this->addActivation(Activation::parse(layerName), alpha);
 			} else if (layerName.compare("BatchNorm") == 0) {
 				if (layerParams.size() - 1 != 2)
 					throw string("BatchNorm Layer should have two parameters");
-				Mat WMat = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[1]));
-				Mat bMat = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[2]));
+				Mat WMat = loadMat(layerParams[1]);
+				Mat bMat = loadMat(layerParams[2]);
 				RowVec W = WMat;
 				RowVec b = bMat;
 				this->addBatchNorm(W, b);
@@ -280,8 +522,8 @@ public:
 			} else if (layerName.compare("Residual_AffineReLU") == 0) {
 				if (layerParams.size() - 1 != 2)
 					throw string("Residual_AffineReLU Layer should have two parameters");
-				Mat WMat = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[1]));
-				Mat bMat = loadOneMat_from_binaryFile(bf, extractRowsAndCols(layerParams[2]));
+				Mat WMat = loadMat(layerParams[1]);
+				Mat bMat = loadMat(layerParams[2]);
 				RowVec b = bMat;
 				this->addResidual_AffineReLU(WMat, b);
 
@@ -303,7 +545,10 @@ public:
 
 		}
 		std::cout << std::endl;
-		return info;
+		if (fuse)
+			std::cout << "fuse layers: " << fuseLayers().toString() << std::endl;
+		else
+			prepare();
 	}
 
 	void clear() {
@@ -311,6 +556,10 @@ public:
 			delete layers[i];
 		}
 		layers.clear();
+		plan.clear();
+	}
+	FeedForwardNet() :
+			max_width(0), planned_layers(0) {
 	}
 	~ FeedForwardNet() {
 		clear();
@@ -332,6 +581,13 @@ public:
 		layers.push_back(new INetLayer_ReLU());
 	}
 
+	void addActivation(Activation::Type type, float alpha = 0.01f) {
+		if (type == Activation::RELU)
+			addReLU();
+		else
+			layers.push_back(new INetLayer_Activation(type, alpha));
+	}
+
 	Mat forward(const Mat& input) {  ///< 会首先复制一份input， 最后的输出不会覆盖input
 #ifdef LCDebug2
 			std::cout<<"\n------Begin FFN forward:"<<std::endl;
@@ -358,6 +614,530 @@ public:
 #endif
 		return input;
 	}
+
+	/**
+	 * 生成 forward_noalloc 使用的合并计划， 并计算各层输出的最大宽度。
+	 * loadNetStructure、 fuseLayers、 quantizeWeights 结束时会自动调用； 用 add* 追加层后， 第一次调用 forward_noalloc 时
+	 * 也会自动调用（只比较层数）。 直接替换、 删除 layers 中的层或修改已有层的参数（W、 b 等）后必须显式调用 prepare，
+	 * 否则合并计划中的指针会失效。 多线程使用前应先调用一次
+	 */
+	void prepare() {
+		plan.clear();
+		max_width = 0;
+		for (unsigned int i = 0; i < layers.size();) {
+			FusedStep step;
+			step.W = NULL;
+			step.Wq = NULL;
+			step.b = NULL;
+			step.bn_W = NULL;
+			step.bn_b = NULL;
+			step.relu = false;
+			step.activation = Activation::IDENTITY;
+			step.alpha = 0;
+			step.num_layers = 1;
+			INetLayer_Affine* affine = dynamic_cast<INetLayer_Affine*>(layers[i]);
+			INetLayer_QuantizedAffine* quantized = dynamic_cast<INetLayer_QuantizedAffine*>(layers[i]);
+			if (affine != NULL || quantized != NULL) {
+				step.kind = FusedStep::AFFINE;
+				if (affine != NULL) {
+					step.W = &affine->W;
+					step.b = &affine->b;
+					step.relu = affine->relu;
+				} else {
+					step.Wq = &quantized->Wt;
+					step.b = &quantized->b;
+					step.relu = quantized->relu;
+				}
+				max_width = std::max<Eigen::Index>(max_width, step.b->size());
+				if (!step.relu && i + step.num_layers < layers.size()) {  // ReLU 在 BatchNorm 之前时不能合并 BatchNorm
+					if (INetLayer_BatchNorm* bn = dynamic_cast<INetLayer_BatchNorm*>(layers[i + step.num_layers])) {
+						step.bn_W = &bn->W;
+						step.bn_b = &bn->b;
+						++step.num_layers;
+					}
+				}
+			} else if (INetLayer_Residual_AffineReLU* residual = dynamic_cast<INetLayer_Residual_AffineReLU*>(layers[i])) {
+				if (residual->W.rows() != residual->W.cols())
+					throw string("Residual_AffineReLU Layer should have a square W");
+				step.kind = FusedStep::RESIDUAL;
+				step.W = &residual->W;
+				step.b = &residual->b;
+				step.relu = true;
+				max_width = std::max<Eigen::Index>(max_width, residual->W.cols());
+				absorbActivation(step, i);
+				plan.push_back(step);
+				i += step.num_layers;
+				continue;  // 残差之后的 ReLU 在相加之后， 不能合并到 relu
+			} else if (INetLayer_BatchNorm* bn = dynamic_cast<INetLayer_BatchNorm*>(layers[i])) {
+				step.kind = FusedStep::BATCHNORM;
+				step.bn_W = &bn->W;
+				step.bn_b = &bn->b;
+			} else if (dynamic_cast<INetLayer_ReLU*>(layers[i])) {
+				step.kind = FusedStep::RELU;
+				step.relu = true;
+				plan.push_back(step);
+				i += step.num_layers;
+				continue;
+			} else if (INetLayer_Activation* act = dynamic_cast<INetLayer_Activation*>(layers[i])) {
+				step.kind = FusedStep::ACTIVATION;
+				step.activation = act->type;
+				step.alpha = act->alpha;
+				plan.push_back(step);
+				i += step.num_layers;
+				continue;
+			} else {
+				throw string("forward_noalloc: unsupported layer type");
+			}
+			if (i + step.num_layers < layers.size() && dynamic_cast<INetLayer_ReLU*>(layers[i + step.num_layers])) {
+				step.relu = true;
+				++step.num_layers;
+			}
+			absorbActivation(step, i);
+			plan.push_back(step);
+			i += step.num_layers;
+		}
+		for (unsigned int k = 0; k < plan.size(); ++k) {  // plan 不再扩容之后再取地址
+			if (plan[k].kind == FusedStep::BATCHNORM) {
+				plan[k].zero_b = RowVec::Zero(plan[k].bn_W->size());
+				plan[k].b = &plan[k].zero_b;
+			}
+		}
+		planned_layers = layers.size();
+	}
+
+	/**
+	 * 加载后的图优化， 直接修改 layers， 不改变网络的数学含义：
+	 * 1、Affine + BatchNorm    -> Affine： W' = W * diag(bn_W)， b' = b * bn_W + bn_b；
+	 * 2、BatchNorm + Affine    -> Affine： W' = diag(bn_W) * W， b' = bn_b * W + b；
+	 * 3、BatchNorm + BatchNorm -> BatchNorm；
+	 * 4、Affine + ReLU -> Affine(relu=true)， 连续的 ReLU 只保留一个；
+	 * 5、中间没有非线性的 Affine + Affine -> Affine： W' = W1 * W2， b' = b1 * W2 + b2，
+	 *    只在乘法次数不增加时合并（K*N <= K*M + M*N）， 避免展开 256->8->256 这样的瓶颈层。
+	 * 折叠后浮点运算的顺序变了， 结果与原网络有舍入误差；
+	 * verify_rows > 0 时用随机输入比较优化前后的输出， 最大差值记在返回值中
+	 */
+	FusionReport fuseLayers(int verify_rows = 16) {
+		FusionReport report;
+		report.layers_before = layers.size();
+		Mat verify_input, expected;
+		const Eigen::Index input_width = inputWidth();
+		if (verify_rows > 0 && input_width > 0) {
+			verify_input = Mat::Random(verify_rows, input_width);
+			expected = forward(verify_input);
+		}
+
+		for (unsigned int i = 0; i + 1 < layers.size();) {
+			INetLayer_Affine* affine = dynamic_cast<INetLayer_Affine*>(layers[i]);
+			INetLayer_BatchNorm* bn = dynamic_cast<INetLayer_BatchNorm*>(layers[i]);
+			INetLayer_Affine* next_affine = dynamic_cast<INetLayer_Affine*>(layers[i + 1]);
+			INetLayer_BatchNorm* next_bn = dynamic_cast<INetLayer_BatchNorm*>(layers[i + 1]);
+			const bool next_relu = dynamic_cast<INetLayer_ReLU*>(layers[i + 1]) != NULL;
+			const bool relu_output = (affine != NULL && affine->relu) || dynamic_cast<INetLayer_ReLU*>(layers[i]) != NULL;
+			if (affine != NULL && !affine->relu && next_bn != NULL) {
+				affine->W.array().rowwise() *= next_bn->W.array();
+				affine->b = affine->b.cwiseProduct(next_bn->W) + next_bn->b;
+				++report.folded_batchnorm;
+			} else if (bn != NULL && next_affine != NULL) {
+				next_affine->b += bn->b * next_affine->W;
+				next_affine->W.array().colwise() *= bn->W.transpose().array();
+				++report.folded_batchnorm;
+				eraseLayer(i);  // 保留后面的 Affine
+				continue;
+			} else if (bn != NULL && next_bn != NULL) {
+				bn->W = bn->W.cwiseProduct(next_bn->W);
+				bn->b = bn->b.cwiseProduct(next_bn->W) + next_bn->b;
+				++report.folded_batchnorm;
+			} else if (affine != NULL && next_relu) {
+				affine->relu = true;
+				++report.merged_relu;
+			} else if (relu_output && next_relu) {
+				++report.merged_relu;
+			} else if (affine != NULL && !affine->relu && next_affine != NULL
+					&& affine->W.rows() * next_affine->W.cols()
+							<= affine->W.rows() * affine->W.cols() + affine->W.cols() * next_affine->W.cols()) {
+				next_affine->b += affine->b * next_affine->W;
+				next_affine->W = affine->W * next_affine->W;
+				++report.collapsed_affine;
+				eraseLayer(i);
+				continue;
+			} else {
+				++i;
+				continue;
+			}
+			eraseLayer(i + 1);
+		}
+		prepare();
+		report.layers_after = layers.size();
+
+		if (verify_input.size() > 0)
+			report.max_abs_diff = (forward(verify_input) - expected).cwiseAbs().maxCoeff();
+		return report;
+	}
+
+	/**
+	 * 把所有 Affine 层的权重转换为低精度存储（INetLayer_QuantizedAffine）， Residual_AffineReLU 仍为 fp32。
+	 * 应在 fuseLayers 之后调用， 量化后的层不再参与合并。
+	 * verify_rows > 0 时用随机输入比较量化前后的输出
+	 */
+	QuantizationReport quantizeWeights(WeightType type, int verify_rows = 16) {
+		QuantizationReport report;
+		Mat verify_input, expected;
+		const Eigen::Index input_width = inputWidth();
+		if (verify_rows > 0 && input_width > 0) {
+			verify_input = Mat::Random(verify_rows, input_width);
+			expected = forward(verify_input);
+		}
+		for (unsigned int i = 0; i < layers.size(); ++i) {
+			if (INetLayer_Affine* affine = dynamic_cast<INetLayer_Affine*>(layers[i])) {
+				INetLayer_QuantizedAffine* quantized = new INetLayer_QuantizedAffine(affine->W, affine->b, affine->relu,
+						type);
+				report.bytes_fp32 += affine->W.size() * sizeof(Scalar);
+				report.bytes_quantized += quantized->Wt.memoryBytes();
+				delete layers[i];
+				layers[i] = quantized;
+			}
+		}
+		prepare();
+		if (verify_input.size() > 0) {
+			const Mat diff = (forward(verify_input) - expected).cwiseAbs();
+			report.max_abs_diff = diff.maxCoeff();
+			report.mean_abs_diff = diff.mean();
+		}
+		return report;
+	}
+
+	/**
+	 * 第一个带参数的层的输入宽度， 只有 ReLU 层时为0
+	 */
+	Eigen::Index inputWidth() const {
+		for (unsigned int i = 0; i < layers.size(); ++i) {
+			if (INetLayer_Affine* affine = dynamic_cast<INetLayer_Affine*>(layers[i]))
+				return affine->W.rows();
+			if (INetLayer_QuantizedAffine* quantized = dynamic_cast<INetLayer_QuantizedAffine*>(layers[i]))
+				return quantized->Wt.cols();
+			if (INetLayer_Residual_AffineReLU* residual = dynamic_cast<INetLayer_Residual_AffineReLU*>(layers[i]))
+				return residual->W.rows();
+			if (INetLayer_BatchNorm* bn = dynamic_cast<INetLayer_BatchNorm*>(layers[i]))
+				return bn->W.size();
+		}
+		return 0;
+	}
+
+	/**
+	 * 最后一个改变宽度的层的输出宽度， 没有这样的层时为 input_width
+	 */
+	Eigen::Index outputWidth(Eigen::Index input_width = 0) const {
+		for (size_t i = layers.size(); i > 0; --i) {
+			if (INetLayer_Affine* affine = dynamic_cast<INetLayer_Affine*>(layers[i - 1]))
+				return affine->b.size();
+			if (INetLayer_QuantizedAffine* quantized = dynamic_cast<INetLayer_QuantizedAffine*>(layers[i - 1]))
+				return quantized->b.size();
+			if (INetLayer_Residual_AffineReLU* residual = dynamic_cast<INetLayer_Residual_AffineReLU*>(layers[i - 1]))
+				return residual->W.cols();
+		}
+		return input_width;
+	}
+
+	inline const vector<FusedStep>& fusedPlan() const {
+		return plan;
+	}
+
+	/**
+	 * 各层输出的最大宽度（列数）， prepare 之后有效
+	 */
+	inline Eigen::Index maxLayerWidth() const {
+		return max_width;
+	}
+
+	/**
+	 * 与 forward 结果相同， 但不复制 input， 也不为中间结果分配内存：
+	 * 各层的输出交替写入 ws 的两块缓冲区， Affine/BatchNorm/ReLU 合并为一步（见 FusedStep）。
+	 * ws 的容量足够后（第一次调用之后）， 激活值不再分配内存； 单行输入（GEMV）和很小的 batch 完全没有堆内存分配。
+	 * 较大的 batch 中 Eigen 的 GEMM 分块缓冲区超过 EIGEN_STACK_ALLOCATION_LIMIT（128KB， 如 64 行 × 256 列的输入）时
+	 * 仍会在堆上分配， 与 forward 相同
+	 * @return 指向 ws 中的输出（或没有层时指向 input）， 在下一次使用 ws 之前有效
+	 */
+	Eigen::Map<const Mat> forward_noalloc(const Scalar* input, Eigen::Index rows, Eigen::Index cols, Workspace& ws) {
+		if (planned_layers != layers.size() || (plan.empty() && !layers.empty()))
+			prepare();
+		ws.reserve(rows * std::max(max_width, cols));
+		const Scalar* src = input;
+		Eigen::Index width = cols;
+		int cur = -1;  // src 所在的缓冲区， -1 为 input
+		for (unsigned int k = 0; k < plan.size(); ++k) {
+			const FusedStep& step = plan[k];
+			if (step.kind == FusedStep::AFFINE || step.kind == FusedStep::RESIDUAL) {
+				const Eigen::Index in_width = step.W != NULL ? step.W->rows() : (Eigen::Index) step.Wq->cols();
+				const Eigen::Index out_width = step.b->size();
+				if (in_width != width)
+					throw string("forward_noalloc: input width does not match W");
+				const int next = cur == 0 ? 1 : 0;
+				Scalar* dst = ws.buffer(next);
+				if (step.W != NULL)
+					Eigen::Map<Mat>(dst, rows, out_width).noalias() = Eigen::Map<const Mat>(src, rows, width) * (*step.W);
+				else
+					step.Wq->matmul(src, rows, 1, rows, dst, 1, rows);
+				epilogue(step, dst, rows, out_width, step.kind == FusedStep::RESIDUAL ? src : NULL);
+				src = dst;
+				width = out_width;
+				cur = next;
+			} else {
+				if (step.bn_W != NULL && step.bn_W->size() != width)
+					throw string("forward_noalloc: input width does not match BatchNorm");
+				if (cur < 0) {  // 不能修改 input
+					Eigen::Map<Mat>(ws.buffer(0), rows, width) = Eigen::Map<const Mat>(src, rows, width);
+					src = ws.buffer(0);
+					cur = 0;
+				}
+				epilogue(step, ws.buffer(cur), rows, width, NULL);
+			}
+		}
+		return Eigen::Map<const Mat>(src, rows, width);
+	}
+
+	Eigen::Map<const Mat> forward_noalloc(const Mat& input, Workspace& ws) {
+		return forward_noalloc(input.data(), input.rows(), input.cols(), ws);
+	}
+
+	Eigen::Map<const Mat> forward_noalloc(const RowVec& input, Workspace& ws) {
+		return forward_noalloc(input.data(), 1, input.cols(), ws);
+	}
+
+	/**
+	 * 使用当前线程的 Workspace， 同一线程内的多个网络共用两块缓冲区
+	 */
+	Eigen::Map<const Mat> forward_noalloc(const Mat& input) {
+		return forward_noalloc(input, threadWorkspace());
+	}
+
+	static Workspace& threadWorkspace() {
+		static thread_local Workspace ws;
+		return ws;
+	}
+
+	/**
+	 * 随机生成 Affine&BatchNorm&ReLU / Residual 的网络， 比较 forward_noalloc 与 forward 的结果和速度
+	 */
+	static void testForwardNoAlloc(int input_width = 256, int rows = 1, int repeat = 10000) {
+		std::cout << "\n---test LC::FeedForwardNet::forward_noalloc" << std::endl;
+		FeedForwardNet net;
+		const int widths[] = { input_width, 128, 128, 64, 1 };
+		for (int l = 0; l + 1 < 5; ++l) {
+			net.addAffine(Mat::Random(widths[l], widths[l + 1]), RowVec::Random(widths[l + 1]));
+			if (l + 2 < 5) {
+				net.addBatchNorm(RowVec::Random(widths[l + 1]), RowVec::Random(widths[l + 1]));
+				net.addReLU();
+			}
+			if (l == 1)
+				net.addResidual_AffineReLU(Mat::Random(128, 128) * 0.1f, RowVec::Random(128));
+		}
+		net.prepare();
+		std::cout << "layers: " << net.layers.size() << " -> fused steps: " << net.fusedPlan().size()
+				<< "; max width: " << net.maxLayerWidth() << std::endl;
+
+		Mat input = Mat::Random(rows, input_width);
+		Workspace ws;
+		Mat expected = net.forward(input);
+		Mat actual = net.forward_noalloc(input, ws);
+		std::cout << "max abs diff: " << (expected - actual).cwiseAbs().maxCoeff() << std::endl;
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		{
+			// 有堆内存分配时 Eigen 的断言会失败
+			const RowVec row = input.row(0);
+			net.forward_noalloc(row, ws);
+			Eigen::internal::set_is_malloc_allowed(false);
+			const float y = net.forward_noalloc(row, ws)(0, 0);
+			Eigen::internal::set_is_malloc_allowed(true);
+			std::cout << "single row without heap allocation: " << y << std::endl;
+		}
+#endif
+
+		LC::TimerAccurate timer;
+		float sum = 0;
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward(input)(0, 0);
+		double t_forward = timer.getElapsedTimeAndRestart();
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward_noalloc(input, ws)(0, 0);
+		double t_noalloc = timer.getElapsedTimeAndRestart();
+		std::cout << "forward:         " << t_forward / repeat * 1e6 << " us/call" << std::endl;
+		std::cout << "forward_noalloc: " << t_noalloc / repeat * 1e6 << " us/call (" << sum << ")" << std::endl;
+	}
+
+	/**
+	 * 随机生成 Affine&BatchNorm&ReLU 的网络， 比较 fuseLayers 前后的结果和速度
+	 */
+	static void testFuseLayers(int input_width = 256, int rows = 1, int repeat = 10000) {
+		std::cout << "\n---test LC::FeedForwardNet::fuseLayers" << std::endl;
+		FeedForwardNet net;
+		const int widths[] = { input_width, 128, 64, 32, 1 };
+		net.addBatchNorm(RowVec::Random(input_width), RowVec::Random(input_width));
+		for (int l = 0; l + 1 < 5; ++l) {
+			net.addAffine(Mat::Random(widths[l], widths[l + 1]), RowVec::Random(widths[l + 1]));
+			if (l == 1)
+				continue;  // 中间没有非线性， 与下一个 Affine 合并
+			if (l + 2 < 5) {
+				net.addBatchNorm(RowVec::Random(widths[l + 1]), RowVec::Random(widths[l + 1]));
+				net.addReLU();
+			}
+		}
+		Mat input = Mat::Random(rows, input_width);
+		LC::TimerAccurate timer;
+		float sum = 0;
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward(input)(0, 0);
+		double t_before = timer.getElapsedTimeAndRestart();
+		std::cout << net.fuseLayers().toString() << std::endl;
+		timer.restart();
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward(input)(0, 0);
+		double t_after = timer.getElapsedTimeAndRestart();
+		std::cout << "forward before: " << t_before / repeat * 1e6 << " us/call" << std::endl;
+		std::cout << "forward after:  " << t_after / repeat * 1e6 << " us/call (" << sum << ")" << std::endl;
+	}
+
+	/**
+	 * 比较 fp32 / fp16 / bf16 / int8 权重的内存、误差和 forward 的速度， 以不量化的网络（Eigen）为基准；
+	 * rows 为1时是在线的单行打分， 较大时是批量打分
+	 */
+	static void testQuantizeWeights(int input_width = 512, int rows = 1, int repeat = 5000) {
+		std::cout << "\n---test LC::FeedForwardNet::quantizeWeights, simd level: " << QuantizedRows::cpu_level()
+				<< "; rows: " << rows << std::endl;
+		const int widths[] = { input_width, 256, 128, 1 };
+		Mat input = Mat::Random(rows, input_width);
+		const char* names[] = { "fp32", "fp16", "bf16", "int8" };
+		Mat expected;
+		for (int t = -1; t < 4; ++t) {
+			FeedForwardNet net;
+			srand(1);
+			for (int l = 0; l + 1 < 4; ++l) {
+				net.addAffine(Mat::Random(widths[l], widths[l + 1]) * (1.0f / std::sqrt((float) widths[l])),
+						RowVec::Random(widths[l + 1]));
+				if (l + 2 < 4)
+					net.addReLU();
+			}
+			net.fuseLayers(0);
+			if (t < 0)
+				std::cout << "eigen (not quantized)" << std::endl;
+			else
+				std::cout << names[t] << ": " << net.quantizeWeights((WeightType) t).toString() << std::endl;
+			Workspace ws;
+			const Mat output = net.forward_noalloc(input, ws);
+			if (t < 0)
+				expected = output;
+			LC::TimerAccurate timer;
+			float sum = 0;
+			for (int i = 0; i < repeat; ++i)
+				sum += net.forward_noalloc(input, ws)(0, 0);
+			std::cout << "\tforward_noalloc: " << timer.getElapsedTime() / repeat * 1e6 << " us/call (" << sum
+					<< "); max abs diff of output: " << (output - expected).cwiseAbs().maxCoeff() << std::endl;
+		}
+
+		Mat table = Mat::Random(10000, 64);
+		std::map<string, Mat> lookUps;
+		lookUps["table"] = table;
+		for (int t = 1; t < 4; ++t)
+			quantizeLookUps(lookUps, (WeightType) t);
+	}
+
+private:
+	vector<FusedStep> plan;
+	Eigen::Index max_width;
+	size_t planned_layers;
+
+	/**
+	 * 步骤 step（从第 i 层开始）之后紧随 INetLayer_Activation 时合并为 epilogue 的最后一步
+	 */
+	void absorbActivation(FusedStep& step, unsigned int i) const {
+		if (i + step.num_layers >= layers.size())
+			return;
+		if (const INetLayer_Activation* act = dynamic_cast<const INetLayer_Activation*>(layers[i + step.num_layers])) {
+			step.activation = act->type;
+			step.alpha = act->alpha;
+			++step.num_layers;
+		}
+	}
+
+	void eraseLayer(unsigned int i) {
+		delete layers[i];
+		layers.erase(layers.begin() + i);
+	}
+
+	FeedForwardNet(const FeedForwardNet&);  // layers 为裸指针， 不可复制
+	FeedForwardNet& operator=(const FeedForwardNet&);
+
+	/**
+	 * 线性部分之后的计算， 激活值已在 L1/L2 cache 中时再计算 step.activation
+	 */
+	static void epilogue(const FusedStep& step, Scalar* data, Eigen::Index rows, Eigen::Index cols,
+			const Scalar* residual) {
+		if (step.kind != FusedStep::ACTIVATION)
+			epilogue_linear(step, data, rows, cols, residual);
+		if (step.activation != Activation::IDENTITY)
+			Activation::apply(step.activation, data, rows * cols, step.alpha);
+	}
+
+	/**
+	 * 一次遍历完成 bias、BatchNorm、ReLU 和残差相加。
+	 * 单行时按整行向量化； 多行时按列（列优先存储， 每列连续）处理， 每列的参数为标量
+	 */
+	static void epilogue_linear(const FusedStep& step, Scalar* data, Eigen::Index rows, Eigen::Index cols,
+			const Scalar* residual) {
+		typedef Eigen::Array<Scalar, 1, Eigen::Dynamic> RowArray;
+		typedef Eigen::Array<Scalar, Eigen::Dynamic, 1> ColArray;
+		if (rows == 1) {
+			Eigen::Map<RowArray> o(data, cols);
+			if (step.kind == FusedStep::RELU) {
+				o = o.max(Scalar(0));
+				return;
+			}
+			const Eigen::Map<const RowArray> b(step.b->data(), cols);
+			if (step.bn_W != NULL) {
+				const Eigen::Map<const RowArray> s(step.bn_W->data(), cols), t(step.bn_b->data(), cols);
+				epilogue_kernel(o, b, &s, &t, step.relu, (const RowArray*) NULL);
+			} else {
+				const Eigen::Map<const RowArray> r(residual == NULL ? data : residual, cols);
+				epilogue_kernel(o, b, (const RowArray*) NULL, (const RowArray*) NULL, step.relu,
+						residual == NULL ? NULL : &r);
+			}
+			return;
+		}
+		for (Eigen::Index j = 0; j < cols; ++j) {
+			Eigen::Map<ColArray> o(data + j * rows, rows);
+			if (step.kind == FusedStep::RELU) {
+				o = o.max(Scalar(0));
+				continue;
+			}
+			const Scalar b = (*step.b)(j);
+			if (step.bn_W != NULL) {
+				const Scalar s = (*step.bn_W)(j), t = (*step.bn_b)(j);
+				epilogue_kernel(o, b, &s, &t, step.relu, (const Eigen::Map<const ColArray>*) NULL);
+			} else {
+				const Eigen::Map<const ColArray> r(residual == NULL ? data : residual + j * rows, rows);
+				epilogue_kernel(o, b, (const Scalar*) NULL, (const Scalar*) NULL, step.relu,
+						residual == NULL ? NULL : &r);
+			}
+		}
+	}
+
+	/**
+	 * o = relu?((o + b) * s + t) + r； s、t、r 为NULL时省略对应的运算。 B/S 为标量或与 o 同形的数组
+	 */
+	template<typename O, typename B, typename S, typename R>
+	static inline void epilogue_kernel(O& o, const B& b, const S* s, const S* t, bool relu, const R* r) {
+		if (s != NULL) {
+			if (relu)
+				o = ((o + b) * (*s) + (*t)).max(Scalar(0));
+			else
+				o = (o + b) * (*s) + (*t);
+		} else if (r != NULL) {
+			o = (o + b).max(Scalar(0)) + (*r);
+		} else if (relu) {
+			o = (o + b).max(Scalar(0));
+		} else {
+			o += b;
+		}
+	}
 };
 
 /////////////////////////////////////////////////////////////
@@ -389,6 +1169,14 @@ public:
 		idx += in.cols();
 	}
 
+	/**
+	 * 按行串联， 第 idx 行设置为 in， 用于把多个请求合并为一个 batch
+	 */
+	void addSubInputRow(const RowVec& in) {
+		m.row(idx) = in;
+		idx += 1;
+	}
+
 };
 
 class RowVecInputLoader {  //自动对input进行串联，，需要首先设置
@@ -0,0 +1,295 @@
+/*
+ * HashedEmbedding.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      直接用原始的64位特征id查询的 embedding 表， 不需要 Discretize::Map 先把 id 映射为连续的行号：
+ *      1、MurmurHash3_x64_128(id) 的高64位选择子表（shard）， 低64位选择子表中的桶（bucket）， 不同的 id 可能共享一行；
+ *         词表大小没有上限， 内存只由 num_shards * buckets_per_shard 决定；
+ *      2、可选的热点 id 缓存： 出现最多的 id 各自使用单独的一行（不与其他 id 冲突），
+ *         用开放寻址的数组查找（复用同一个 hash）， 没有 std::map / unordered_map；
+ *      3、满足 EmbeddingBag::forwardTable 的接口， 可以批量查询并写入 FeedForwardNet 的输入。
+ *      每个子表是单独的 MatRowMajor， 可以分别加载或量化。
+ *
+ *      用法：
+ *      LC::HashedEmbeddingTable table(8, 1 << 20, 32);
+ *      table.setHotRows(top_ids, top_embeddings);  // 可选
+ *      col = table.forward(LC::EmbeddingBag::SUM, offsets, raw_ids, weights, input, col);
+ */
+
+#ifndef LC_DEEPLEARNING_HASHEDEMBEDDING_HPP_
+#define LC_DEEPLEARNING_HASHEDEMBEDDING_HPP_
+
+#include "EmbeddingBag.hpp"
+#include "../utility/HashMurmur3.hpp"
+#include <stdint.h>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+namespace LC {
+
+class HashedEmbeddingTable {
+public:
+	/**
+	 * id 对应的行所在的位置
+	 */
+	struct Location {
+		int32_t hot;  ///< 热点缓存中的行， -1 表示不在缓存中
+		uint32_t shard;
+		uint64_t bucket;
+	};
+
+	/**
+	 * @param num_shards 子表的个数
+	 * @param buckets_per_shard 每个子表的行数
+	 * @param seed MurmurHash3 的 seed， 训练和预测必须相同
+	 */
+	HashedEmbeddingTable(size_t num_shards, size_t buckets_per_shard, size_t cols, uint32_t seed = 0) :
+			buckets(buckets_per_shard), cols_(cols), seed(seed), hot_mask(0) {
+		if (num_shards == 0 || buckets_per_shard == 0 || cols == 0)
+			throw std::invalid_argument("HashedEmbeddingTable: empty table");
+		shards.assign(num_shards, MatRowMajor::Zero(buckets_per_shard, cols));
+	}
+
+	inline size_t cols() const {
+		return cols_;
+	}
+
+	inline size_t numShards() const {
+		return shards.size();
+	}
+
+	inline size_t bucketsPerShard() const {
+		return buckets;
+	}
+
+	inline size_t numHotRows() const {
+		return hot_rows.rows();
+	}
+
+	inline MatRowMajor& shard(size_t s) {
+		return shards[s];
+	}
+
+	inline const MatRowMajor& shard(size_t s) const {
+		return shards[s];
+	}
+
+	inline size_t memoryBytes() const {
+		return (shards.size() * buckets + hot_rows.rows()) * cols_ * sizeof(float)
+				+ hot_ids.size() * (sizeof(uint64_t) + sizeof(int32_t));
+	}
+
+	/**
+	 * 设置热点 id 及其 embedding（每行一个）， 替换之前的缓存
+	 */
+	template<typename KeyType>
+	void setHotRows(const std::vector<KeyType>& ids, const MatRowMajor& embeddings) {
+		if ((Eigen::Index) ids.size() != embeddings.rows() || (!ids.empty() && (size_t) embeddings.cols() != cols_))
+			throw std::invalid_argument("HashedEmbeddingTable: hot ids and embeddings do not match");
+		size_t capacity = 1;
+		while (capacity < ids.size() * 2)
+			capacity <<= 1;
+		hot_ids.assign(ids.empty() ? 0 : capacity, 0);
+		hot_slots.assign(hot_ids.size(), -1);
+		hot_mask = hot_ids.empty() ? 0 : capacity - 1;
+		hot_rows = embeddings;
+		for (size_t i = 0; i < ids.size(); ++i) {
+			const uint64_t id = (uint64_t) ids[i];
+			uint64_t h[2];
+			hash(id, h);
+			size_t p = h[1] & hot_mask;
+			while (hot_slots[p] >= 0 && hot_ids[p] != id)
+				p = (p + 1) & hot_mask;
+			hot_ids[p] = id;
+			hot_slots[p] = i;
+		}
+	}
+
+	/**
+	 * 在 samples 中出现次数最多的 top_k 个 id 作为热点， 初始值为其当前（共享的）embedding
+	 */
+	template<typename KeyType>
+	void setHotIdsByFrequency(const std::vector<KeyType>& samples, size_t top_k) {
+		std::vector<uint64_t> sorted(samples.begin(), samples.end());
+		std::sort(sorted.begin(), sorted.end());
+		std::vector<std::pair<size_t, uint64_t> > counts;
+		for (size_t i = 0; i < sorted.size();) {
+			size_t j = i;
+			while (j < sorted.size() && sorted[j] == sorted[i])
+				++j;
+			counts.push_back(std::make_pair(j - i, sorted[i]));
+			i = j;
+		}
+		top_k = std::min(top_k, counts.size());
+		std::partial_sort(counts.begin(), counts.begin() + top_k, counts.end(),
+				std::greater<std::pair<size_t, uint64_t> >());
+		std::vector<uint64_t> ids(top_k);
+		MatRowMajor embeddings(top_k, cols_);
+		for (size_t i = 0; i < top_k; ++i) {
+			ids[i] = counts[i].second;
+			embeddings.row(i) = Eigen::Map<const RowVec>(row(ids[i]), cols_);
+		}
+		setHotRows(ids, embeddings);
+	}
+
+	template<typename KeyType>
+	inline Location locate(KeyType key) const {
+		const uint64_t id = (uint64_t) key;
+		uint64_t h[2];
+		hash(id, h);
+		Location loc;
+		loc.hot = -1;
+		loc.shard = h[1] % shards.size();
+		loc.bucket = h[0] % buckets;
+		if (!hot_ids.empty()) {
+			for (size_t p = h[1] & hot_mask; hot_slots[p] >= 0; p = (p + 1) & hot_mask) {
+				if (hot_ids[p] == id) {
+					loc.hot = hot_slots[p];
+					break;
+				}
+			}
+		}
+		return loc;
+	}
+
+	template<typename KeyType>
+	inline const float* row(KeyType id) const {
+		const Location loc = locate(id);
+		return loc.hot >= 0 ? hot_rows.data() + (size_t) loc.hot * cols_ : shards[loc.shard].data() + loc.bucket * cols_;
+	}
+
+	/**
+	 * 用于加载或更新参数： 热点 id 返回其单独的行， 否则返回共享的桶
+	 */
+	template<typename KeyType>
+	inline float* mutableRow(KeyType id) {
+		return const_cast<float*>(row(id));
+	}
+
+	////////////////////// EmbeddingBag::forwardTable 需要的接口
+	template<typename KeyType>
+	inline bool valid(KeyType) const {
+		return true;
+	}
+
+	template<typename KeyType>
+	inline void prefetchRow(KeyType id) const {
+#ifdef __GNUC__
+		const char* p = (const char*) row(id);
+		for (size_t i = 0; i < cols_ * sizeof(float); i += 64)
+			__builtin_prefetch(p + i, 0, 1);
+#endif
+	}
+
+	template<typename KeyType>
+	inline void axpyRow(KeyType id, float w, float* acc) const {
+		EmbeddingBag::axpy(row(id), w, acc, cols_);
+	}
+
+	/**
+	 * 参见 EmbeddingBag::forward， ids 为原始的特征id
+	 */
+	template<typename KeyType>
+	Eigen::Index forward(EmbeddingBag::Combiner combiner, const std::vector<size_t>& offsets,
+			const std::vector<KeyType>& ids, const std::vector<float>& weights, Mat& input, Eigen::Index col_offset) const {
+		return EmbeddingBag::forwardTable(*this, combiner, offsets, ids, weights, input, col_offset);
+	}
+
+	/**
+	 * ids 中不同的 id 有多少比例与其他 id 共享同一行（热点 id 不计）， 用于选择表的大小
+	 */
+	template<typename KeyType>
+	double collisionRate(const std::vector<KeyType>& ids) const {
+		std::vector<std::pair<uint64_t, uint64_t> > cells;  // (shard * buckets + bucket, id)
+		std::vector<uint64_t> distinct(ids.begin(), ids.end());
+		std::sort(distinct.begin(), distinct.end());
+		distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+		for (size_t i = 0; i < distinct.size(); ++i) {
+			const Location loc = locate(distinct[i]);
+			if (loc.hot < 0)
+				cells.push_back(std::make_pair(loc.shard * buckets + loc.bucket, distinct[i]));
+		}
+		std::sort(cells.begin(), cells.end());
+		size_t collided = 0;
+		for (size_t i = 0; i < cells.size(); ++i)
+			if ((i > 0 && cells[i - 1].first == cells[i].first)
+					|| (i + 1 < cells.size() && cells[i + 1].first == cells[i].first))
+				++collided;
+		return distinct.empty() ? 0 : (double) collided / distinct.size();
+	}
+
+	/**
+	 * 与 unordered_map 映射 id + EmbeddingBag 比较结果和速度
+	 */
+	static void testHashedEmbedding(size_t vocab = 500000, int cols = 32, int num_bags = 512, int ids_per_bag = 20,
+			int repeat = 20) {
+		std::cout << "\n---test LC::HashedEmbeddingTable" << std::endl;
+		// Zipf 分布的原始id
+		LC::RandomUniform<int, double> rnd(23);
+		rnd.set_param_f(0.0, 1.0);
+		std::vector<size_t> offsets(1, 0);
+		std::vector<long long> ids;
+		for (int b = 0; b < num_bags; ++b) {
+			for (int j = 0; j < ids_per_bag; ++j) {
+				const size_t rank = std::min(vocab, (size_t) std::pow((double) vocab, rnd.randf()));
+				ids.push_back((long long) (rank * 0x9E3779B97F4A7C15ull));  // 稀疏的64位id
+			}
+			offsets.push_back(ids.size());
+		}
+
+		HashedEmbeddingTable table(4, vocab / 4, cols);
+		for (size_t s = 0; s < table.numShards(); ++s)
+			table.shard(s).setRandom();
+		std::cout << "collision rate: " << table.collisionRate(ids) << std::endl;
+		table.setHotIdsByFrequency(ids, 1000);
+		std::cout << "collision rate with " << table.numHotRows() << " hot ids: " << table.collisionRate(ids)
+				<< "; memory: " << table.memoryBytes() << " bytes" << std::endl;
+
+		// 参照： 用 unordered_map 把整个词表映射为连续的行号（Discretize::Map 的做法）， 表的大小相同
+		std::unordered_map<long long, long long> remap;
+		remap.reserve(vocab);
+		MatRowMajor dense(vocab, cols);
+		for (size_t rank = 1; rank <= vocab; ++rank) {
+			const long long id = (long long) (rank * 0x9E3779B97F4A7C15ull);
+			remap[id] = rank - 1;
+			dense.row(rank - 1) = Eigen::Map<const RowVec>(table.row(id), cols);
+		}
+		std::vector<long long> rows(ids.size());
+		Mat expected(num_bags, cols), actual(num_bags, cols);
+		const std::vector<float> weights;
+		LC::TimerAccurate timer;
+		for (int r = 0; r < repeat; ++r) {
+			for (size_t j = 0; j < ids.size(); ++j)
+				rows[j] = remap.find(ids[j])->second;
+			EmbeddingBag::forward(dense, EmbeddingBag::SUM, offsets, rows, weights, expected, 0);
+		}
+		const double t_remap = timer.getElapsedTimeAndRestart();
+		for (int r = 0; r < repeat; ++r)
+			table.forward(EmbeddingBag::SUM, offsets, ids, weights, actual, 0);
+		const double t_hashed = timer.getElapsedTimeAndRestart();
+		std::cout << "max abs diff: " << (expected - actual).cwiseAbs().maxCoeff() << "; unordered_map + EmbeddingBag: "
+				<< t_remap / repeat * 1e6 << " us/batch; hashed: " << t_hashed / repeat * 1e6 << " us/batch" << std::endl;
+	}
+
+private:
+	std::vector<MatRowMajor> shards;
+	size_t buckets;
+	size_t cols_;
+	uint32_t seed;
+
+	// 热点缓存： 开放寻址， 容量为2的幂， hot_slots 为 -1 表示空位
+	std::vector<uint64_t> hot_ids;
+	std::vector<int32_t> hot_slots;
+	size_t hot_mask;
+	MatRowMajor hot_rows;
+
+	inline void hash(uint64_t id, uint64_t* out) const {
+		LC::Murmur3::MurmurHash3_x64_128(&id, sizeof(id), seed, out);
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_HASHEDEMBEDDING_HPP_ */
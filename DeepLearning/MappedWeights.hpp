@@ -0,0 +1,461 @@
+/*
+ * MappedWeights.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      FeedForwardNet 和 embedding 表（loadLookUps）的二进制容器格式， 加载时 mmap 整个文件：
+ *      1、文件头之后是各矩阵的描述（名字、元素类型、存储顺序、维数、偏移、校验和）， 矩阵数据按64字节对齐；
+ *      2、embedding 表直接映射为 Eigen::Map<const MatRowMajor>， 不解析也不复制，
+ *         同一台机器上的多个进程共享相同的物理页， 热更新时由 page cache 提供；
+ *      3、网络的各层持有自己的矩阵（fuseLayers、quantizeWeights 会修改它们）， 因此 loadNet 从映射中整块复制，
+ *         不再逐个读取 float。
+ *      convertLookUps / convertNet 将原来的文本头 + float 格式转换为该格式， 转换时按块流式读写， 不需要把表全部读入内存。
+ *
+ *      用法：
+ *      LC::MappedWeights::convertLookUps("lookups.bin", "lookups.lcmat");  // 离线转换一次
+ *      LC::MappedWeights lookups("lookups.lcmat");
+ *      Eigen::Map<const LC::MatRowMajor> emb = lookups.mat("user_emb");
+ *
+ *      LC::MappedWeights::convertNet("net.bin", "net.lcmat");
+ *      LC::FeedForwardNet net;
+ *      LC::MappedWeights::loadNet(net, "net.lcmat");
+ */
+
+#ifndef LC_DEEPLEARNING_MAPPEDWEIGHTS_HPP_
+#define LC_DEEPLEARNING_MAPPEDWEIGHTS_HPP_
+
+#include "FeedForwardNet.hpp"
+#include "../utility/MappedFile.hpp"
+#include "../utility/HashMurmur3.hpp"
+#include <stdint.h>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+
+namespace LC {
+
+/**
+ * 文件布局（各段起始位置均按64字节对齐）：
+ * header | MappedWeights_entry[num_entries] | info | 各矩阵的数据
+ * info 为原文件的文本头（网络结构或变量列表）。 使用本机字节序， endian 字段用于检测不匹配的字节序
+ */
+struct MappedWeights_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	uint64_t num_entries;
+	uint64_t entries_offset;
+	uint64_t info_offset;
+	uint64_t info_size;
+	uint64_t file_size;
+};
+
+struct MappedWeights_entry {
+	enum {
+		DTYPE_FLOAT32 = 'f', LAYOUT_ROW_MAJOR = 0
+	};
+
+	char name[64];
+	uint32_t dtype;
+	uint32_t layout;
+	uint64_t rows;
+	uint64_t cols;
+	uint64_t offset;
+	uint64_t checksum;  ///< 数据的校验和， 见 MappedWeights::checksum
+
+	inline uint64_t bytes() const {
+		return rows * cols * sizeof(float);
+	}
+};
+
+/**
+ * 顺序写入 MappedWeights 格式的文件： 构造时确定所有矩阵的名字和维数， 再按顺序用 append 写入每个矩阵的数据（可以分多次），
+ * 最后调用 close 写入校验和
+ */
+class MappedWeightsWriter {
+	std::ofstream out;
+	std::vector<MappedWeights_entry> entries;
+	uint64_t entries_offset;
+	uint64_t file_size;
+	size_t current;  ///< 正在写入的矩阵
+	uint64_t written;  ///< 当前矩阵已写入的字节数
+	std::vector<char> chunk;  ///< 未满 CHECKSUM_CHUNK 的数据， 满一块时计算校验和
+	uint64_t hash;
+
+	MappedWeightsWriter(const MappedWeightsWriter&);
+	MappedWeightsWriter& operator=(const MappedWeightsWriter&);
+public:
+	static const size_t CHECKSUM_CHUNK = 1 << 20;
+
+	/**
+	 * @param names 各矩阵的名字， 不超过63个字符
+	 * @param dims 各矩阵的 (rows, cols)
+	 */
+	MappedWeightsWriter(const string& filename, const string& info, const std::vector<string>& names,
+			const std::vector<std::pair<uint64_t, uint64_t> >& dims) :
+			out(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc), current(0), written(0), hash(0) {
+		if (!out)
+			throw string("can not open file for writing: ") + filename;
+		if (names.size() != dims.size())
+			throw string("MappedWeightsWriter: names and dims have different sizes");
+		MappedWeights_header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, magic(), 8);
+		header.version = VERSION;
+		header.endian = 0x01020304u;
+		header.num_entries = names.size();
+		header.entries_offset = align(sizeof(header));
+		header.info_offset = align(header.entries_offset + names.size() * sizeof(MappedWeights_entry));
+		header.info_size = info.size();
+		uint64_t offset = align(header.info_offset + info.size());
+		entries.resize(names.size());
+		for (size_t i = 0; i < names.size(); ++i) {
+			MappedWeights_entry& e = entries[i];
+			std::memset(&e, 0, sizeof(e));
+			if (names[i].size() >= sizeof(e.name))
+				throw string("MappedWeightsWriter: name too long: ") + names[i];
+			std::memcpy(e.name, names[i].data(), names[i].size());
+			e.dtype = MappedWeights_entry::DTYPE_FLOAT32;
+			e.layout = MappedWeights_entry::LAYOUT_ROW_MAJOR;
+			e.rows = dims[i].first;
+			e.cols = dims[i].second;
+			e.offset = offset;
+			offset = align(offset + e.bytes());
+		}
+		header.file_size = entries.empty() ? header.info_offset + info.size() : entries.back().offset
+				+ entries.back().bytes();
+		entries_offset = header.entries_offset;
+		file_size = header.file_size;
+
+		out.write((const char*) &header, sizeof(header));
+		pad(header.entries_offset);
+		out.write((const char*) entries.data(), entries.size() * sizeof(MappedWeights_entry));  // 校验和在 close 时重写
+		pad(header.info_offset);
+		out.write(info.data(), info.size());
+		chunk.reserve(CHECKSUM_CHUNK);
+		skipEmpty();
+	}
+
+	~MappedWeightsWriter() {
+		if (out.is_open())
+			out.close();
+	}
+
+	static uint64_t align(uint64_t offset) {
+		return (offset + 63u) / 64u * 64u;
+	}
+
+	static const char* magic() {
+		return "LCMATS\0\0";
+	}
+
+	static const uint32_t VERSION = 1;
+
+	/**
+	 * 校验和的一步， n 不超过 CHECKSUM_CHUNK
+	 */
+	static uint64_t checksumUpdate(uint64_t h, const char* p, size_t n) {
+		uint64_t out[2];
+		LC::Murmur3::MurmurHash3_x64_128(p, (int) n, (uint32_t) h, out);
+		return out[0] ^ (h << 1 | h >> 63);
+	}
+
+	/**
+	 * 写入当前矩阵（按行）的后续 n 个元素， 写满后自动切换到下一个矩阵
+	 */
+	void append(const float* data, size_t n) {
+		const char* p = (const char*) data;
+		size_t bytes = n * sizeof(float);
+		while (bytes > 0) {
+			if (current >= entries.size())
+				throw string("MappedWeightsWriter: too much data");
+			MappedWeights_entry& e = entries[current];
+			if (written == 0)
+				pad(e.offset);
+			const size_t m = std::min<uint64_t>(bytes, std::min<uint64_t>(e.bytes() - written, CHECKSUM_CHUNK - chunk.size()));
+			chunk.insert(chunk.end(), p, p + m);
+			out.write(p, m);
+			p += m;
+			bytes -= m;
+			written += m;
+			if (chunk.size() == CHECKSUM_CHUNK || written == e.bytes())
+				flushChunk();
+			if (written == e.bytes()) {
+				e.checksum = hash;
+				++current;
+				written = 0;
+				hash = 0;
+				skipEmpty();
+			}
+		}
+	}
+
+	void close() {
+		if (current != entries.size())
+			throw string("MappedWeightsWriter: matrix ") + entries[current].name + " is incomplete";
+		pad(file_size);
+		out.seekp(entries_offset);
+		out.write((const char*) entries.data(), entries.size() * sizeof(MappedWeights_entry));
+		out.close();
+		if (out.fail())
+			throw string("MappedWeightsWriter: fail to write file");
+	}
+
+private:
+	void pad(uint64_t offset) {
+		const uint64_t pos = out.tellp();
+		if (offset < pos)
+			throw string("MappedWeightsWriter: invalid offset");
+		static const char zeros[64] = { 0 };
+		out.write(zeros, offset - pos);
+	}
+
+	void flushChunk() {
+		hash = checksumUpdate(hash, chunk.data(), chunk.size());
+		chunk.clear();
+	}
+
+	void skipEmpty() {  // 0x0 的矩阵不需要数据
+		while (current < entries.size() && entries[current].bytes() == 0)
+			++current;
+	}
+};
+
+/**
+ * mmap MappedWeightsWriter 生成的文件， 矩阵直接映射为 Eigen::Map<const MatRowMajor>。
+ * 返回的 Map 在 MappedWeights（或 file() 返回的 shared_ptr）析构之前有效
+ */
+class MappedWeights {
+	std::shared_ptr<MappedFile> mapped;
+	const MappedWeights_entry* entries;
+	size_t num_entries;
+	string info_;
+	std::map<string, size_t> index;
+
+public:
+	typedef Eigen::Map<const MatRowMajor> ConstMap;
+
+	/**
+	 * @param verify_checksum 为true时校验所有矩阵（会读入所有页）， 也可以之后用 verify 只校验部分矩阵
+	 * @param populate 预先读入所有页， 参见 MappedFile
+	 */
+	MappedWeights(const string& filename, bool verify_checksum = false, bool populate = false) :
+			mapped(std::make_shared<MappedFile>(filename, populate)), entries(NULL), num_entries(0) {
+		if (mapped->size() < sizeof(MappedWeights_header))
+			throw string("invalid mapped weights (too small): ") + filename;
+		const MappedWeights_header& header = *mapped->at<MappedWeights_header>(0);
+		if (std::memcmp(header.magic, MappedWeightsWriter::magic(), 8) != 0)
+			throw string("invalid mapped weights (magic): ") + filename;
+		if (header.version != MappedWeightsWriter::VERSION)
+			throw string("unsupported mapped weights version: ") + LC::Str::num2str((int) header.version);
+		if (header.endian != 0x01020304u)
+			throw string("mapped weights has different endianness: ") + filename;
+		if (header.file_size != mapped->size() || header.entries_offset < sizeof(header)
+				|| header.entries_offset + header.num_entries * sizeof(MappedWeights_entry) > header.info_offset
+				|| header.info_offset + header.info_size > header.file_size)
+			throw string("invalid mapped weights (layout): ") + filename;
+		entries = mapped->at<MappedWeights_entry>(header.entries_offset);
+		num_entries = header.num_entries;
+		info_.assign(mapped->data() + header.info_offset, header.info_size);
+		for (size_t i = 0; i < num_entries; ++i) {
+			const MappedWeights_entry& e = entries[i];
+			if (e.dtype != MappedWeights_entry::DTYPE_FLOAT32 || e.layout != MappedWeights_entry::LAYOUT_ROW_MAJOR)
+				throw string("unsupported dtype or layout in mapped weights: ") + name(i);
+			if (e.offset % 64 != 0 || e.offset < header.info_offset + header.info_size
+					|| e.offset + e.bytes() > header.file_size)
+				throw string("invalid mapped weights (matrix offset): ") + name(i);
+			index[name(i)] = i;
+		}
+		if (verify_checksum)
+			for (size_t i = 0; i < num_entries; ++i)
+				verify(i);
+	}
+
+	inline size_t size() const {
+		return num_entries;
+	}
+
+	inline const string& info() const {  ///< 原文件的文本头
+		return info_;
+	}
+
+	inline std::shared_ptr<MappedFile> file() const {
+		return mapped;
+	}
+
+	string name(size_t i) const {
+		return string(entries[i].name, strnlen(entries[i].name, sizeof(entries[i].name)));
+	}
+
+	inline bool has(const string& name) const {
+		return index.count(name) > 0;
+	}
+
+	inline ConstMap mat(size_t i) const {
+		const MappedWeights_entry& e = entries[i];
+		return ConstMap(mapped->at<float>(e.offset), e.rows, e.cols);
+	}
+
+	ConstMap mat(const string& name) const {
+		std::map<string, size_t>::const_iterator it = index.find(name);
+		if (it == index.end())
+			throw string("matrix not found in mapped weights: ") + name;
+		return mat(it->second);
+	}
+
+	/**
+	 * 与 FeedForwardNet::loadLookUps 对应， 但不复制
+	 */
+	std::map<string, ConstMap> lookUps() const {
+		std::map<string, ConstMap> result;
+		for (size_t i = 0; i < num_entries; ++i)
+			result.insert(std::make_pair(name(i), mat(i)));
+		return result;
+	}
+
+	void verify(size_t i) const {
+		if (checksum(mapped->data() + entries[i].offset, entries[i].bytes()) != entries[i].checksum)
+			throw string("invalid mapped weights (checksum): ") + name(i);
+	}
+
+	/**
+	 * 按 MappedWeightsWriter::CHECKSUM_CHUNK 分块计算的 MurmurHash3
+	 */
+	static uint64_t checksum(const char* p, uint64_t n) {
+		uint64_t h = 0;
+		for (uint64_t off = 0; off < n; off += MappedWeightsWriter::CHECKSUM_CHUNK)
+			h = MappedWeightsWriter::checksumUpdate(h, p + off,
+					std::min<uint64_t>(n - off, uint64_t(MappedWeightsWriter::CHECKSUM_CHUNK)));
+		return h;
+	}
+
+	static bool isMappedWeights(const string& filename) {
+		std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+		char magic[8];
+		return in.read(magic, 8) && std::memcmp(magic, MappedWeightsWriter::magic(), 8) == 0;
+	}
+
+	/**
+	 * 将 loadLookUps 格式的文件转换为 MappedWeights 格式， 按块复制， 内存占用与表的大小无关
+	 */
+	static void convertLookUps(const string& src, const string& dst) {
+		LC::BinaryFileIO bf(src.c_str());
+		std::string info;
+		std::getline(bf, info);
+		std::vector<string> vars = LC::Str::split(info, '&');
+		std::vector<string> names;
+		std::vector<std::pair<uint64_t, uint64_t> > dims;
+		for (size_t i = 0; i < vars.size(); ++i) {
+			if (vars[i].size() < 3)
+				continue;  // maybe the last one is empty
+			names.push_back(FeedForwardNet::extractVarName(vars[i]));
+			dims.push_back(FeedForwardNet::extractRowsAndCols(vars[i]));
+		}
+		MappedWeightsWriter writer(dst, info, names, dims);
+		std::vector<float> buffer(MappedWeightsWriter::CHECKSUM_CHUNK / sizeof(float));
+		for (size_t i = 0; i < dims.size(); ++i) {
+			for (uint64_t left = dims[i].first * dims[i].second; left > 0;) {
+				const size_t n = std::min<uint64_t>(left, buffer.size());
+				bf.read((char*) buffer.data(), n * sizeof(float));
+				if (!bf)
+					throw string("unexpected end of file: ") + src;
+				writer.append(buffer.data(), n);
+				left -= n;
+			}
+		}
+		writer.close();
+	}
+
+	/**
+	 * 将 loadNetStructure 格式的文件转换为 MappedWeights 格式， 矩阵按文件中出现的顺序命名为 "<层序号>.<变量名>"
+	 */
+	static void convertNet(const string& src, const string& dst) {
+		LC::BinaryFileIO bf(src.c_str());
+		std::string info;
+		std::getline(bf, info);
+		std::vector<string> names;
+		std::vector<std::pair<uint64_t, uint64_t> > dims;
+		std::vector<MatRowMajor> mats;
+		FeedForwardNet net;  // 只用于按相同的规则解析文件头
+		net.parseNetStructure(info, [&](const string& varStr) {
+			names.push_back(LC::Str::num2str((int) names.size()) + "." + FeedForwardNet::extractVarName(varStr));
+			dims.push_back(FeedForwardNet::extractRowsAndCols(varStr));
+			mats.push_back(FeedForwardNet::loadOneMat_from_binaryFile(bf, dims.back()));
+			return Mat(mats.back());
+		});
+		MappedWeightsWriter writer(dst, info, names, dims);
+		for (size_t i = 0; i < mats.size(); ++i)
+			writer.append(mats[i].data(), mats[i].size());
+		writer.close();
+	}
+
+	/**
+	 * 加载 convertNet 生成的文件， 与 loadNetStructure 得到相同的网络
+	 */
+	static string loadNet(FeedForwardNet& net, const string& filename, bool printVerboseInfo = false, bool fuse =
+			false) {
+		std::cout << "\n-------- Loading mapped feed forward net: " << filename << std::endl;
+		MappedWeights weights(filename, true);
+		size_t next = 0;
+		net.parseNetStructure(weights.info(), [&](const string& varStr) {
+			const std::pair<unsigned int, unsigned int> rc = FeedForwardNet::extractRowsAndCols(varStr);
+			if (next >= weights.size() || weights.entries[next].rows != rc.first || weights.entries[next].cols != rc.second)
+				throw string("mapped net does not match its structure at ") + varStr;
+			return Mat(weights.mat(next++));
+		}, printVerboseInfo, fuse);
+		return weights.info();
+	}
+
+	static void testMappedWeights(const string& dir = "/tmp", int rows = 200000, int cols = 64) {
+		std::cout << "\n---test LC::MappedWeights" << std::endl;
+		const string src = dir + "/lc_mapped_weights_test.bin", dst = dir + "/lc_mapped_weights_test.lcmat";
+		const MatRowMajor emb = MatRowMajor::Random(rows, cols), small = MatRowMajor::Random(3, 5);
+		{
+			LC::BinaryFileIO bf(src.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			bf << "emb=f" << rows << "x" << cols << "&small=f3x5&\n";
+			bf.writeBinaryNumbers(emb.data(), emb.size());
+			bf.writeBinaryNumbers(small.data(), small.size());
+		}
+		LC::TimerAccurate timer;
+		std::map<string, Mat> loaded = FeedForwardNet::loadLookUps(src);
+		const double t_load = timer.getElapsedTimeAndRestart();
+		convertLookUps(src, dst);
+		const double t_convert = timer.getElapsedTimeAndRestart();
+		MappedWeights mapped(dst);
+		std::map<string, ConstMap> lookUps = mapped.lookUps();
+		const double t_mmap = timer.getElapsedTimeAndRestart();
+		for (size_t i = 0; i < mapped.size(); ++i)
+			mapped.verify(i);
+		std::cout << "max abs diff: " << std::max((lookUps.at("emb") - loaded["emb"]).cwiseAbs().maxCoeff(),
+				(lookUps.at("small") - small).cwiseAbs().maxCoeff()) << "; aligned: "
+				<< (((size_t) lookUps.at("emb").data()) % 64 == 0) << std::endl;
+		std::cout << "loadLookUps: " << t_load << " s; convert: " << t_convert << " s; mmap: " << t_mmap << " s"
+				<< std::endl;
+
+		FeedForwardNet net;
+		{
+			LC::BinaryFileIO bf(src.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+			bf << "Affine&W=f" << cols << "x32&b=f32|ReLU|LeakyReLU&alpha=0.1|Affine&W=f32x1&b=f1|\n";
+			const MatRowMajor W1 = MatRowMajor::Random(cols, 32), b1 = MatRowMajor::Random(1, 32);
+			const MatRowMajor W2 = MatRowMajor::Random(32, 1), b2 = MatRowMajor::Random(1, 1);
+			bf.writeBinaryNumbers(W1.data(), W1.size());
+			bf.writeBinaryNumbers(b1.data(), b1.size());
+			bf.writeBinaryNumbers(W2.data(), W2.size());
+			bf.writeBinaryNumbers(b2.data(), b2.size());
+		}
+		net.loadNetStructure(src);
+		convertNet(src, dst);
+		FeedForwardNet mappedNet;
+		loadNet(mappedNet, dst);
+		const Mat input = Mat::Random(8, cols);
+		std::cout << "net max abs diff: " << (net.forward(input) - mappedNet.forward(input)).cwiseAbs().maxCoeff()
+				<< std::endl;
+		std::remove(src.c_str());
+		std::remove(dst.c_str());
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_MAPPEDWEIGHTS_HPP_ */
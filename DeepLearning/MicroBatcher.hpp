@@ -0,0 +1,326 @@
+/*
+ * MicroBatcher.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      FeedForwardNet 的微批处理：
+ *      多个服务线程各自提交 1xN 的 RowVec， 单独的 dispatcher 线程收集到 max_batch 行，
+ *      或第一行等待超过 max_wait_us 微秒后， 用 MatInputLoader 按行拼成一个矩阵，
+ *      调用一次 forward_mutableInput（GEMM 而不是多次 GEMV）， 再把每一行的结果交给对应的 future。
+ *      max_batch 越大吞吐越高， max_wait_us 是负载较低时单个请求额外增加的最大延迟。
+ *      net 只在 dispatcher 线程中使用， 运行期间不要在其他线程修改它。
+ *
+ *      用法：
+ *      LC::MicroBatcher batcher(net, 32, 200);
+ *      std::future<LC::RowVec> f = batcher.submit(x);  // 多线程同时调用
+ *      LC::RowVec y = f.get();
+ *      std::cout << batcher.getStats().toString() << std::endl;
+ */
+
+#ifndef LC_DEEPLEARNING_MICROBATCHER_HPP_
+#define LC_DEEPLEARNING_MICROBATCHER_HPP_
+
+#include "FeedForwardNet.hpp"
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <chrono>
+#include <algorithm>
+
+namespace LC {
+
+class MicroBatcher {
+public:
+	typedef std::chrono::steady_clock Clock;
+
+	static const size_t LATENCY_WINDOW = 1 << 16;  ///< 计算延迟分位数时保留的最近请求数
+
+	/**
+	 * 从上次 resetStats 开始的统计， 延迟为 submit 到结果可用的时间；
+	 * 请求数、 平均和最大延迟包括所有请求， p50/p99 只统计最近 LATENCY_WINDOW 个请求
+	 */
+	struct Stats {
+		size_t requests;
+		size_t batches;
+		double seconds;
+		double mean_latency_us;
+		double p50_latency_us;
+		double p99_latency_us;
+		double max_latency_us;
+
+		Stats() :
+				requests(0), batches(0), seconds(0), mean_latency_us(0), p50_latency_us(0), p99_latency_us(0), max_latency_us(
+						0) {
+		}
+
+		double meanBatchSize() const {
+			return batches > 0 ? (double) requests / batches : 0;
+		}
+
+		double throughput() const {  ///< rows/sec
+			return seconds > 0 ? requests / seconds : 0;
+		}
+
+		string toString() const {
+			std::stringstream ss;
+			ss << "requests: " << requests << "; batches: " << batches << "; mean batch: " << meanBatchSize()
+					<< "; throughput: " << throughput() << " rows/sec; latency us mean/p50/p99/max: " << mean_latency_us
+					<< "/" << p50_latency_us << "/" << p99_latency_us << "/" << max_latency_us;
+			return ss.str();
+		}
+	};
+
+	/**
+	 * @param max_batch 每个 batch 的最大行数
+	 * @param max_wait_us 第一行到达后最多等待的微秒数， 为0时不等待， 只合并已经在队列中的请求
+	 */
+	MicroBatcher(FeedForwardNet& net, int max_batch = 32, int max_wait_us = 200) :
+			net(net), max_batch(std::max(max_batch, 1)), max_wait(max_wait_us), input_width(net.inputWidth()), stop(
+					false), latency_next(0), num_requests(0), latency_sum_us(0), latency_max_us(0), batches(0), start(
+						Clock::now()) {
+		dispatcher = std::thread(&MicroBatcher::dispatch, this);
+	}
+
+	/**
+	 * 处理完队列中已有的请求后退出
+	 */
+	~MicroBatcher() {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			stop = true;
+		}
+		cv.notify_all();
+		dispatcher.join();
+	}
+
+	std::future<RowVec> submit(const RowVec& x) {
+		if (input_width > 0 && x.cols() != input_width)
+			throw string("MicroBatcher: input width ") + LC::Str::num2str((int) x.cols()) + " != "
+					+ LC::Str::num2str((int) input_width);
+		Request req(x);
+		std::future<RowVec> result = req.promise.get_future();
+		size_t size;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			if (stop)
+				throw string("MicroBatcher: submit after stop");
+			queue.push_back(std::move(req));
+			size = queue.size();
+		}
+		// 只有 dispatcher 可能在等待： 队列从空变为非空， 或已经凑满一个 batch 时才需要唤醒
+		if (size == 1 || size >= (size_t) max_batch)
+			cv.notify_one();
+		return result;
+	}
+
+	RowVec forward(const RowVec& x) {
+		return submit(x).get();
+	}
+
+	Stats getStats() const {
+		std::vector<double> latency;
+		Stats stats;
+		{
+			std::unique_lock<std::mutex> lock(stats_mutex);
+			latency = latencies_us;
+			stats.requests = num_requests;
+			stats.batches = batches;
+			stats.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+			stats.mean_latency_us = num_requests > 0 ? latency_sum_us / num_requests : 0;
+			stats.max_latency_us = latency_max_us;
+		}
+		if (latency.empty())
+			return stats;
+		// 窗口最多 LATENCY_WINDOW 个， 在锁外排序
+		std::sort(latency.begin(), latency.end());
+		stats.p50_latency_us = latency[latency.size() / 2];
+		stats.p99_latency_us = latency[std::min(latency.size() - 1, latency.size() * 99 / 100)];
+		return stats;
+	}
+
+	void resetStats() {
+		std::unique_lock<std::mutex> lock(stats_mutex);
+		latencies_us.clear();
+		latency_next = 0;
+		num_requests = 0;
+		latency_sum_us = 0;
+		latency_max_us = 0;
+		batches = 0;
+		start = Clock::now();
+	}
+
+	/**
+	 * num_threads 个线程各自同步地提交 requests_per_thread 行， 输出不同 max_batch 和 max_wait_us 下的延迟和吞吐，
+	 * 第一行为不合并（每个线程直接调用 forward）的结果
+	 */
+	static void benchmark_microBatching(FeedForwardNet& net, int num_threads = 16, int requests_per_thread = 2000) {
+		std::cout << "\n---benchmark LC::MicroBatcher, threads: " << num_threads << std::endl;
+		const Eigen::Index cols = net.inputWidth();
+		if (cols <= 0)
+			throw string("MicroBatcher: can not get input width of the net");
+		const Mat inputs = Mat::Random(requests_per_thread, cols);
+
+		{
+			std::mutex net_mutex;  // forward 不是线程安全的（层内有临时状态）， 作为基准时串行调用
+			LC::TimerAccurate timer;
+			std::vector<std::thread> threads;
+			for (int t = 0; t < num_threads; ++t)
+				threads.push_back(std::thread([&]() {
+					for (int i = 0; i < requests_per_thread; ++i) {
+						std::unique_lock<std::mutex> lock(net_mutex);
+						net.forward(inputs.row(i));
+					}
+				}));
+			for (int t = 0; t < num_threads; ++t)
+				threads[t].join();
+			const double seconds = timer.getElapsedTime();
+			std::cout << "no batching: " << num_threads * requests_per_thread / seconds << " rows/sec" << std::endl;
+		}
+
+		const int batch_sizes[] = { 1, 8, 32, 128 };
+		const int wait_us[] = { 0, 50, 200, 1000 };
+		for (int b = 0; b < 4; ++b) {
+			for (int w = 0; w < 4; ++w) {
+				MicroBatcher batcher(net, batch_sizes[b], wait_us[w]);
+				std::vector<std::thread> threads;
+				for (int t = 0; t < num_threads; ++t)
+					threads.push_back(std::thread([&]() {
+						for (int i = 0; i < requests_per_thread; ++i)
+							batcher.forward(inputs.row(i));
+					}));
+				for (int t = 0; t < num_threads; ++t)
+					threads[t].join();
+				std::cout << "B=" << batch_sizes[b] << " T=" << wait_us[w] << "us: " << batcher.getStats().toString()
+						<< std::endl;
+			}
+		}
+	}
+
+	static void testMicroBatcher(int input_width = 256, int num_threads = 8, int requests_per_thread = 500) {
+		std::cout << "\n---test LC::MicroBatcher" << std::endl;
+		FeedForwardNet net;
+		const int widths[] = { input_width, 128, 64, 1 };
+		for (int l = 0; l + 1 < 4; ++l) {
+			net.addAffine(Mat::Random(widths[l], widths[l + 1]), RowVec::Random(widths[l + 1]));
+			if (l + 2 < 4)
+				net.addReLU();
+		}
+		const Mat inputs = Mat::Random(requests_per_thread, input_width);
+		const Mat expected = net.forward(inputs);
+
+		std::vector<float> max_diff(num_threads, 0.0f);
+		{
+			MicroBatcher batcher(net, 16, 100);
+			std::vector<std::thread> threads;
+			for (int t = 0; t < num_threads; ++t)
+				threads.push_back(std::thread([&, t]() {
+					for (int i = 0; i < requests_per_thread; ++i) {
+						RowVec y = batcher.forward(inputs.row(i));
+						max_diff[t] = std::max(max_diff[t], (y - expected.row(i)).cwiseAbs().maxCoeff());
+					}
+				}));
+			for (int t = 0; t < num_threads; ++t)
+				threads[t].join();
+			std::cout << batcher.getStats().toString() << std::endl;
+		}
+		std::cout << "max abs diff: " << *std::max_element(max_diff.begin(), max_diff.end()) << std::endl;
+		benchmark_microBatching(net, num_threads, requests_per_thread);
+	}
+
+private:
+	struct Request {
+		RowVec x;
+		std::promise<RowVec> promise;
+		Clock::time_point arrival;
+
+		explicit Request(const RowVec& x) :
+				x(x), arrival(Clock::now()) {
+		}
+	};
+
+	FeedForwardNet& net;
+	const int max_batch;
+	const std::chrono::microseconds max_wait;
+	const Eigen::Index input_width;
+
+	std::deque<Request> queue;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stop;
+	std::thread dispatcher;
+
+	mutable std::mutex stats_mutex;
+	std::vector<double> latencies_us;  ///< 最近 LATENCY_WINDOW 个请求的延迟（环形缓冲）
+	size_t latency_next;  ///< 环形缓冲中下一个写入的位置
+	size_t num_requests;
+	double latency_sum_us;
+	double latency_max_us;
+	size_t batches;
+	Clock::time_point start;
+
+	MicroBatcher(const MicroBatcher&);
+	MicroBatcher& operator=(const MicroBatcher&);
+
+	void dispatch() {
+		MatInputLoader loader;
+		std::vector<Request> batch;
+		while (true) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				while (!stop && queue.empty())
+					cv.wait(lock);
+				if (queue.empty())
+					return;
+				const Clock::time_point deadline = queue.front().arrival + max_wait;
+				while (!stop && queue.size() < (size_t) max_batch && Clock::now() < deadline)
+					cv.wait_until(lock, deadline);
+				const size_t n = std::min(queue.size(), (size_t) max_batch);
+				for (size_t i = 0; i < n; ++i) {
+					batch.push_back(std::move(queue.front()));
+					queue.pop_front();
+				}
+			}
+			run(batch, loader);
+			batch.clear();
+		}
+	}
+
+	void run(std::vector<Request>& batch, MatInputLoader& loader) {
+		const Mat* output = NULL;
+		try {
+			loader.setInputSize(batch.size(), batch[0].x.cols());
+			for (size_t i = 0; i < batch.size(); ++i)
+				loader.addSubInputRow(batch[i].x);
+			output = &net.forward_mutableInput(loader.getInput());
+		} catch (...) {
+			for (size_t i = 0; i < batch.size(); ++i)
+				batch[i].promise.set_exception(std::current_exception());
+			return;
+		}
+		{
+			// 先记录统计再设置结果， 调用者拿到结果后 getStats 一定包含该请求
+			const Clock::time_point now = Clock::now();
+			std::unique_lock<std::mutex> lock(stats_mutex);
+			++batches;
+			for (size_t i = 0; i < batch.size(); ++i) {
+				const double latency = std::chrono::duration<double, std::micro>(now - batch[i].arrival).count();
+				if (latencies_us.size() < LATENCY_WINDOW)
+					latencies_us.push_back(latency);
+				else
+					latencies_us[latency_next] = latency;
+				latency_next = (latency_next + 1) % LATENCY_WINDOW;
+				++num_requests;
+				latency_sum_us += latency;
+				latency_max_us = std::max(latency_max_us, latency);
+			}
+		}
+		for (size_t i = 0; i < batch.size(); ++i)
+			batch[i].promise.set_value(output->row(i));
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_MICROBATCHER_HPP_ */
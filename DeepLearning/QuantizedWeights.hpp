@@ -0,0 +1,835 @@
+/*
+ * QuantizedWeights.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      低精度存储的权重矩阵， 用于 FeedForwardNet 的 Affine 层和 loadLookUps 的 embedding 表：
+ *      1、FP16 / BF16： 每个数2字节， 计算时转换为 float， 用 float 累加；
+ *      2、INT8： 每行（一个输出通道或一个 embedding）单独的对称 scale = max|x| / 127， 每个数1字节；
+ *         矩阵乘法时输入也按行动态量化为 int8， int32 累加后再乘两个 scale。
+ *      运行时检测CPU指令集： AVX-VNNI（vpdpbusd）> AVX2（vpmaddwd， FP16 使用 F16C）> 标量。
+ *      按行存储， 每行补零到 ALIGN_ELEMENTS 的整数倍， SIMD 循环不需要处理尾部。
+ */
+
+#ifndef LC_DEEPLEARNING_QUANTIZEDWEIGHTS_HPP_
+#define LC_DEEPLEARNING_QUANTIZEDWEIGHTS_HPP_
+
+#include <stdint.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LC_QUANTIZED_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace LC {
+
+enum WeightType {
+	WEIGHT_FP32 = 0, WEIGHT_FP16 = 1, WEIGHT_BF16 = 2, WEIGHT_INT8 = 3
+};
+
+/**
+ * 量化前后的内存和误差
+ */
+struct QuantizationReport {
+	size_t bytes_fp32;
+	size_t bytes_quantized;
+	float max_abs_diff;
+	float mean_abs_diff;
+
+	QuantizationReport() :
+			bytes_fp32(0), bytes_quantized(0), max_abs_diff(0), mean_abs_diff(0) {
+	}
+
+	std::string toString() const {
+		std::stringstream ss;
+		ss << "bytes: " << bytes_fp32 << " -> " << bytes_quantized << " ("
+				<< (bytes_quantized > 0 ? (double) bytes_fp32 / bytes_quantized : 0.0) << "x); max abs diff: "
+				<< max_abs_diff << "; mean abs diff: " << mean_abs_diff;
+		return ss.str();
+	}
+};
+
+/**
+ * rows 行、 cols 列的低精度矩阵， 每行连续存储。
+ * 作为 Affine 层的权重时保存 W 的转置（每行是一个输出通道）， 作为 embedding 表时每行是一个 embedding
+ */
+class QuantizedRows {
+public:
+	enum SIMDLevel {
+		SIMD_SCALAR = 0, SIMD_AVX2 = 1, SIMD_AVX_VNNI = 2
+	};
+	static const size_t ALIGN_ELEMENTS = 16;  ///< embedding 的维数通常是16的倍数， 不浪费内存
+
+	QuantizedRows() :
+			type_(WEIGHT_FP32), rows_(0), cols_(0), stride_(0), level_(cpu_level()) {
+	}
+
+	QuantizedRows(WeightType type, size_t rows, size_t cols, SIMDLevel max_level = SIMD_AVX_VNNI) :
+			type_(type), rows_(rows), cols_(cols), stride_((cols + ALIGN_ELEMENTS - 1) / ALIGN_ELEMENTS * ALIGN_ELEMENTS), level_(
+					std::min(max_level, cpu_level())) {
+		switch (type_) {
+		case WEIGHT_FP32:
+			f32_.assign(rows_ * stride_, 0.0f);
+			break;
+		case WEIGHT_FP16:
+		case WEIGHT_BF16:
+			u16_.assign(rows_ * stride_, 0);
+			break;
+		case WEIGHT_INT8:
+			i8_.assign(rows_ * stride_, 0);
+			scales_.assign(rows_, 0.0f);
+			row_sums_.assign(rows_, 0);
+			break;
+		default:
+			throw std::string("QuantizedRows: unknown weight type");
+		}
+	}
+
+	/**
+	 * 由行优先的 float 矩阵量化
+	 */
+	QuantizedRows(WeightType type, const float* data, size_t rows, size_t cols, SIMDLevel max_level = SIMD_AVX_VNNI) :
+			QuantizedRows(type, rows, cols, max_level) {
+		for (size_t r = 0; r < rows; ++r)
+			setRow(r, data + r * cols);
+	}
+
+	static SIMDLevel cpu_level() {
+#ifdef LC_QUANTIZED_SIMD_X86
+		static const SIMDLevel level =
+				__builtin_cpu_supports("avxvnni") ? SIMD_AVX_VNNI :
+				(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) ? SIMD_AVX2 : SIMD_SCALAR;
+		return level;
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+	static WeightType parseWeightType(const std::string& name) {
+		if (name == "fp32" || name == "f")
+			return WEIGHT_FP32;
+		if (name == "fp16" || name == "h")
+			return WEIGHT_FP16;
+		if (name == "bf16" || name == "b")
+			return WEIGHT_BF16;
+		if (name == "int8" || name == "q")
+			return WEIGHT_INT8;
+		throw std::string("unknown weight type: ") + name;
+	}
+
+	/**
+	 * loadLookUps 文件头中的元素类型， 如 "W=q1000x64" 中的 'q'
+	 */
+	static char typeChar(WeightType type) {
+		static const char chars[] = { 'f', 'h', 'b', 'q' };
+		return chars[type];
+	}
+
+	inline WeightType type() const {
+		return type_;
+	}
+
+	inline size_t rows() const {
+		return rows_;
+	}
+
+	inline size_t cols() const {
+		return cols_;
+	}
+
+	inline SIMDLevel level() const {
+		return level_;
+	}
+
+	inline size_t memoryBytes() const {
+		return f32_.size() * sizeof(float) + u16_.size() * sizeof(uint16_t) + i8_.size() + scales_.size() * sizeof(float)
+				+ row_sums_.size() * sizeof(int32_t);
+	}
+
+	inline float scale(size_t r) const {
+		return type_ == WEIGHT_INT8 ? scales_[r] : 1.0f;
+	}
+
+	inline const int8_t* int8Row(size_t r) const {
+		return i8_.data() + r * stride_;
+	}
+
+	inline const uint16_t* halfRow(size_t r) const {
+		return u16_.data() + r * stride_;
+	}
+
+	/**
+	 * 预取第 r 行， EmbeddingBag 在累加前几行时提前调用
+	 */
+	inline void prefetchRow(size_t r) const {
+#ifdef __GNUC__
+		const char* p;
+		size_t bytes;
+		switch (type_) {
+		case WEIGHT_FP32:
+			p = (const char*) (f32_.data() + r * stride_);
+			bytes = cols_ * sizeof(float);
+			break;
+		case WEIGHT_INT8:
+			p = (const char*) (i8_.data() + r * stride_);
+			bytes = cols_;
+			break;
+		default:
+			p = (const char*) (u16_.data() + r * stride_);
+			bytes = cols_ * sizeof(uint16_t);
+			break;
+		}
+		for (size_t i = 0; i < bytes; i += 64)
+			__builtin_prefetch(p + i, 0, 1);
+#endif
+	}
+
+	/**
+	 * 量化一行， values 有 cols 个数
+	 */
+	void setRow(size_t r, const float* values) {
+		switch (type_) {
+		case WEIGHT_FP32:
+			std::copy(values, values + cols_, f32_.begin() + r * stride_);
+			break;
+		case WEIGHT_FP16:
+			for (size_t c = 0; c < cols_; ++c)
+				u16_[r * stride_ + c] = float_to_half(values[c]);
+			break;
+		case WEIGHT_BF16:
+			for (size_t c = 0; c < cols_; ++c)
+				u16_[r * stride_ + c] = float_to_bf16(values[c]);
+			break;
+		case WEIGHT_INT8: {
+			float max_abs = 0;
+			for (size_t c = 0; c < cols_; ++c)
+				max_abs = std::max(max_abs, std::abs(values[c]));
+			const float s = max_abs / 127.0f;
+			const float inv = max_abs > 0 ? 127.0f / max_abs : 0.0f;
+			int8_t* q = i8_.data() + r * stride_;
+			for (size_t c = 0; c < cols_; ++c)
+				q[c] = (int8_t) std::max(-127L, std::min(127L, std::lround(values[c] * inv)));
+			setRowInt8(r, s, q);
+			break;
+		}
+		}
+	}
+
+	/**
+	 * 直接设置已量化的一行（从量化文件加载时使用）
+	 */
+	void setRowInt8(size_t r, float scale, const int8_t* q) {
+		int8_t* dst = i8_.data() + r * stride_;
+		if (dst != q)
+			std::copy(q, q + cols_, dst);
+		scales_[r] = scale;
+		int32_t sum = 0;
+		for (size_t c = 0; c < cols_; ++c)
+			sum += dst[c];
+		row_sums_[r] = sum;
+	}
+
+	void setRowHalf(size_t r, const uint16_t* h) {
+		std::copy(h, h + cols_, u16_.begin() + r * stride_);
+	}
+
+	/**
+	 * acc[0, cols) += w * row(r)， 用于 embedding 的加权求和
+	 */
+	void axpyRow(size_t r, float w, float* acc) const {
+		size_t c = 0;
+#ifdef LC_QUANTIZED_SIMD_X86
+		if (level_ >= SIMD_AVX2)
+			c = axpy_avx2(r, w, acc);
+#endif
+		for (; c < cols_; ++c)
+			acc[c] += w * value(r, c);
+	}
+
+	void dequantizeRow(size_t r, float* out) const {
+		std::fill(out, out + cols_, 0.0f);
+		axpyRow(r, 1.0f, out);
+	}
+
+	inline float value(size_t r, size_t c) const {
+		const size_t i = r * stride_ + c;
+		switch (type_) {
+		case WEIGHT_FP32:
+			return f32_[i];
+		case WEIGHT_FP16:
+			return half_to_float(u16_[i]);
+		case WEIGHT_BF16:
+			return bf16_to_float(u16_[i]);
+		default:
+			return scales_[r] * i8_[i];
+		}
+	}
+
+	/**
+	 * out(i, r) = sum_k x(i, k) * row(r)[k]， 即 out = X * W（本对象保存 W 的转置）。
+	 * x(i, k) 位于 x[i * x_row_stride + k * x_col_stride]， out(i, r) 位于 out[i * out_row_stride + r * out_col_stride]，
+	 * 行优先和列优先的 Eigen 矩阵都可以直接传入。
+	 * 先把 n 行输入复制（INT8 时量化）到当前线程的缓冲区， 缓冲区只增不减， 容量足够后不再分配内存。
+	 * SIMD 按块计算（见 matmul_blocked）： 一次读入的输入被多行权重共用， 一次读入（转换）的权重被多行输入共用
+	 */
+	void matmul(const float* x, size_t n, size_t x_row_stride, size_t x_col_stride, float* out, size_t out_row_stride,
+			size_t out_col_stride) const {
+		if (type_ == WEIGHT_INT8) {
+			matmul_int8(x, n, x_row_stride, x_col_stride, out, out_row_stride, out_col_stride);
+			return;
+		}
+		const float* xf = copy_input(x, n, x_row_stride, x_col_stride);
+#ifdef LC_QUANTIZED_SIMD_X86
+		if (level_ >= SIMD_AVX2) {
+			switch (type_) {
+			case WEIGHT_FP32:
+				matmul_blocked<FloatDot<F32Load> >(f32_.data(), xf, n, NULL, out, out_row_stride, out_col_stride);
+				break;
+			case WEIGHT_FP16:
+				matmul_blocked<FloatDot<F16Load> >(u16_.data(), xf, n, NULL, out, out_row_stride, out_col_stride);
+				break;
+			default:
+				matmul_blocked<FloatDot<BF16Load> >(u16_.data(), xf, n, NULL, out, out_row_stride, out_col_stride);
+				break;
+			}
+			return;
+		}
+#endif
+		for (size_t r = 0; r < rows_; ++r) {
+			for (size_t i = 0; i < n; ++i) {
+				const float* xi = xf + i * stride_;
+				float sum = 0;
+				for (size_t c = 0; c < cols_; ++c)
+					sum += value(r, c) * xi[c];
+				out[i * out_row_stride + r * out_col_stride] = sum;
+			}
+		}
+	}
+
+	/**
+	 * 与 fp32 原矩阵（行优先）比较量化误差
+	 */
+	QuantizationReport drift(const float* data) const {
+		QuantizationReport report;
+		report.bytes_fp32 = rows_ * cols_ * sizeof(float);
+		report.bytes_quantized = memoryBytes();
+		double sum = 0;
+		for (size_t r = 0; r < rows_; ++r) {
+			for (size_t c = 0; c < cols_; ++c) {
+				const float d = std::abs(value(r, c) - data[r * cols_ + c]);
+				report.max_abs_diff = std::max(report.max_abs_diff, d);
+				sum += d;
+			}
+		}
+		report.mean_abs_diff = rows_ * cols_ > 0 ? sum / (rows_ * cols_) : 0;
+		return report;
+	}
+
+	static uint16_t float_to_half(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		const uint32_t sign = (x >> 16) & 0x8000;
+		x &= 0x7FFFFFFF;
+		if (x >= 0x7F800000)  // inf / nan
+			return sign | 0x7C00 | (x > 0x7F800000 ? 0x200 : 0);
+		if (x >= 0x477FF000)  // >= 65520， 舍入后溢出
+			return sign | 0x7C00;
+		if (x < 0x38800000) {  // < 2^-14， 非规格化数
+			float a;
+			std::memcpy(&a, &x, sizeof(a));
+			return sign | (uint16_t) std::lrint(a * 16777216.0f);  // 单位为 2^-24， 舍入到偶数
+		}
+		uint32_t h = ((x >> 23) - 112) << 10 | ((x & 0x7FFFFF) >> 13);
+		const uint32_t rest = x & 0x1FFF;
+		if (rest > 0x1000 || (rest == 0x1000 && (h & 1)))
+			++h;  // 进位可以直接进入指数
+		return sign | h;
+	}
+
+	static float half_to_float(uint16_t h) {
+		const uint32_t sign = (uint32_t) (h & 0x8000) << 16;
+		const uint32_t exp = (h >> 10) & 0x1F;
+		const uint32_t mant = h & 0x3FF;
+		if (exp == 0) {
+			const float f = mant * (1.0f / 16777216.0f);
+			return sign ? -f : f;
+		}
+		const uint32_t x = sign | (exp == 31 ? 0x7F800000 | (mant << 13) : ((exp + 112) << 23) | (mant << 13));
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+	static uint16_t float_to_bf16(float f) {
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		if ((x & 0x7FFFFFFF) > 0x7F800000)
+			return (x >> 16) | 0x40;  // quiet nan
+		return (x + 0x7FFF + ((x >> 16) & 1)) >> 16;
+	}
+
+	static float bf16_to_float(uint16_t h) {
+		const uint32_t x = (uint32_t) h << 16;
+		float f;
+		std::memcpy(&f, &x, sizeof(f));
+		return f;
+	}
+
+private:
+	WeightType type_;
+	size_t rows_;
+	size_t cols_;
+	size_t stride_;  ///< 每行补零后的长度
+	SIMDLevel level_;
+
+	std::vector<float> f32_;
+	std::vector<uint16_t> u16_;
+	std::vector<int8_t> i8_;
+	std::vector<float> scales_;
+	std::vector<int32_t> row_sums_;  ///< INT8 每行的和， VNNI 把输入加128变为 uint8 后用于修正
+
+	enum {
+		MATMUL_INPUT_BLOCK = 48  ///< matmul_blocked 每块输入的行数， 3的倍数
+	};
+
+	static std::vector<float>& thread_float_buffer() {
+		static thread_local std::vector<float> buffer;
+		return buffer;
+	}
+
+	static std::vector<float>& thread_panel_buffer() {
+		static thread_local std::vector<float> buffer;
+		return buffer;
+	}
+
+	/**
+	 * 把 n 行输入复制到当前线程的缓冲区， 每行补零到 stride_ 个数
+	 */
+	const float* copy_input(const float* x, size_t n, size_t x_row_stride, size_t x_col_stride) const {
+		std::vector<float>& xf = thread_float_buffer();
+		if (xf.size() < n * stride_)
+			xf.resize(n * stride_);
+		for (size_t i = 0; i < n; ++i) {
+			float* xi = xf.data() + i * stride_;
+			for (size_t k = 0; k < cols_; ++k)
+				xi[k] = x[i * x_row_stride + k * x_col_stride];
+			std::fill(xi + cols_, xi + stride_, 0.0f);
+		}
+		return xf.data();
+	}
+
+	void matmul_int8(const float* x, size_t n, size_t x_row_stride, size_t x_col_stride, float* out,
+			size_t out_row_stride, size_t out_col_stride) const {
+		static thread_local std::vector<int8_t> xq;
+		static thread_local std::vector<float> xs;
+		if (xq.size() < n * stride_)
+			xq.resize(n * stride_);
+		if (xs.size() < n)
+			xs.resize(n);
+		const float* xf = copy_input(x, n, x_row_stride, x_col_stride);
+		// VNNI 的 vpdpbusd 是 uint8 * int8， 输入加128后存为 uint8， 结果减去 128 * row_sums_
+		const bool vnni = level_ >= SIMD_AVX_VNNI;
+		for (size_t i = 0; i < n; ++i) {
+			const float* xi = xf + i * stride_;
+			int8_t* qi = xq.data() + i * stride_;
+#ifdef LC_QUANTIZED_SIMD_X86
+			if (level_ >= SIMD_AVX2) {
+				xs[i] = quantize_row_avx2(xi, qi, vnni);
+				continue;
+			}
+#endif
+			float max_abs = 0;
+			for (size_t k = 0; k < cols_; ++k)
+				max_abs = std::max(max_abs, std::abs(xi[k]));
+			const float inv = max_abs > 0 ? 127.0f / max_abs : 0.0f;
+			xs[i] = max_abs / 127.0f;
+			for (size_t k = 0; k < stride_; ++k)  // 补零的权重为0， 补的值不影响结果
+				qi[k] = (int8_t) std::lrint(xi[k] * inv);
+		}
+#ifdef LC_QUANTIZED_SIMD_X86
+		if (vnni) {
+			matmul_blocked<VNNIDot>(i8_.data(), (const uint8_t*) xq.data(), n, xs.data(), out, out_row_stride,
+					out_col_stride);
+			return;
+		}
+		if (level_ >= SIMD_AVX2) {
+			matmul_blocked<Int8Dot>(i8_.data(), xq.data(), n, xs.data(), out, out_row_stride, out_col_stride);
+			return;
+		}
+#endif
+		for (size_t r = 0; r < rows_; ++r) {
+			const int8_t* w = i8_.data() + r * stride_;
+			for (size_t i = 0; i < n; ++i) {
+				const int8_t* qi = xq.data() + i * stride_;
+				int32_t dot = 0;
+				for (size_t k = 0; k < cols_; ++k)
+					dot += (int32_t) qi[k] * w[k];
+				out[i * out_row_stride + r * out_col_stride] = dot * (xs[i] * scales_[r]);
+			}
+		}
+	}
+
+#ifdef LC_QUANTIZED_SIMD_X86
+	__attribute__((target("avx2")))
+	static inline float hsum_avx2(__m256 v) {
+		__m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+		s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_add_ss(s, _mm_movehdup_ps(s));
+		return _mm_cvtss_f32(s);
+	}
+
+	__attribute__((target("avx2")))
+	static inline int32_t hsum_epi32_avx2(__m256i v) {
+		__m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+		s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtsi128_si32(s);
+	}
+
+	/**
+	 * 4个向量各自的和， 比4次 hsum_avx2 少一半以上的指令
+	 */
+	__attribute__((target("avx2")))
+	static inline __m128 hsum4_avx2(__m256 a, __m256 b, __m256 c, __m256 d) {
+		const __m256 s = _mm256_hadd_ps(_mm256_hadd_ps(a, b), _mm256_hadd_ps(c, d));
+		return _mm_add_ps(_mm256_castps256_ps128(s), _mm256_extractf128_ps(s, 1));
+	}
+
+	__attribute__((target("avx2")))
+	static inline __m128i hsum4_epi32_avx2(__m256i a, __m256i b, __m256i c, __m256i d) {
+		const __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(a, b), _mm256_hadd_epi32(c, d));
+		return _mm_add_epi32(_mm256_castsi256_si128(s), _mm256_extracti128_si256(s, 1));
+	}
+
+	__attribute__((target("avx2,fma")))
+	static inline __m256 load_bf16_avx2(const uint16_t* a) {
+		const __m256i w = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) a));
+		return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+	}
+
+	/**
+	 * load 把8个权重转换为 float， decode 把连续的 n 个（8的倍数）权重转换为 float
+	 */
+	struct F32Load {
+		typedef float T;
+		__attribute__((target("avx2")))
+		static inline __m256 load(const float* a) {
+			return _mm256_loadu_ps(a);
+		}
+
+		static inline const float* decode(const float* a, size_t, float*) {
+			return a;
+		}
+	};
+
+	struct F16Load {
+		typedef uint16_t T;
+		__attribute__((target("avx2,f16c")))
+		static inline __m256 load(const uint16_t* a) {
+			return _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) a));
+		}
+
+		__attribute__((target("avx2,fma,f16c")))
+		static const float* decode(const uint16_t* a, size_t n, float* buffer) {
+			for (size_t k = 0; k < n; k += 8)
+				_mm256_storeu_ps(buffer + k, load(a + k));
+			return buffer;
+		}
+	};
+
+	struct BF16Load {
+		typedef uint16_t T;
+		__attribute__((target("avx2,fma")))
+		static inline __m256 load(const uint16_t* a) {
+			return load_bf16_avx2(a);
+		}
+
+		__attribute__((target("avx2,fma")))
+		static const float* decode(const uint16_t* a, size_t n, float* buffer) {
+			for (size_t k = 0; k < n; k += 8)
+				_mm256_storeu_ps(buffer + k, load(a + k));
+			return buffer;
+		}
+	};
+
+	/**
+	 * matmul_blocked 的内核： dot<R, N> 计算从 w 开始的 R 行权重与从 x 开始的 N 行输入的 R * N 个内积（各 len 个数），
+	 * 结果写入 sums[r * N + i]。 每次读入的输入被 R 行权重共用， 每次读入的权重被 N 行输入共用， R * N 个累加器互不依赖。
+	 * panel 把连续的几行权重转换为 Panel::W， 由 Panel 与多行输入相乘。
+	 * 常数次的循环要完全展开（GCC -O2 默认不展开）， 累加器才能都放在寄存器中
+	 */
+	template<typename Load>
+	struct FloatDot {
+		typedef typename Load::T W;
+		typedef float X;
+		typedef float Acc;
+		typedef FloatDot<F32Load> Panel;  ///< 多行输入时 FP16 / BF16 的权重先转换为 float
+
+		static inline const float* panel(const W* w, size_t n, float* buffer) {
+			return Load::decode(w, n, buffer);
+		}
+
+		template<int R, int N>
+		__attribute__((target("avx2,fma,f16c")))
+		static void dot(const W* w, size_t w_stride, const float* x, size_t x_stride, size_t len, float* sums) {
+			__m256 acc[R * N];
+#pragma GCC unroll 16
+			for (int j = 0; j < R * N; ++j)
+				acc[j] = _mm256_setzero_ps();
+			for (size_t k = 0; k < len; k += 8) {
+				__m256 xv[N];
+#pragma GCC unroll 16
+				for (int i = 0; i < N; ++i)
+					xv[i] = _mm256_loadu_ps(x + i * x_stride + k);
+#pragma GCC unroll 16
+				for (int r = 0; r < R; ++r) {
+					const __m256 wv = Load::load(w + r * w_stride + k);
+#pragma GCC unroll 16
+					for (int i = 0; i < N; ++i)
+						acc[r * N + i] = _mm256_fmadd_ps(wv, xv[i], acc[r * N + i]);
+				}
+			}
+			int j = 0;
+#pragma GCC unroll 16
+			for (; j + 4 <= R * N; j += 4)
+				_mm_storeu_ps(sums + j, hsum4_avx2(acc[j], acc[j + 1], acc[j + 2], acc[j + 3]));
+#pragma GCC unroll 16
+			for (; j < R * N; ++j)
+				sums[j] = hsum_avx2(acc[j]);
+		}
+	};
+
+	/**
+	 * int8 * int8： 符号扩展为 int16 后用 vpmaddwd， 不会像 vpmaddubsw 那样饱和
+	 */
+	struct Int8Dot {
+		typedef int8_t W;
+		typedef int8_t X;
+		typedef int32_t Acc;
+		typedef Int8Dot Panel;
+
+		static inline const int8_t* panel(const int8_t* w, size_t, float*) {
+			return w;
+		}
+
+		template<int R, int N>
+		__attribute__((target("avx2")))
+		static void dot(const int8_t* w, size_t w_stride, const int8_t* x, size_t x_stride, size_t len, int32_t* sums) {
+			__m256i acc[R * N];
+#pragma GCC unroll 16
+			for (int j = 0; j < R * N; ++j)
+				acc[j] = _mm256_setzero_si256();
+			for (size_t k = 0; k < len; k += 16) {
+				__m256i xv[N];
+#pragma GCC unroll 16
+				for (int i = 0; i < N; ++i)
+					xv[i] = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (x + i * x_stride + k)));
+#pragma GCC unroll 16
+				for (int r = 0; r < R; ++r) {
+					const __m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128((const __m128i*) (w + r * w_stride + k)));
+#pragma GCC unroll 16
+					for (int i = 0; i < N; ++i)
+						acc[r * N + i] = _mm256_add_epi32(acc[r * N + i], _mm256_madd_epi16(wv, xv[i]));
+				}
+			}
+			int j = 0;
+#pragma GCC unroll 16
+			for (; j + 4 <= R * N; j += 4)
+				_mm_storeu_si128((__m128i*) (sums + j), hsum4_epi32_avx2(acc[j], acc[j + 1], acc[j + 2], acc[j + 3]));
+#pragma GCC unroll 16
+			for (; j < R * N; ++j)
+				sums[j] = hsum_epi32_avx2(acc[j]);
+		}
+	};
+
+	/**
+	 * uint8 * int8： vpdpbusd 每4个乘积直接累加到 int32， 输入是加了128的 uint8
+	 */
+	struct VNNIDot {
+		typedef int8_t W;
+		typedef uint8_t X;
+		typedef int32_t Acc;
+		typedef VNNIDot Panel;
+
+		static inline const int8_t* panel(const int8_t* w, size_t, float*) {
+			return w;
+		}
+
+		template<int R, int N>
+		__attribute__((target("avx2,avxvnni")))
+		static void dot(const int8_t* w, size_t w_stride, const uint8_t* x, size_t x_stride, size_t len, int32_t* sums) {
+			__m256i acc[R * N];
+#pragma GCC unroll 16
+			for (int j = 0; j < R * N; ++j)
+				acc[j] = _mm256_setzero_si256();
+			size_t k = 0;
+			for (; k + 32 <= len; k += 32) {
+				__m256i xv[N];
+#pragma GCC unroll 16
+				for (int i = 0; i < N; ++i)
+					xv[i] = _mm256_loadu_si256((const __m256i*) (x + i * x_stride + k));
+#pragma GCC unroll 16
+				for (int r = 0; r < R; ++r) {
+					const __m256i wv = _mm256_loadu_si256((const __m256i*) (w + r * w_stride + k));
+#pragma GCC unroll 16
+					for (int i = 0; i < N; ++i)
+						acc[r * N + i] = _mm256_dpbusd_avx_epi32(acc[r * N + i], xv[i], wv);
+				}
+			}
+			if (k < len) {  // len 是16的倍数， 最多剩16个， 累加到低128位
+				__m128i xv[N];
+#pragma GCC unroll 16
+				for (int i = 0; i < N; ++i)
+					xv[i] = _mm_loadu_si128((const __m128i*) (x + i * x_stride + k));
+#pragma GCC unroll 16
+				for (int r = 0; r < R; ++r) {
+					const __m128i wv = _mm_loadu_si128((const __m128i*) (w + r * w_stride + k));
+#pragma GCC unroll 16
+					for (int i = 0; i < N; ++i) {
+						const __m128i tail = _mm_dpbusd_avx_epi32(_mm_setzero_si128(), xv[i], wv);
+						acc[r * N + i] = _mm256_add_epi32(acc[r * N + i],
+								_mm256_inserti128_si256(_mm256_setzero_si256(), tail, 0));
+					}
+				}
+			}
+			int j = 0;
+#pragma GCC unroll 16
+			for (; j + 4 <= R * N; j += 4)
+				_mm_storeu_si128((__m128i*) (sums + j), hsum4_epi32_avx2(acc[j], acc[j + 1], acc[j + 2], acc[j + 3]));
+#pragma GCC unroll 16
+			for (; j < R * N; ++j)
+				sums[j] = hsum_epi32_avx2(acc[j]);
+		}
+	};
+
+	inline float finish_dot(float sum, size_t, const float*, size_t) const {
+		return sum;
+	}
+
+	inline float finish_dot(int32_t dot, size_t r, const float* xs, size_t i) const {
+		if (level_ >= SIMD_AVX_VNNI)
+			dot -= 128 * row_sums_[r];
+		return dot * (xs[i] * scales_[r]);
+	}
+
+	/**
+	 * 第 r 行起的 R 行权重（wr 指向第 r 行）与第 i 行起的 N 行输入相乘， 写入 out
+	 */
+	template<typename K, int R, int N>
+	inline void dot_block(const typename K::W* wr, const typename K::X* x, size_t r, size_t i, const float* xs,
+			float* out, size_t out_row_stride, size_t out_col_stride) const {
+		typename K::Acc sums[R * N];
+		K::template dot<R, N>(wr, stride_, x + i * stride_, stride_, stride_, sums);
+		for (int a = 0; a < R; ++a) {
+			for (int b = 0; b < N; ++b)
+				out[(i + b) * out_row_stride + (r + a) * out_col_stride] = finish_dot(sums[a * N + b], r + a, xs, i + b);
+		}
+	}
+
+	/**
+	 * 按块计算 out = X * W， w、 x 是补零后的权重和输入（每行 stride_ 个数）， xs 为 INT8 输入每行的 scale：
+	 * 1、n < 3 时每行输入依次与8行权重同时计算， 一次读入的输入被8行权重共用；
+	 * 2、否则每 MATMUL_INPUT_BLOCK 行输入为一块， 每4行权重（FP16 / BF16 先转换为 float）与块内的输入按3行一组计算，
+	 *    4行权重在 L1 中被整块输入共用， 整块输入在 L2 中被所有权重共用
+	 */
+	template<typename K>
+	void matmul_blocked(const typename K::W* w, const typename K::X* x, size_t n, const float* xs, float* out,
+			size_t out_row_stride, size_t out_col_stride) const {
+		if (n < 3) {
+			for (size_t i = 0; i < n; ++i) {
+				size_t r = 0;
+				for (; r + 8 <= rows_; r += 8)
+					dot_block<K, 8, 1>(w + r * stride_, x, r, i, xs, out, out_row_stride, out_col_stride);
+				for (; r < rows_; ++r)
+					dot_block<K, 1, 1>(w + r * stride_, x, r, i, xs, out, out_row_stride, out_col_stride);
+			}
+			return;
+		}
+		typedef typename K::Panel P;
+		std::vector<float>& buffer = thread_panel_buffer();
+		if (buffer.size() < 4 * stride_)
+			buffer.resize(4 * stride_);
+		for (size_t i0 = 0; i0 < n; i0 += MATMUL_INPUT_BLOCK) {
+			const size_t i1 = std::min<size_t>(n, i0 + MATMUL_INPUT_BLOCK);
+			size_t r = 0;
+			for (; r + 4 <= rows_; r += 4) {
+				const typename P::W* wr = K::panel(w + r * stride_, 4 * stride_, buffer.data());
+				size_t i = i0;
+				for (; i + 3 <= i1; i += 3)
+					dot_block<P, 4, 3>(wr, x, r, i, xs, out, out_row_stride, out_col_stride);
+				for (; i < i1; ++i)
+					dot_block<P, 4, 1>(wr, x, r, i, xs, out, out_row_stride, out_col_stride);
+			}
+			for (; r < rows_; ++r) {
+				for (size_t i = i0; i < i1; ++i)
+					dot_block<K, 1, 1>(w + r * stride_, x, r, i, xs, out, out_row_stride, out_col_stride);
+			}
+		}
+	}
+
+	/**
+	 * 把补零后的一行输入（stride_ 个数）量化为 int8， 返回 scale； vnni 时加128， q + 128 在 [1, 255]， 按 uint8 解释。
+	 * vcvtps2dq 与 lrint 一样舍入到偶数
+	 */
+	__attribute__((target("avx2")))
+	float quantize_row_avx2(const float* x, int8_t* q, bool vnni) const {
+		const __m256 sign = _mm256_set1_ps(-0.0f);
+		__m256 m = _mm256_setzero_ps();
+		for (size_t k = 0; k < stride_; k += 8)
+			m = _mm256_max_ps(m, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + k)));
+		__m128 s = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+		s = _mm_max_ps(s, _mm_movehl_ps(s, s));
+		s = _mm_max_ss(s, _mm_movehdup_ps(s));
+		const float max_abs = _mm_cvtss_f32(s);
+		const __m256 inv = _mm256_set1_ps(max_abs > 0 ? 127.0f / max_abs : 0.0f);
+		const __m128i offset = _mm_set1_epi8(vnni ? (char) 0x80 : 0);
+		for (size_t k = 0; k < stride_; k += 16) {
+			const __m256i a = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + k), inv));
+			const __m256i b = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(x + k + 8), inv));
+			const __m256i ab = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));  // pack 按128位交错
+			const __m128i q8 = _mm_packs_epi16(_mm256_castsi256_si128(ab), _mm256_extracti128_si256(ab, 1));
+			_mm_storeu_si128((__m128i*) (q + k), _mm_xor_si128(q8, offset));
+		}
+		return max_abs / 127.0f;
+	}
+
+	/**
+	 * acc += w * row(r) 的前 cols_ / 8 * 8 个数， 返回处理的个数
+	 */
+	__attribute__((target("avx2,fma,f16c")))
+	size_t axpy_avx2(size_t r, float w, float* acc) const {
+		const size_t n = cols_ / 8 * 8;
+		const size_t base = r * stride_;
+		const __m256 wv = _mm256_set1_ps(w * scale(r));
+		for (size_t c = 0; c < n; c += 8) {
+			__m256 v;
+			switch (type_) {
+			case WEIGHT_FP32:
+				v = _mm256_loadu_ps(f32_.data() + base + c);
+				break;
+			case WEIGHT_FP16:
+				v = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*) (u16_.data() + base + c)));
+				break;
+			case WEIGHT_BF16:
+				v = load_bf16_avx2(u16_.data() + base + c);
+				break;
+			default:
+				v = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(_mm_loadl_epi64((const __m128i*) (i8_.data() + base + c))));
+				break;
+			}
+			_mm256_storeu_ps(acc + c, _mm256_fmadd_ps(wv, v, _mm256_loadu_ps(acc + c)));
+		}
+		return n;
+	}
+#endif
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_QUANTIZEDWEIGHTS_HPP_ */
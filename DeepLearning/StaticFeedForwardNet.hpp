@@ -0,0 +1,476 @@
+/*
+ * StaticFeedForwardNet.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      层的类型和维数都是模板参数的前馈网络， 用于结构固定的线上模型（如 256->128->64->1）：
+ *      1、没有虚函数， 每层的 forward 都可以内联；
+ *      2、激活值是定长的 Eigen::Matrix<float, 1, N>， 放在栈上， 不分配内存；
+ *      3、权重保存在堆上（避免大的定长矩阵超过 EIGEN_STACK_ALLOCATION_LIMIT）， 计算时映射为定长矩阵
+ *         Eigen::Map<const Eigen::Matrix<float, In, Out> >， 编译器知道全部维数， 可以展开和向量化。
+ *      参数从已加载的 FeedForwardNet 中复制， 结构或维数不一致时抛出异常， 动态网络仍作为通用的路径。
+ *      StaticNetGenerator 由 loadNetStructure 的文件头（或 FeedForwardNet）生成对应的类型。
+ *
+ *      用法：
+ *      LC::FeedForwardNet net;
+ *      std::string info = net.loadNetStructure(filename);
+ *      std::cout << LC::StaticNetGenerator::toCppSource(info, "CtrNet");  // 生成类型后编译进代码
+ *      typedef LC::StaticNet<LC::StaticAffine<256, 128, true>, LC::StaticAffine<128, 64, true>, LC::StaticAffine<64, 1> > CtrNet;
+ *      std::unique_ptr<CtrNet> fast(new CtrNet());
+ *      fast->load(net);
+ *      CtrNet::Output y;
+ *      fast->forward(x, y);
+ */
+
+#ifndef LC_DEEPLEARNING_STATICFEEDFORWARDNET_HPP_
+#define LC_DEEPLEARNING_STATICFEEDFORWARDNET_HPP_
+
+#include "FeedForwardNet.hpp"
+#include <memory>
+
+namespace LC {
+
+/**
+ * y = relu?(x * W + b)， 对应 INetLayer_Affine（relu 为true时也可以对应 Affine + ReLU 两层）
+ */
+template<int In, int Out, bool ReLU = false>
+class StaticAffine {
+public:
+	enum {
+		InputSize = In, OutputSize = Out
+	};
+	typedef Eigen::Matrix<Scalar, 1, In> Input;
+	typedef Eigen::Matrix<Scalar, 1, Out> Output;
+
+	Mat W;
+	RowVec b;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		const Eigen::Map<const Eigen::Matrix<Scalar, In, Out>, Eigen::AlignedMax> w(W.data());
+		const Eigen::Map<const Output, Eigen::AlignedMax> bias(b.data());
+		y.noalias() = x * w;
+		if (ReLU)
+			y = (y + bias).cwiseMax(Scalar(0));
+		else
+			y += bias;
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		const INetLayer_Affine* affine = i < layers.size() ? dynamic_cast<const INetLayer_Affine*>(layers[i]) : NULL;
+		if (affine == NULL || affine->W.rows() != In || affine->W.cols() != Out)
+			throw string("StaticAffine: layer ") + LC::Str::num2str((int) i) + " is not Affine " + LC::Str::num2str(In) + "x"
+					+ LC::Str::num2str(Out);
+		W = affine->W;
+		b = affine->b;
+		++i;
+		if (affine->relu != ReLU) {
+			if (!ReLU || i >= layers.size() || dynamic_cast<const INetLayer_ReLU*>(layers[i]) == NULL)
+				throw string("StaticAffine: ReLU mismatch at layer ") + LC::Str::num2str((int) i - 1);
+			++i;
+		}
+		return i;
+	}
+};
+
+/**
+ * y = relu?(x * W + b)， W、b 为行向量， 对应 INetLayer_BatchNorm（+ ReLU）
+ */
+template<int N, bool ReLU = false>
+class StaticBatchNorm {
+public:
+	enum {
+		InputSize = N, OutputSize = N
+	};
+	typedef Eigen::Matrix<Scalar, 1, N> Input;
+	typedef Eigen::Matrix<Scalar, 1, N> Output;
+
+	RowVec W;
+	RowVec b;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		const Eigen::Map<const Output, Eigen::AlignedMax> w(W.data()), bias(b.data());
+		if (ReLU)
+			y = (x.cwiseProduct(w) + bias).cwiseMax(Scalar(0));
+		else
+			y = x.cwiseProduct(w) + bias;
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		const INetLayer_BatchNorm* bn = i < layers.size() ? dynamic_cast<const INetLayer_BatchNorm*>(layers[i]) : NULL;
+		if (bn == NULL || bn->W.size() != N)
+			throw string("StaticBatchNorm: layer ") + LC::Str::num2str((int) i) + " is not BatchNorm " + LC::Str::num2str(N);
+		W = bn->W;
+		b = bn->b;
+		++i;
+		if (ReLU) {
+			if (i >= layers.size() || dynamic_cast<const INetLayer_ReLU*>(layers[i]) == NULL)
+				throw string("StaticBatchNorm: ReLU mismatch at layer ") + LC::Str::num2str((int) i);
+			++i;
+		}
+		return i;
+	}
+};
+
+template<int N>
+class StaticReLU {
+public:
+	enum {
+		InputSize = N, OutputSize = N
+	};
+	typedef Eigen::Matrix<Scalar, 1, N> Input;
+	typedef Eigen::Matrix<Scalar, 1, N> Output;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		y = x.cwiseMax(Scalar(0));
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		if (i >= layers.size() || dynamic_cast<const INetLayer_ReLU*>(layers[i]) == NULL)
+			throw string("StaticReLU: layer ") + LC::Str::num2str((int) i) + " is not ReLU";
+		return i + 1;
+	}
+};
+
+/**
+ * y = activation(x)， 对应 INetLayer_Activation
+ */
+template<int N, Activation::Type T>
+class StaticActivation {
+public:
+	enum {
+		InputSize = N, OutputSize = N
+	};
+	typedef Eigen::Matrix<Scalar, 1, N> Input;
+	typedef Eigen::Matrix<Scalar, 1, N> Output;
+
+	float alpha;
+
+	StaticActivation() :
+			alpha(0.01f) {
+	}
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		y = x;
+		Activation::apply_serial(T, y.data(), N, alpha);
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		const INetLayer_Activation* act = i < layers.size() ? dynamic_cast<const INetLayer_Activation*>(layers[i]) : NULL;
+		if (act == NULL || act->type != T)
+			throw string("StaticActivation: layer ") + LC::Str::num2str((int) i) + " is not " + Activation::name(T);
+		alpha = act->alpha;
+		return i + 1;
+	}
+};
+
+/**
+ * y = relu(x * W + b) + x， 对应 INetLayer_Residual_AffineReLU
+ */
+template<int N>
+class StaticResidual {
+public:
+	enum {
+		InputSize = N, OutputSize = N
+	};
+	typedef Eigen::Matrix<Scalar, 1, N> Input;
+	typedef Eigen::Matrix<Scalar, 1, N> Output;
+
+	Mat W;
+	RowVec b;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		const Eigen::Map<const Eigen::Matrix<Scalar, N, N>, Eigen::AlignedMax> w(W.data());
+		const Eigen::Map<const Output, Eigen::AlignedMax> bias(b.data());
+		y.noalias() = x * w;
+		y = (y + bias).cwiseMax(Scalar(0)) + x;
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		const INetLayer_Residual_AffineReLU* residual =
+				i < layers.size() ? dynamic_cast<const INetLayer_Residual_AffineReLU*>(layers[i]) : NULL;
+		if (residual == NULL || residual->W.rows() != N || residual->W.cols() != N)
+			throw string("StaticResidual: layer ") + LC::Str::num2str((int) i) + " is not Residual_AffineReLU "
+					+ LC::Str::num2str(N);
+		W = residual->W;
+		b = residual->b;
+		return i + 1;
+	}
+};
+
+/**
+ * 由若干 Static* 层组成的网络， 相邻层的维数在编译时检查
+ */
+template<typename... Layers>
+class StaticNet;
+
+template<typename Layer>
+class StaticNet<Layer> {
+public:
+	enum {
+		InputSize = Layer::InputSize, OutputSize = Layer::OutputSize
+	};
+	typedef typename Layer::Input Input;
+	typedef typename Layer::Output Output;
+
+	Layer layer;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		layer.forward(x, y);
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		return layer.load(layers, i);
+	}
+
+	/**
+	 * 从结构相同的 FeedForwardNet 复制参数
+	 */
+	void load(const FeedForwardNet& net) {
+		if (load(net.layers, 0) != net.layers.size())
+			throw string("StaticNet: FeedForwardNet has more layers than the static type");
+	}
+
+	inline Output forward(const Scalar* x) const {
+		Output y;
+		forward(Eigen::Map<const Input>(x), y);
+		return y;
+	}
+
+	/**
+	 * 逐行计算， input 的列数必须为 InputSize， output 为 input.rows() x OutputSize
+	 */
+	void forward(const Mat& input, Mat& output) const {
+		if (input.cols() != InputSize)
+			throw string("StaticNet: input width does not match");
+		output.resize(input.rows(), OutputSize);
+		Input x;
+		Output y;
+		for (Eigen::Index r = 0; r < input.rows(); ++r) {
+			x = input.row(r);
+			forward(x, y);
+			output.row(r) = y;
+		}
+	}
+};
+
+template<typename Layer, typename Next, typename... Rest>
+class StaticNet<Layer, Next, Rest...> {
+	typedef StaticNet<Next, Rest...> Tail;
+	static_assert((int) Layer::OutputSize == (int) Tail::InputSize, "StaticNet: adjacent layer sizes do not match");
+public:
+	enum {
+		InputSize = Layer::InputSize, OutputSize = Tail::OutputSize
+	};
+	typedef typename Layer::Input Input;
+	typedef typename Tail::Output Output;
+
+	Layer layer;
+	Tail tail;
+
+	template<typename X>
+	inline void forward(const Eigen::MatrixBase<X>& x, Output& y) const {
+		typename Layer::Output h;
+		layer.forward(x, h);
+		tail.forward(h, y);
+	}
+
+	size_t load(const vector<INetLayer*>& layers, size_t i) {
+		return tail.load(layers, layer.load(layers, i));
+	}
+
+	void load(const FeedForwardNet& net) {
+		if (load(net.layers, 0) != net.layers.size())
+			throw string("StaticNet: FeedForwardNet has more layers than the static type");
+	}
+
+	inline Output forward(const Scalar* x) const {
+		Output y;
+		forward(Eigen::Map<const Input>(x), y);
+		return y;
+	}
+
+	void forward(const Mat& input, Mat& output) const {
+		if (input.cols() != InputSize)
+			throw string("StaticNet: input width does not match");
+		output.resize(input.rows(), OutputSize);
+		Input x;
+		Output y;
+		for (Eigen::Index r = 0; r < input.rows(); ++r) {
+			x = input.row(r);
+			forward(x, y);
+			output.row(r) = y;
+		}
+	}
+};
+
+/**
+ * 生成与网络结构对应的 StaticNet 类型， 紧随 Affine / BatchNorm 的 ReLU 合并为模板参数 ReLU=true
+ */
+class StaticNetGenerator {
+public:
+	/**
+	 * @param info loadNetStructure 返回的文件头， 如 "Affine&W=f256x128&b=f128|ReLU|Affine&W=f128x1&b=f1|"
+	 */
+	static string toCppType(const string& info) {
+		vector<string> layers;
+		int width = -1;  // 当前的输出宽度
+		std::vector<string> layerStrs = LC::Str::split(info, '|');
+		for (unsigned int idx = 0; idx < layerStrs.size(); ++idx) {
+			const string& layerStr = layerStrs[idx];
+			if (layerStr.size() < 3)
+				continue;
+			std::vector<string> params = LC::Str::split(layerStr, '&');
+			const string& name = params[0];
+			if (name == "Affine" || name == "Affine_BatchNorm") {
+				std::pair<unsigned int, unsigned int> rc = FeedForwardNet::extractRowsAndCols(params.at(1));
+				layers.push_back(affine(rc.first, rc.second, false));
+				width = rc.second;
+			} else if (name == "BatchNorm") {
+				width = FeedForwardNet::extractRowsAndCols(params.at(1)).second;
+				layers.push_back(batchNorm(width, false));
+			} else if (name == "Residual_AffineReLU") {
+				width = FeedForwardNet::extractRowsAndCols(params.at(1)).second;
+				layers.push_back(residual(width));
+			} else if (name == "ReLU") {
+				if (width < 0)
+					throw string("StaticNetGenerator: ReLU before any layer with parameters");
+				addReLU(layers, width);
+			} else if (Activation::isActivation(name)) {
+				if (width < 0)
+					throw string("StaticNetGenerator: activation before any layer with parameters");
+				layers.push_back(activation(width, Activation::parse(name)));
+			} else {
+				throw string("StaticNetGenerator: unsupported layer type: ") + name;
+			}
+		}
+		return join(layers);
+	}
+
+	/**
+	 * 由已加载（可以是 fuseLayers 之后）的网络生成类型
+	 */
+	static string toCppType(const FeedForwardNet& net) {
+		vector<string> layers;
+		int width = -1;
+		for (unsigned int i = 0; i < net.layers.size(); ++i) {
+			const INetLayer* layer = net.layers[i];
+			if (const INetLayer_Affine* a = dynamic_cast<const INetLayer_Affine*>(layer)) {
+				layers.push_back(affine(a->W.rows(), a->W.cols(), a->relu));
+				width = a->W.cols();
+			} else if (const INetLayer_BatchNorm* bn = dynamic_cast<const INetLayer_BatchNorm*>(layer)) {
+				width = bn->W.size();
+				layers.push_back(batchNorm(width, false));
+			} else if (const INetLayer_Residual_AffineReLU* r = dynamic_cast<const INetLayer_Residual_AffineReLU*>(layer)) {
+				width = r->W.cols();
+				layers.push_back(residual(width));
+			} else if (dynamic_cast<const INetLayer_ReLU*>(layer)) {
+				if (width < 0)
+					throw string("StaticNetGenerator: ReLU before any layer with parameters");
+				addReLU(layers, width);
+			} else if (const INetLayer_Activation* act = dynamic_cast<const INetLayer_Activation*>(layer)) {
+				if (width < 0)
+					throw string("StaticNetGenerator: activation before any layer with parameters");
+				layers.push_back(activation(width, act->type));
+			} else {
+				throw string("StaticNetGenerator: unsupported layer at ") + LC::Str::num2str((int) i);
+			}
+		}
+		return join(layers);
+	}
+
+	static string toCppSource(const string& info, const string& typedefName) {
+		return "typedef " + toCppType(info) + " " + typedefName + ";\n";
+	}
+
+	/**
+	 * 256->128->64->1 的网络， 比较 StaticNet 与 FeedForwardNet 的结果和速度
+	 */
+	static void testStaticNet(int repeat = 100000) {
+		std::cout << "\n---test LC::StaticNet" << std::endl;
+		FeedForwardNet net;
+		net.addAffine(Mat::Random(256, 128), RowVec::Random(128));
+		net.addReLU();
+		net.addBatchNorm(RowVec::Random(128), RowVec::Random(128));
+		net.addAffine(Mat::Random(128, 64), RowVec::Random(64));
+		net.addReLU();
+		net.addResidual_AffineReLU(Mat::Random(64, 64) * 0.1f, RowVec::Random(64));
+		net.addAffine(Mat::Random(64, 1), RowVec::Random(1));
+		std::cout << "generated: " << StaticNetGenerator::toCppType(net) << std::endl;
+
+		typedef StaticNet<StaticAffine<256, 128, true>, StaticBatchNorm<128>, StaticAffine<128, 64, true>, StaticResidual<64>,
+				StaticAffine<64, 1> > Net;
+		std::unique_ptr<Net> fast(new Net());
+		fast->load(net);
+
+		Mat input = Mat::Random(1, 256);
+		Net::Input x = input.row(0);
+		Net::Output y;
+		fast->forward(x, y);
+		std::cout << "max abs diff: " << (net.forward(input).row(0) - y).cwiseAbs().maxCoeff() << std::endl;
+
+		FeedForwardNet::Workspace ws;
+		LC::TimerAccurate timer;
+		float sum = 0;
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward(input)(0, 0);
+		double t_dynamic = timer.getElapsedTimeAndRestart();
+		for (int i = 0; i < repeat; ++i)
+			sum += net.forward_noalloc(input, ws)(0, 0);
+		double t_noalloc = timer.getElapsedTimeAndRestart();
+		for (int i = 0; i < repeat; ++i) {
+			fast->forward(x, y);
+			sum += y(0);
+		}
+		double t_static = timer.getElapsedTimeAndRestart();
+		std::cout << "forward:         " << t_dynamic / repeat * 1e6 << " us/call" << std::endl;
+		std::cout << "forward_noalloc: " << t_noalloc / repeat * 1e6 << " us/call" << std::endl;
+		std::cout << "StaticNet:       " << t_static / repeat * 1e6 << " us/call (" << sum << ")" << std::endl;
+	}
+
+private:
+	static string affine(int in, int out, bool relu) {
+		return "LC::StaticAffine<" + LC::Str::num2str(in) + ", " + LC::Str::num2str(out) + (relu ? ", true>" : ">");
+	}
+
+	static string batchNorm(int n, bool relu) {
+		return "LC::StaticBatchNorm<" + LC::Str::num2str(n) + (relu ? ", true>" : ">");
+	}
+
+	static string activation(int n, Activation::Type type) {
+		static const char* types[] = { "IDENTITY", "RELU", "LEAKY_RELU", "SIGMOID", "TANH", "GELU" };
+		return "LC::StaticActivation<" + LC::Str::num2str(n) + ", LC::Activation::" + types[type] + ">";
+	}
+
+	static string residual(int n) {
+		return "LC::StaticResidual<" + LC::Str::num2str(n) + ">";
+	}
+
+	static void addReLU(vector<string>& layers, int width) {
+		string& last = layers.back();
+		const bool mergeable = (last.find("LC::StaticAffine<") == 0 || last.find("LC::StaticBatchNorm<") == 0)
+				&& last.find(", true>") == string::npos;
+		if (mergeable)
+			last = last.substr(0, last.size() - 1) + ", true>";
+		else
+			layers.push_back("LC::StaticReLU<" + LC::Str::num2str(width) + ">");
+	}
+
+	static string join(const vector<string>& layers) {
+		if (layers.empty())
+			throw string("StaticNetGenerator: empty net");
+		string s = "LC::StaticNet<";
+		for (unsigned int i = 0; i < layers.size(); ++i)
+			s += (i > 0 ? ", " : "") + layers[i];
+		return s + " >";
+	}
+};
+
+}
+
+#endif /* LC_DEEPLEARNING_STATICFEEDFORWARDNET_HPP_ */
@@ -1,4 +1,6 @@
+#ifndef LC_EIGEN_PARALLELIZE
 #define EIGEN_DONT_PARALLELIZE
+#endif
 #include <Eigen/Dense>
 #include <string>
 #include <iostream>
@@ -12,6 +12,7 @@
 #include <functional>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <chrono>
 #include <ctime>
 //#include <shared_mutex>
@@ -66,6 +67,7 @@ namespace LC {
 template<typename ModelClass>
 class ModelSelector {
 	int numModelLoad;
+	std::atomic<unsigned long long> modelGeneration;  ///< 每次切换到新模型时加1， 在发布 pCurModel 之前
 public:
 
 	std::string modelParentFolder;
@@ -98,7 +100,7 @@ public:
 //	string modelState; //当前模型的状态信息，每次加载模型后会进行更新
 	long long next_model_load_time;
 	ModelSelector() :
-			numModelLoad(0), modelParentFolder(""), modelPrefix("net_model"), modelVersionCheckUpFile(""), modelCheckUpFile(
+			numModelLoad(0), modelGeneration(0), modelParentFolder(""), modelPrefix("net_model"), modelVersionCheckUpFile(""), modelCheckUpFile(
 					"ModelSentinel.txt"), model1_load_time(-1), model2_load_time(-1), pCurModel(
 			NULL), modelIsDir(true), pLoadModelThread(NULL), numModel2keep(2), checkNewModelPerSeconds(1800), process_idx(
 					0), process_num(1), tryReleaseOldModelAfterSeconds(1), next_model_load_time(-1) {
@@ -113,6 +115,13 @@ public:
 //			pLoadModelThread = NULL;
 //		}
 	}
+	/**
+	 * 模型的版本号， 每次切换模型时（发布新模型之前）加1； 缓存了模型计算结果的对象（如 EmbeddingCache::bindGeneration）用它判断是否需要清空
+	 */
+	const std::atomic<unsigned long long>& getModelGeneration() const {
+		return modelGeneration;
+	}
+
 	ModelClass& getModel() {
 		return *pCurModel;
 	}
@@ -370,6 +379,7 @@ public:
 			model1 = ModelClass();
 			int ret = model1.loadConfigs(newestModel);
 			if (ret == 0) {
+				modelGeneration.fetch_add(1);  // 先更新版本号再发布新模型， 看到新模型的线程一定看到新的版本号
 				pCurModel = &model1;
 				model1_load_time = cur_time;
 				modelVersion = newestModel;
@@ -390,6 +400,7 @@ public:
 				int ret = model2.loadConfigs(newestModel);
 				if (ret == 0) {
 					model2_load_time = cur_time;
+					modelGeneration.fetch_add(1);
 					pCurModel = &model2;
 					modelVersion = newestModel;
 					numModelLoad += 1;
@@ -411,6 +422,7 @@ public:
 				int ret = model1.loadConfigs(newestModel);
 				if (ret == 0) {
 					model1_load_time = cur_time;
+					modelGeneration.fetch_add(1);
 					pCurModel = &model1;
 					numModelLoad += 1;
 					modelVersion = newestModel;
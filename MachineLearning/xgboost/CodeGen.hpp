@@ -0,0 +1,269 @@
+/*
+ * CodeGen.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      将 GBDT_predictor 生成为独立的C++源文件， 编译成 .so 后通过 dlopen 加载为 GBDT_engine（CompiledModel）。
+ *      与 GBDT_predictor::to_java_code(cpp_version=true) 不同：
+ *      1、每棵树按 CompactNode 的顺序生成扁平的 label/goto 代码， 而不是嵌套的 if/else；
+ *      2、保留了 missing value 分支， 语义与 Tree::predict 相同；
+ *      3、导出 C ABI 的单行和批量预测函数（见 CodeGen::ABI_VERSION 附近的说明）；
+ *      4、先调用 GBDT_predictor::optimize_layout 时， 按 profile 的分支方向生成 __builtin_expect。
+ *      注意：生成的代码不能用 -ffast-math 编译， 否则 NAN 的判断会被优化掉。 使用 dlopen 需要链接 -ldl
+ *
+ *      用法：
+ *      LC::xgboost::GBDT_predictor gbdt(filename);
+ *      LC::xgboost::CodeGen::compile_shared_library(gbdt, "/path/to/model.so");
+ *      gbdt.set_engine(std::make_shared<LC::xgboost::CompiledModel>("/path/to/model.so"));
+ */
+
+#ifndef LC_MACHINELEARNING_XGBOOST_CODEGEN_HPP_
+#define LC_MACHINELEARNING_XGBOOST_CODEGEN_HPP_
+
+#include "predictor.hpp"
+#include <cstdlib>
+#include <dlfcn.h>
+
+namespace LC {
+namespace xgboost {
+
+/**
+ * 生成的 .so 中导出的函数：
+ * int   lc_gbdt_abi_version();
+ * int   lc_gbdt_num_features();
+ * int   lc_gbdt_num_trees();
+ * float lc_gbdt_predict_margin(const float* fv, float missing);
+ * void  lc_gbdt_predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float missing, float* out);
+ */
+class CodeGen {
+public:
+	static const int ABI_VERSION = 1;
+
+	static string to_cpp_source(const GBDT_predictor& gbdt) {
+		const std::vector<Tree>& trees = gbdt.trees();
+		std::stringstream ss;
+		// 9位有效数字可以无损地表示float； showpoint 保证整数值也带小数点（"1f" 不是合法的字面量）
+		ss << std::setprecision(9) << std::showpoint;
+		ss << "// generated by LC::xgboost::CodeGen, " << gbdt.toString();
+		ss << "// do NOT compile with -ffast-math\n";
+		ss << "#include <stddef.h>\n\n";
+		ss << "namespace {\n\n";
+		for (unsigned int t = 0; t < trees.size(); ++t) {
+			Tree tree = trees[t];
+			if (!tree.is_compiled() && !tree.compile())
+				throw std::string("CodeGen: can not compile tree ") + LC::Str::num2str(t);
+			tree_to_cpp(ss, tree, t);
+		}
+		ss << "}\n\n";
+
+		ss << "extern \"C\" {\n\n";
+		ss << "int lc_gbdt_abi_version() {\n  return " << ABI_VERSION << ";\n}\n\n";
+		ss << "int lc_gbdt_num_features() {\n  return " << gbdt.num_features() << ";\n}\n\n";
+		ss << "int lc_gbdt_num_trees() {\n  return " << trees.size() << ";\n}\n\n";
+		ss << "float lc_gbdt_predict_margin(const float* fv, float missing) {\n";
+		ss << "  const bool missing_is_nan = missing != missing;\n";
+		ss << "  float score = 0.0f;\n";
+		for (unsigned int t = 0; t < trees.size(); ++t)
+			ss << "  score += tree_" << t << "(fv, missing, missing_is_nan);\n";
+		ss << "  return score;\n}\n\n";
+		ss << "void lc_gbdt_predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float missing, "
+				"float* out) {\n";
+		ss << "  for (size_t r = 0; r < n_rows; ++r)\n";
+		ss << "    out[r] = lc_gbdt_predict_margin(rows + r * stride, missing);\n";
+		ss << "}\n\n";
+		ss << "}\n";
+		return ss.str();
+	}
+
+	static void write_cpp_source(const GBDT_predictor& gbdt, const string& cpp_path) {
+		std::ofstream out(cpp_path.c_str());
+		if (!out)
+			throw std::string("CodeGen: can not open ") + cpp_path;
+		out << to_cpp_source(gbdt);
+	}
+
+	/**
+	 * 生成源文件 so_path + ".cpp" 并编译为 so_path
+	 * @param compiler 编译命令， 会在其后追加 "-o so_path so_path.cpp"
+	 */
+	static void compile_shared_library(const GBDT_predictor& gbdt, const string& so_path, const string& compiler =
+			"g++ -O2 -shared -fPIC") {
+		const string cpp_path = so_path + ".cpp";
+		write_cpp_source(gbdt, cpp_path);
+		const string cmd = compiler + " -o '" + so_path + "' '" + cpp_path + "'";
+		if (std::system(cmd.c_str()) != 0)
+			throw std::string("CodeGen: compile failed: ") + cmd;
+	}
+
+private:
+	static void tree_to_cpp(std::stringstream& ss, const Tree& tree, unsigned int t) {
+		const CompactNode* nodes = tree.compact_nodes();
+		const float* leaves = tree.leaf_values();
+		// noinline： 避免所有树被内联进同一个巨大的函数
+		ss << "__attribute__((noinline)) float tree_" << t
+				<< "(const float* fv, float missing, bool missing_is_nan) {\n";
+		ss << "  float x;\n";
+		for (unsigned int i = 0; i < tree.num_compact_nodes(); ++i) {
+			const CompactNode& n = nodes[i];
+			ss << " n" << i << ":\n";
+			if (n.is_leaf()) {
+				ss << "  return " << leaves[~n.child] << "f;\n";
+				continue;
+			}
+			ss << "  x = fv[" << n.feature << "];\n";
+			ss << "  if ((missing_is_nan && x != x) || x == missing) goto n" << n.missing_child() << ";\n";
+			// GBDT_predictor::optimize_layout 标记的分支提示
+			if (n.flags & CompactNode::FLAG_LIKELY_LEFT)
+				ss << "  if (__builtin_expect(x < " << n.threshold << "f, 1)) goto n" << n.child << ";\n";
+			else if (n.flags & CompactNode::FLAG_LIKELY_RIGHT)
+				ss << "  if (__builtin_expect(x < " << n.threshold << "f, 0)) goto n" << n.child << ";\n";
+			else
+				ss << "  if (x < " << n.threshold << "f) goto n" << n.child << ";\n";
+			ss << "  goto n" << (n.child + 1) << ";\n";
+		}
+		ss << "}\n\n";
+	}
+};
+
+/**
+ * 通过 dlopen 加载 CodeGen 生成的 .so， 可直接作为 GBDT_predictor 的引擎使用
+ */
+class CompiledModel: public GBDT_engine {
+	typedef int (*IntFunc)();
+	typedef float (*PredictFunc)(const float*, float);
+	typedef void (*PredictBatchFunc)(const float*, size_t, size_t, float, float*);
+
+	void* handle_;
+	int num_features_;
+	int num_trees_;
+	PredictFunc predict_;
+	PredictBatchFunc predict_batch_;
+
+	CompiledModel(const CompiledModel&);
+	CompiledModel& operator=(const CompiledModel&);
+
+	void* symbol(const char* name) {
+		void* p = ::dlsym(handle_, name);
+		if (p == NULL)
+			throw std::string("CompiledModel: symbol not found: ") + name;
+		return p;
+	}
+public:
+	CompiledModel(const string& so_path) :
+			handle_(NULL), num_features_(-1), num_trees_(0), predict_(NULL), predict_batch_(NULL) {
+		handle_ = ::dlopen(so_path.c_str(), RTLD_NOW | RTLD_LOCAL);
+		if (handle_ == NULL)
+			throw std::string("CompiledModel: dlopen failed: ") + ::dlerror();
+		try {
+			int abi = ((IntFunc) symbol("lc_gbdt_abi_version"))();
+			if (abi != CodeGen::ABI_VERSION)
+				throw std::string("CompiledModel: abi version mismatch: ") + LC::Str::num2str(abi);
+			num_features_ = ((IntFunc) symbol("lc_gbdt_num_features"))();
+			num_trees_ = ((IntFunc) symbol("lc_gbdt_num_trees"))();
+			predict_ = (PredictFunc) symbol("lc_gbdt_predict_margin");
+			predict_batch_ = (PredictBatchFunc) symbol("lc_gbdt_predict_margin_batch");
+		} catch (...) {
+			::dlclose(handle_);
+			throw;
+		}
+	}
+
+	virtual ~CompiledModel() {
+		if (handle_ != NULL)
+			::dlclose(handle_);
+	}
+
+	virtual std::string name() const {
+		return "compiled";
+	}
+
+	inline int num_features() const {
+		return num_features_;
+	}
+
+	inline int num_trees() const {
+		return num_trees_;
+	}
+
+	/**
+	 * 概率等请用 GBDT_predictor::transform_margin 变换（按 set_objective 设置的 objective）
+	 */
+	inline float predict_margin(const float* fv, float missing = NAN) const {
+		return predict_(fv, missing);
+	}
+
+	virtual void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing) const {
+		predict_batch_(rows, n_rows, stride, missing, out);
+	}
+
+	/**
+	 * 检查编译后的模型与逐树遍历的结果是否一致， 返回最大的 margin 差值（正常应为0）
+	 */
+	static float check_consistency(const GBDT_predictor& gbdt, const CompiledModel& compiled, const float* rows,
+			size_t n_rows, size_t stride, float missing = NAN) {
+		if (compiled.num_trees() != (int) gbdt.num_trees())
+			throw std::string("CompiledModel: num_trees mismatch");
+		GBDT_predictor traversal = gbdt;
+		traversal.set_engine("");
+		std::vector<float> expected(n_rows), actual(n_rows);
+		traversal.predict_margin_batch(rows, n_rows, stride, expected.data(), missing);
+		compiled.predict_margin_batch(rows, n_rows, stride, actual.data(), missing);
+		float max_diff = 0.0f;
+		for (size_t r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(expected[r] - actual[r]));
+		return max_diff;
+	}
+
+	static void testCompiledModel(const string& so_path = "/tmp/lc_gbdt_codegen_test.so", int num_trees = 200,
+			int max_depth = 6, int num_features = 50, int n_rows = 2000) {
+		std::cout << "\n---test LC::xgboost::CompiledModel" << std::endl;
+		std::stringstream dump(GBDT_predictor::random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		CodeGen::compile_shared_library(gbdt, so_path);
+		std::shared_ptr<CompiledModel> compiled = std::make_shared<CompiledModel>(so_path);
+
+		LC::RandomUniform<int, float> rnd(4);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			rows[i] = rnd.randf();
+			if (rows[i] < 0.05f)
+				rows[i] = NAN;
+			else if (rows[i] < 0.1f)
+				rows[i] = -1.0f;
+		}
+		std::cout << "max abs diff (missing=NAN): "
+				<< check_consistency(gbdt, *compiled, rows.data(), n_rows, num_features) << std::endl;
+		std::cout << "max abs diff (missing=-1):  "
+				<< check_consistency(gbdt, *compiled, rows.data(), n_rows, num_features, -1.0f) << std::endl;
+
+		// 整数的阈值和叶子值（真实的 xgboost dump 中很常见）
+		std::stringstream int_dump("booster[0]:\n0:[f0<1] yes=1,no=2,missing=1\n\t1:leaf=0\n"
+				"\t2:[f1<-2] yes=3,no=4,missing=4\n\t\t3:leaf=2\n\t\t4:leaf=-1\n"
+				"booster[1]:\n0:[f2<100000] yes=1,no=2,missing=2\n\t1:leaf=3\n\t2:leaf=1e-05\n");
+		GBDT_predictor int_gbdt(int_dump);
+		CodeGen::compile_shared_library(int_gbdt, so_path + ".int.so");
+		CompiledModel int_compiled(so_path + ".int.so");
+		const float int_rows[] = { 0, -3, 99999, 1, -2, 100000, NAN, 5, NAN, 0.5f, NAN, -1e6f };
+		std::cout << "max abs diff (integer literals): " << check_consistency(int_gbdt, int_compiled, int_rows, 4, 3)
+				<< std::endl;
+
+		std::vector<float> out(n_rows);
+		gbdt.compile();
+		LC::TimerAccurate timer;
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_traversal = timer.getElapsedTimeAndRestart();
+		gbdt.set_engine(compiled);
+		timer.restart();
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_compiled = timer.getElapsedTimeAndRestart();
+		std::cout << "traversal: " << n_rows / t_traversal << " rows/sec" << std::endl;
+		std::cout << "compiled:  " << n_rows / t_compiled << " rows/sec" << std::endl;
+	}
+};
+
+}/*xgboost*/
+}
+
+#endif /* LC_MACHINELEARNING_XGBOOST_CODEGEN_HPP_ */
@@ -0,0 +1,259 @@
+/*
+ * Quantized.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      分裂阈值量化的预测引擎：
+ *      1、收集每个特征在所有树中用到的不同阈值， 排序后作为该特征的分桶边界（LC::Discretize::Bucketize）；
+ *      2、每一行只分桶一次， 得到 uint8（所有特征的阈值都不超过254个时）或 uint16 的桶序号；
+ *      3、节点保存整数的桶阈值（QuantizedNode， 8字节， CompactNode 为12字节）， 比较整数而不是float。
+ *      桶序号 bin = 阈值中 <= x 的个数， 因此 x < thresholds[j] 等价于 bin <= j， 即 bin < j + 1；
+ *      NAN 与任何阈值比较都为false， bin 为阈值个数， 总是走右孩子， 与 Tree::predict 相同；
+ *      missing value 使用单独的桶序号（全1）， missing 分支走左孩子的节点单独判断。
+ *      结果与逐树遍历完全相同。
+ *
+ *      用法：
+ *      #include "Quantized.hpp"
+ *      LC::xgboost::GBDT_predictor gbdt(filename, false, "quantized");
+ */
+
+#ifndef LC_MACHINELEARNING_XGBOOST_QUANTIZED_HPP_
+#define LC_MACHINELEARNING_XGBOOST_QUANTIZED_HPP_
+
+#include "predictor.hpp"
+#include "../preprocess/Discretize.hpp"
+
+namespace LC {
+namespace xgboost {
+
+/**
+ * 量化后的节点： child >= 0 时左孩子为 child， 右孩子为 child + 1； child < 0 时为叶子， 值为 leaf_values[~child]
+ */
+struct QuantizedNode {
+	enum {
+		FEATURE_MASK = 0x7FFF, DEFAULT_LEFT = 0x8000 ///< feature 的最高位： missing value 走左孩子
+	};
+
+	uint16_t bin_threshold; ///< bin < bin_threshold 时走左孩子
+	uint16_t feature_flags;
+	int32_t child;
+
+	inline bool is_leaf() const {
+		return child < 0;
+	}
+};
+
+class QuantizedGBDT: public GBDT_engine {
+public:
+	QuantizedGBDT(const GBDT_predictor& gbdt) :
+			num_features_(std::max(gbdt.num_features(), 0)) {
+		const std::vector<Tree>& trees = gbdt.trees();
+		if (num_features_ > QuantizedNode::FEATURE_MASK + 1)
+			throw std::string("QuantizedGBDT: too many features: ") + LC::Str::num2str(num_features_);
+
+		// 每个特征的所有不同阈值
+		std::vector<Tree> compiled(trees);
+		thresholds_.resize(num_features_);
+		for (unsigned int t = 0; t < compiled.size(); ++t) {
+			if (!compiled[t].compile())
+				throw std::string("QuantizedGBDT: can not compile tree ") + LC::Str::num2str(t);
+			const CompactNode* nodes = compiled[t].compact_nodes();
+			for (unsigned int i = 0; i < compiled[t].num_compact_nodes(); ++i) {
+				if (!nodes[i].is_leaf())
+					thresholds_[nodes[i].feature].push_back(nodes[i].threshold);
+			}
+		}
+		size_t max_bins = 0;
+		for (int f = 0; f < num_features_; ++f) {
+			std::vector<float>& th = thresholds_[f];
+			std::sort(th.begin(), th.end());
+			th.erase(std::unique(th.begin(), th.end()), th.end());
+			max_bins = std::max(max_bins, th.size() + 1);
+			bucketizers_.push_back(LC::Discretize::Bucketize<float, int>(th));
+		}
+		// 全1的桶序号留给 missing value
+		if (max_bins < 0xFFu)
+			bin_bytes_ = 1;
+		else if (max_bins < 0xFFFFu)
+			bin_bytes_ = 2;
+		else
+			throw std::string("QuantizedGBDT: too many distinct thresholds for one feature");
+
+		tree_begin_.push_back(0);
+		leaf_begin_.push_back(0);
+		for (unsigned int t = 0; t < compiled.size(); ++t) {
+			const CompactNode* nodes = compiled[t].compact_nodes();
+			for (unsigned int i = 0; i < compiled[t].num_compact_nodes(); ++i) {
+				const CompactNode& n = nodes[i];
+				QuantizedNode q;
+				q.child = n.child;
+				if (n.is_leaf()) {
+					q.bin_threshold = 0;
+					q.feature_flags = 0;
+				} else {
+					const std::vector<float>& th = thresholds_[n.feature];
+					q.bin_threshold = (uint16_t) (std::lower_bound(th.begin(), th.end(), n.threshold) - th.begin() + 1);
+					q.feature_flags = n.feature
+							| ((n.flags & CompactNode::FLAG_DEFAULT_LEFT) ? QuantizedNode::DEFAULT_LEFT : 0);
+				}
+				nodes_.push_back(q);
+			}
+			leaf_values_.insert(leaf_values_.end(), compiled[t].leaf_values(),
+					compiled[t].leaf_values() + compiled[t].num_leaves());
+			tree_begin_.push_back(nodes_.size());
+			leaf_begin_.push_back(leaf_values_.size());
+		}
+	}
+
+	static std::shared_ptr<GBDT_engine> create(const GBDT_predictor& gbdt) {
+		return std::make_shared<QuantizedGBDT>(gbdt);
+	}
+
+	virtual std::string name() const {
+		return "quantized";
+	}
+
+	/**
+	 * 每个桶序号的字节数， 1 (uint8) 或 2 (uint16)
+	 */
+	inline int bin_bytes() const {
+		return bin_bytes_;
+	}
+
+	/**
+	 * 第 f 个特征排序去重后的阈值， 即分桶边界
+	 */
+	inline const std::vector<float>& thresholds(int f) const {
+		return thresholds_[f];
+	}
+
+	inline unsigned long long memory_bytes() const {
+		return nodes_.size() * sizeof(QuantizedNode) + leaf_values_.size() * sizeof(float);
+	}
+
+	virtual void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing) const {
+		if (bin_bytes_ == 1)
+			predict_binned<uint8_t>(rows, n_rows, stride, out, missing);
+		else
+			predict_binned<uint16_t>(rows, n_rows, stride, out, missing);
+	}
+
+	/**
+	 * 将一行特征分桶， missing value 的桶序号为全1
+	 */
+	template<typename BinT>
+	void bin_row(const float* fv, float missing, BinT* bins) const {
+		const bool missing_is_nan = std::isnan(missing);
+		for (int f = 0; f < num_features_; ++f) {
+			const float x = fv[f];
+			if ((missing_is_nan && std::isnan(x)) || x == missing)
+				bins[f] = (BinT) ~(BinT) 0;
+			else
+				bins[f] = (BinT) bucketizers_[f](x);
+		}
+	}
+
+	/**
+	 * 检查量化引擎与逐树遍历的结果是否一致， 返回最大的 margin 差值（正常应为0）
+	 */
+	static float check_equivalence(const GBDT_predictor& gbdt, const float* rows, size_t n_rows, size_t stride,
+			float missing = NAN) {
+		GBDT_predictor traversal = gbdt;
+		traversal.set_engine("");
+		QuantizedGBDT quantized(gbdt);
+		std::vector<float> expected(n_rows), actual(n_rows);
+		traversal.predict_margin_batch(rows, n_rows, stride, expected.data(), missing);
+		quantized.predict_margin_batch(rows, n_rows, stride, actual.data(), missing);
+		float max_diff = 0.0f;
+		for (size_t r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(expected[r] - actual[r]));
+		return max_diff;
+	}
+
+	static void testQuantizedGBDT(int num_trees = 500, int max_depth = 6, int num_features = 100, int n_rows = 2000) {
+		std::cout << "\n---test LC::xgboost::QuantizedGBDT" << std::endl;
+		std::stringstream dump(GBDT_predictor::random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		gbdt.compile();
+
+		LC::RandomUniform<int, float> rnd(6);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			rows[i] = rnd.randf();
+			if (rows[i] < 0.05f)
+				rows[i] = NAN;
+			else if (rows[i] < 0.1f)
+				rows[i] = -1.0f;
+		}
+		std::cout << "max abs diff (missing=NAN): "
+				<< check_equivalence(gbdt, rows.data(), n_rows, num_features) << std::endl;
+		std::cout << "max abs diff (missing=-1):  "
+				<< check_equivalence(gbdt, rows.data(), n_rows, num_features, -1.0f) << std::endl;
+
+		std::vector<float> out(n_rows);
+		LC::TimerAccurate timer;
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_traversal = timer.getElapsedTimeAndRestart();
+		std::shared_ptr<QuantizedGBDT> quantized = std::make_shared<QuantizedGBDT>(gbdt);
+		gbdt.set_engine(quantized);
+		timer.restart();
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_quantized = timer.getElapsedTimeAndRestart();
+		std::cout << "bin bytes: " << quantized->bin_bytes() << "; node bytes: "
+				<< gbdt.num_nodes() * sizeof(CompactNode) << " -> " << gbdt.num_nodes() * sizeof(QuantizedNode) << std::endl;
+		std::cout << "traversal: " << n_rows / t_traversal << " rows/sec" << std::endl;
+		std::cout << "quantized: " << n_rows / t_quantized << " rows/sec" << std::endl;
+	}
+
+private:
+	static const size_t ROW_BLOCK = 64;
+
+	int num_features_;
+	int bin_bytes_;
+	std::vector<std::vector<float> > thresholds_;
+	mutable std::vector<LC::Discretize::Bucketize<float, int> > bucketizers_; ///< Bucketize::operator() 不是const， 但不修改状态
+
+	// 第 t 棵树的节点为 nodes_[tree_begin_[t] ...]， 叶子为 leaf_values_[leaf_begin_[t] ...]
+	std::vector<QuantizedNode> nodes_;
+	std::vector<float> leaf_values_;
+	std::vector<size_t> tree_begin_;
+	std::vector<size_t> leaf_begin_;
+
+	template<typename BinT>
+	void predict_binned(const float* rows, size_t n_rows, size_t stride, float* out, float missing) const {
+		const BinT missing_bin = (BinT) ~(BinT) 0;
+		std::vector<BinT> bins(ROW_BLOCK * std::max(num_features_, 1));
+		std::fill(out, out + n_rows, 0.0f);
+		for (size_t r_begin = 0; r_begin < n_rows; r_begin += ROW_BLOCK) {
+			const size_t r_end = std::min(n_rows, r_begin + ROW_BLOCK);
+			for (size_t r = r_begin; r < r_end; ++r)
+				bin_row(rows + r * stride, missing, bins.data() + (r - r_begin) * num_features_);
+			for (unsigned int t = 0; t + 1 < tree_begin_.size(); ++t) {
+				const QuantizedNode* nodes = nodes_.data() + tree_begin_[t];
+				const float* leaves = leaf_values_.data() + leaf_begin_[t];
+				for (size_t r = r_begin; r < r_end; ++r) {
+					const BinT* b = bins.data() + (r - r_begin) * num_features_;
+					const QuantizedNode* pn = nodes;
+					while (!pn->is_leaf()) {
+						const BinT x = b[pn->feature_flags & QuantizedNode::FEATURE_MASK];
+						const bool left = x == missing_bin ?
+								(pn->feature_flags & QuantizedNode::DEFAULT_LEFT) != 0 : x < pn->bin_threshold;
+						pn = nodes + pn->child + (left ? 0 : 1);
+					}
+					out[r] += leaves[~pn->child];
+				}
+			}
+		}
+	}
+};
+
+namespace {
+const bool quantized_registered = GBDT_predictor::register_engine("quantized", QuantizedGBDT::create);
+}
+
+}/*xgboost*/
+}
+
+#endif /* LC_MACHINELEARNING_XGBOOST_QUANTIZED_HPP_ */
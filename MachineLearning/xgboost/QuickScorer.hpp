@@ -0,0 +1,253 @@
+/*
+ * QuickScorer.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      QuickScorer 预测引擎， 参见 Lucchese et al. "QuickScorer: a Fast Algorithm to Rank Documents with Additive
+ *      Ensembles of Regression Trees", SIGIR 2015
+ *      适用于每棵树不超过64个叶子的浅层模型（如 depth<=6）， 不再逐节点跳转， 而是：
+ *      1、将所有树的所有 (feature, threshold) 按特征分组、按阈值升序排列；
+ *      2、对每个特征， 阈值 <= x 的节点都会走右孩子（xgboost 中 x < threshold 走左孩子），
+ *         将该节点左子树中的叶子从该树的叶子bitmask中去掉；
+ *      3、每棵树最终的出口叶子即bitmask中最低位的1， 用 count-trailing-zeros 得到。
+ *      missing value 与 Tree::predict 的语义相同：x 为 missing 时， 只对 missing 分支走右孩子的节点做 AND
+ *
+ *      用法：
+ *      #include "QuickScorer.hpp"
+ *      LC::xgboost::GBDT_predictor gbdt(filename, false, "quickscorer");
+ */
+
+#ifndef LC_MACHINELEARNING_XGBOOST_QUICKSCORER_HPP_
+#define LC_MACHINELEARNING_XGBOOST_QUICKSCORER_HPP_
+
+#include "predictor.hpp"
+
+namespace LC {
+namespace xgboost {
+
+class QuickScorer: public GBDT_engine {
+public:
+	static const unsigned int MAX_LEAVES = 64;
+
+	QuickScorer(const GBDT_predictor& gbdt) :
+			num_features_(std::max(gbdt.num_features(), 0)) {
+		const std::vector<Tree>& trees = gbdt.trees();
+		num_trees_ = trees.size();
+
+		std::vector<std::vector<Test> > tests(num_features_);
+		std::vector<std::vector<Test> > missing_tests(num_features_);
+		leaf_offset_.push_back(0);
+		for (unsigned int t = 0; t < trees.size(); ++t) {
+			Tree tree = trees[t];
+			if (!tree.is_compiled() && !tree.compile())
+				throw std::string("QuickScorer: can not compile tree ") + LC::Str::num2str(t);
+			if (tree.num_leaves() > MAX_LEAVES)
+				throw std::string("QuickScorer: more than 64 leaves in tree ") + LC::Str::num2str(t);
+			unsigned int num_leaves = 0;
+			collect_tests(tree.compact_nodes(), 0, t, num_leaves, tests, missing_tests);
+			collect_leaves(tree.compact_nodes(), tree.leaf_values(), 0);
+			leaf_offset_.push_back(leaf_offset_.back() + num_leaves);
+		}
+
+		feature_offset_.push_back(0);
+		missing_offset_.push_back(0);
+		for (int f = 0; f < num_features_; ++f) {
+			std::stable_sort(tests[f].begin(), tests[f].end());
+			for (unsigned int i = 0; i < tests[f].size(); ++i) {
+				thresholds_.push_back(tests[f][i].threshold);
+				tree_ids_.push_back(tests[f][i].tree);
+				masks_.push_back(tests[f][i].mask);
+			}
+			feature_offset_.push_back(thresholds_.size());
+			for (unsigned int i = 0; i < missing_tests[f].size(); ++i) {
+				missing_tree_ids_.push_back(missing_tests[f][i].tree);
+				missing_masks_.push_back(missing_tests[f][i].mask);
+			}
+			missing_offset_.push_back(missing_tree_ids_.size());
+		}
+	}
+
+	/**
+	 * 是否所有树都能被 QuickScorer 处理（叶子数不超过64）
+	 */
+	static bool supports(const GBDT_predictor& gbdt) {
+		const std::vector<Tree>& trees = gbdt.trees();
+		for (unsigned int t = 0; t < trees.size(); ++t) {
+			Tree tree = trees[t];
+			if (!tree.is_compiled() && !tree.compile())
+				return false;
+			if (tree.num_leaves() > MAX_LEAVES)
+				return false;
+		}
+		return true;
+	}
+
+	static std::shared_ptr<GBDT_engine> create(const GBDT_predictor& gbdt) {
+		return std::make_shared<QuickScorer>(gbdt);
+	}
+
+	virtual std::string name() const {
+		return "quickscorer";
+	}
+
+	virtual void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing) const {
+		std::vector<uint64_t> leafmask(num_trees_);
+		for (size_t r = 0; r < n_rows; ++r) {
+			out[r] = score(rows + r * stride, missing, leafmask.data());
+		}
+	}
+
+	inline unsigned int num_tests() const {
+		return thresholds_.size();
+	}
+
+	/**
+	 * 检查 QuickScorer 与逐树遍历的结果是否一致， 返回最大的 margin 差值（正常应为0）
+	 */
+	static float check_equivalence(const GBDT_predictor& gbdt, const float* rows, size_t n_rows, size_t stride,
+			float missing = NAN) {
+		GBDT_predictor traversal = gbdt;
+		traversal.set_engine("");
+		QuickScorer qs(gbdt);
+		std::vector<float> expected(n_rows), actual(n_rows);
+		traversal.predict_margin_batch(rows, n_rows, stride, expected.data(), missing);
+		qs.predict_margin_batch(rows, n_rows, stride, actual.data(), missing);
+		float max_diff = 0.0f;
+		for (size_t r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(expected[r] - actual[r]));
+		return max_diff;
+	}
+
+	/**
+	 * 在随机的 depth-6 模型上（含missing value）检查一致性并比较吞吐
+	 */
+	static void testQuickScorer(int num_trees = 300, int max_depth = 6, int num_features = 100, int n_rows = 1000) {
+		std::cout << "\n---test LC::xgboost::QuickScorer" << std::endl;
+		std::stringstream dump(GBDT_predictor::random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		gbdt.compile();
+
+		LC::RandomUniform<int, float> rnd(2);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			rows[i] = rnd.randf();
+			if (rows[i] < 0.05f)
+				rows[i] = NAN;
+			else if (rows[i] < 0.1f)
+				rows[i] = -1.0f;
+		}
+		std::cout << "max abs diff (missing=NAN): "
+				<< check_equivalence(gbdt, rows.data(), n_rows, num_features) << std::endl;
+		std::cout << "max abs diff (missing=-1):  "
+				<< check_equivalence(gbdt, rows.data(), n_rows, num_features, -1.0f) << std::endl;
+
+		std::vector<float> out(n_rows);
+		LC::TimerAccurate timer;
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_traversal = timer.getElapsedTimeAndRestart();
+		gbdt.set_engine("quickscorer");
+		timer.restart();
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, out.data());
+		double t_qs = timer.getElapsedTimeAndRestart();
+		std::cout << "traversal:   " << n_rows / t_traversal << " rows/sec" << std::endl;
+		std::cout << "quickscorer: " << n_rows / t_qs << " rows/sec" << std::endl;
+	}
+
+private:
+	struct Test {
+		float threshold;
+		uint32_t tree;
+		uint64_t mask;
+		inline bool operator<(const Test& other) const {
+			return threshold < other.threshold;
+		}
+	};
+
+	int num_features_;
+	unsigned int num_trees_;
+
+	// 按特征分组、组内按阈值升序的节点， 第 f 个特征对应 [feature_offset_[f], feature_offset_[f + 1])
+	std::vector<unsigned int> feature_offset_;
+	std::vector<float> thresholds_;
+	std::vector<uint32_t> tree_ids_;
+	std::vector<uint64_t> masks_;
+
+	// missing 分支走右孩子的节点， 第 f 个特征对应 [missing_offset_[f], missing_offset_[f + 1])
+	std::vector<unsigned int> missing_offset_;
+	std::vector<uint32_t> missing_tree_ids_;
+	std::vector<uint64_t> missing_masks_;
+
+	// 第 t 棵树从左到右的叶子为 leaf_values_[leaf_offset_[t] ...]
+	std::vector<unsigned int> leaf_offset_;
+	std::vector<float> leaf_values_;
+
+	/**
+	 * 中序遍历， 按从左到右的顺序给叶子编号， 并为每个内部节点生成“去掉左子树叶子”的mask
+	 */
+	void collect_tests(const CompactNode* nodes, int32_t idx, uint32_t tree, unsigned int& num_leaves,
+			std::vector<std::vector<Test> >& tests, std::vector<std::vector<Test> >& missing_tests) {
+		const CompactNode& n = nodes[idx];
+		if (n.is_leaf()) {
+			num_leaves++;
+			return;
+		}
+		const unsigned int left_begin = num_leaves;
+		collect_tests(nodes, n.child, tree, num_leaves, tests, missing_tests);
+		const unsigned int left_end = num_leaves;
+		collect_tests(nodes, n.child + 1, tree, num_leaves, tests, missing_tests);
+
+		uint64_t left_leaves = (left_end - left_begin >= 64u ? ~0ULL : ((1ULL << (left_end - left_begin)) - 1ULL))
+				<< left_begin;
+		Test test;
+		test.threshold = n.threshold;
+		test.tree = tree;
+		test.mask = ~left_leaves;
+		tests[n.feature].push_back(test);
+		if (!(n.flags & CompactNode::FLAG_DEFAULT_LEFT))
+			missing_tests[n.feature].push_back(test);
+	}
+
+	void collect_leaves(const CompactNode* nodes, const float* values, int32_t idx) {
+		const CompactNode& n = nodes[idx];
+		if (n.is_leaf()) {
+			leaf_values_.push_back(values[~n.child]);
+			return;
+		}
+		collect_leaves(nodes, values, n.child);
+		collect_leaves(nodes, values, n.child + 1);
+	}
+
+	inline float score(const float* fv, float missing, uint64_t* leafmask) const {
+		std::fill(leafmask, leafmask + num_trees_, ~0ULL);
+		const bool missing_is_nan = std::isnan(missing);
+		for (int f = 0; f < num_features_; ++f) {
+			const float x = fv[f];
+			if ((missing_is_nan && std::isnan(x)) || x == missing) {
+				for (unsigned int i = missing_offset_[f]; i < missing_offset_[f + 1]; ++i)
+					leafmask[missing_tree_ids_[i]] &= missing_masks_[i];
+			} else if (std::isnan(x)) { // NAN 与阈值比较均为false， 在 Tree::predict 中总是走右孩子
+				for (unsigned int i = feature_offset_[f]; i < feature_offset_[f + 1]; ++i)
+					leafmask[tree_ids_[i]] &= masks_[i];
+			} else {
+				for (unsigned int i = feature_offset_[f]; i < feature_offset_[f + 1] && thresholds_[i] <= x; ++i)
+					leafmask[tree_ids_[i]] &= masks_[i];
+			}
+		}
+		float s = 0.0f;
+		for (unsigned int t = 0; t < num_trees_; ++t) {
+			s += leaf_values_[leaf_offset_[t] + __builtin_ctzll(leafmask[t])];
+		}
+		return s;
+	}
+};
+
+namespace {
+const bool quickscorer_registered = GBDT_predictor::register_engine("quickscorer", QuickScorer::create);
+}
+
+}/*xgboost*/
+}
+
+#endif /* LC_MACHINELEARNING_XGBOOST_QUICKSCORER_HPP_ */
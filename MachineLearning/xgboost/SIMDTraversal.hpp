@@ -0,0 +1,247 @@
+/*
+ * SIMDTraversal.hpp
+ *
+ *  Created on: Oct 18, 2026
+ *
+ *      多行同时遍历同一棵树的SIMD预测引擎：AVX2 一次8行， AVX-512 一次16行。
+ *      每个lane保存自己的节点序号， 通过gather读取 CompactNode 的 threshold/child/feature 以及该行的特征值，
+ *      用 compare + blend 选择孩子， 直到所有lane都到达叶子。
+ *      运行时检测CPU指令集， 不支持时（或非x86平台）退化为 Tree::predict_compact。
+ *      missing value 的语义与 Tree::predict 相同：x 为 NAN（missing 为 NAN 时）或 x == missing 时走 missing 分支。
+ *
+ *      用法：
+ *      #include "SIMDTraversal.hpp"
+ *      LC::xgboost::GBDT_predictor gbdt(filename, false, "simd");
+ */
+
+#ifndef LC_MACHINELEARNING_XGBOOST_SIMDTRAVERSAL_HPP_
+#define LC_MACHINELEARNING_XGBOOST_SIMDTRAVERSAL_HPP_
+
+#include "predictor.hpp"
+#include <climits>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LC_XGBOOST_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace LC {
+namespace xgboost {
+
+class SIMDTraversal: public GBDT_engine {
+public:
+	enum SIMDLevel {
+		SIMD_SCALAR = 0, SIMD_AVX2 = 1, SIMD_AVX512 = 2
+	};
+
+	/**
+	 * @param gbdt
+	 * @param max_level 使用的最高指令集， 实际使用的是它与CPU支持的指令集中较低的一个
+	 */
+	SIMDTraversal(const GBDT_predictor& gbdt, SIMDLevel max_level = SIMD_AVX512) :
+			trees_(gbdt.trees()), level_(std::min(max_level, cpu_level())) {
+		for (unsigned int t = 0; t < trees_.size(); ++t) {
+			if (!trees_[t].is_compiled() && !trees_[t].compile())
+				throw std::string("SIMDTraversal: can not compile tree ") + LC::Str::num2str(t);
+		}
+	}
+
+	static std::shared_ptr<GBDT_engine> create(const GBDT_predictor& gbdt) {
+		return std::make_shared<SIMDTraversal>(gbdt);
+	}
+
+	static SIMDLevel cpu_level() {
+#ifdef LC_XGBOOST_SIMD_X86
+		static const SIMDLevel level = __builtin_cpu_supports("avx512f") ? SIMD_AVX512 :
+										__builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SCALAR;
+		return level;
+#else
+		return SIMD_SCALAR;
+#endif
+	}
+
+	inline SIMDLevel level() const {
+		return level_;
+	}
+
+	virtual std::string name() const {
+		return "simd";
+	}
+
+	virtual void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing) const {
+		std::fill(out, out + n_rows, 0.0f);
+		size_t r = 0;
+#ifdef LC_XGBOOST_SIMD_X86
+		// gather 使用32位偏移
+		const bool fits_int32 = n_rows * stride < (size_t) INT_MAX;
+		if (level_ == SIMD_AVX512 && fits_int32) {
+			for (; r + 16 <= n_rows; r += 16) {
+				for (unsigned int t = 0; t < trees_.size(); ++t)
+					predict_tree_avx512(trees_[t], rows, r, stride, missing, out + r);
+			}
+		}
+		if (level_ >= SIMD_AVX2 && fits_int32) {
+			for (; r + 8 <= n_rows; r += 8) {
+				for (unsigned int t = 0; t < trees_.size(); ++t)
+					predict_tree_avx2(trees_[t], rows, r, stride, missing, out + r);
+			}
+		}
+#endif
+		for (; r < n_rows; ++r) {
+			for (unsigned int t = 0; t < trees_.size(); ++t)
+				out[r] += trees_[t].predict_compact(rows + r * stride, missing);
+		}
+	}
+
+	/**
+	 * 检查SIMD引擎与逐树遍历的结果是否一致， 返回最大的 margin 差值（正常应为0）
+	 */
+	static float check_equivalence(const GBDT_predictor& gbdt, const float* rows, size_t n_rows, size_t stride,
+			float missing = NAN, SIMDLevel max_level = SIMD_AVX512) {
+		GBDT_predictor traversal = gbdt;
+		traversal.set_engine("");
+		SIMDTraversal simd(gbdt, max_level);
+		std::vector<float> expected(n_rows), actual(n_rows);
+		traversal.predict_margin_batch(rows, n_rows, stride, expected.data(), missing);
+		simd.predict_margin_batch(rows, n_rows, stride, actual.data(), missing);
+		float max_diff = 0.0f;
+		for (size_t r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(expected[r] - actual[r]));
+		return max_diff;
+	}
+
+	static void testSIMDTraversal(int num_trees = 500, int max_depth = 8, int num_features = 100, int n_rows = 1003) {
+		std::cout << "\n---test LC::xgboost::SIMDTraversal, cpu level: " << cpu_level() << std::endl;
+		std::stringstream dump(GBDT_predictor::random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		gbdt.compile();
+
+		LC::RandomUniform<int, float> rnd(3);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i) {
+			rows[i] = rnd.randf();
+			if (rows[i] < 0.05f)
+				rows[i] = NAN;
+			else if (rows[i] < 0.1f)
+				rows[i] = -1.0f;
+		}
+		const SIMDLevel levels[] = { SIMD_SCALAR, SIMD_AVX2, SIMD_AVX512 };
+		std::vector<float> out(n_rows);
+		for (unsigned int i = 0; i < 3u && levels[i] <= cpu_level(); ++i) {
+			std::cout << "level " << levels[i] << ": max abs diff (missing=NAN): "
+					<< check_equivalence(gbdt, rows.data(), n_rows, num_features, NAN, levels[i])
+					<< "; (missing=-1): "
+					<< check_equivalence(gbdt, rows.data(), n_rows, num_features, -1.0f, levels[i]);
+			SIMDTraversal simd(gbdt, levels[i]);
+			LC::TimerAccurate timer;
+			simd.predict_margin_batch(rows.data(), n_rows, num_features, out.data(), NAN);
+			std::cout << "; \t" << n_rows / timer.getElapsedTime() << " rows/sec" << std::endl;
+		}
+	}
+
+private:
+	std::vector<Tree> trees_;
+	SIMDLevel level_;
+
+#ifdef LC_XGBOOST_SIMD_X86
+	/**
+	 * 8行（r0 ~ r0+7）同时遍历一棵树， 叶子值累加到 out[0~7]
+	 */
+	__attribute__((target("avx2")))
+	static void predict_tree_avx2(const Tree& tree, const float* rows, size_t r0, size_t stride, float missing,
+			float* out) {
+		const int* nodes = (const int*) (tree.compact_nodes());
+		const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i row_offset = _mm256_mullo_epi32(_mm256_add_epi32(lane, _mm256_set1_epi32((int) r0)),
+				_mm256_set1_epi32((int) stride));
+		const __m256i three = _mm256_set1_epi32(3);
+		const __m256i minus_one = _mm256_set1_epi32(-1);
+		const __m256i feature_mask = _mm256_set1_epi32(0xFFFF);
+		const __m256i default_left_mask = _mm256_set1_epi32(CompactNode::FLAG_DEFAULT_LEFT << 16);
+		const __m256 missing_v = _mm256_set1_ps(missing);
+		const bool missing_is_nan = std::isnan(missing);
+
+		__m256i idx = _mm256_setzero_si256();
+		__m256i child;
+		while (true) {
+			const __m256i word = _mm256_mullo_epi32(idx, three);
+			child = _mm256_i32gather_epi32(nodes + 1, word, 4);
+			const __m256i active = _mm256_cmpgt_epi32(child, minus_one);
+			if (_mm256_movemask_epi8(active) == 0)
+				break;
+			const __m256 threshold = _mm256_i32gather_ps((const float* ) nodes, word, 4);
+			const __m256i feature_flags = _mm256_i32gather_epi32(nodes + 2, word, 4);
+			const __m256i feature = _mm256_and_si256(feature_flags, feature_mask);
+			const __m256 x = _mm256_i32gather_ps(rows, _mm256_add_epi32(row_offset, feature), 4);
+
+			const __m256 is_missing =
+					missing_is_nan ? _mm256_cmp_ps(x, x, _CMP_UNORD_Q) : _mm256_cmp_ps(x, missing_v, _CMP_EQ_OQ);
+			const __m256 not_less = _mm256_cmp_ps(x, threshold, _CMP_NLT_UQ); // !(x < threshold)， 与Tree::predict一致
+			const __m256i default_right = _mm256_cmpeq_epi32(_mm256_and_si256(feature_flags, default_left_mask),
+					_mm256_setzero_si256());
+			const __m256i go_right = _mm256_castps_si256(
+					_mm256_blendv_ps(not_less, _mm256_castsi256_ps(default_right), is_missing));
+			const __m256i next = _mm256_sub_epi32(child, go_right); // go_right 为 -1 时走 child + 1
+			idx = _mm256_blendv_epi8(idx, next, active);
+		}
+		const __m256 leaf = _mm256_i32gather_ps(tree.leaf_values(), _mm256_xor_si256(child, minus_one), 4);
+		_mm256_storeu_ps(out, _mm256_add_ps(_mm256_loadu_ps(out), leaf));
+	}
+
+	/**
+	 * 16行（r0 ~ r0+15）同时遍历一棵树， 叶子值累加到 out[0~15]
+	 */
+	__attribute__((target("avx512f")))
+	static void predict_tree_avx512(const Tree& tree, const float* rows, size_t r0, size_t stride, float missing,
+			float* out) {
+		const int* nodes = (const int*) (tree.compact_nodes());
+		const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m512i row_offset = _mm512_mullo_epi32(_mm512_add_epi32(lane, _mm512_set1_epi32((int) r0)),
+				_mm512_set1_epi32((int) stride));
+		const __m512i three = _mm512_set1_epi32(3);
+		const __m512i minus_one = _mm512_set1_epi32(-1);
+		const __m512i feature_mask = _mm512_set1_epi32(0xFFFF);
+		const __m512i default_left_mask = _mm512_set1_epi32(CompactNode::FLAG_DEFAULT_LEFT << 16);
+		const __m512 missing_v = _mm512_set1_ps(missing);
+		const __m512i zero_i = _mm512_setzero_si512();
+		const __m512 zero_f = _mm512_setzero_ps();
+		const __mmask16 all_lanes = 0xFFFF; // 使用 mask gather 并显式给出初值， 避免 gcc 的 -Wuninitialized 误报
+		const bool missing_is_nan = std::isnan(missing);
+
+		__m512i idx = _mm512_setzero_si512();
+		__m512i child;
+		while (true) {
+			const __m512i word = _mm512_mullo_epi32(idx, three);
+			child = _mm512_mask_i32gather_epi32(zero_i, all_lanes, word, nodes + 1, 4);
+			const __mmask16 active = _mm512_cmpgt_epi32_mask(child, minus_one);
+			if (active == 0)
+				break;
+			const __m512 threshold = _mm512_mask_i32gather_ps(zero_f, all_lanes, word, nodes, 4);
+			const __m512i feature_flags = _mm512_mask_i32gather_epi32(zero_i, all_lanes, word, nodes + 2, 4);
+			const __m512i feature = _mm512_and_si512(feature_flags, feature_mask);
+			const __m512 x = _mm512_mask_i32gather_ps(zero_f, all_lanes, _mm512_add_epi32(row_offset, feature), rows, 4);
+
+			const __mmask16 is_missing =
+					missing_is_nan ? _mm512_cmp_ps_mask(x, x, _CMP_UNORD_Q) : _mm512_cmp_ps_mask(x, missing_v, _CMP_EQ_OQ);
+			const __mmask16 not_less = _mm512_cmp_ps_mask(x, threshold, _CMP_NLT_UQ);
+			const __mmask16 default_right = _mm512_testn_epi32_mask(feature_flags, default_left_mask);
+			const __mmask16 go_right = (__mmask16) ((is_missing & default_right) | (~is_missing & not_less));
+			const __m512i next = _mm512_mask_add_epi32(child, go_right, child, _mm512_set1_epi32(1));
+			idx = _mm512_mask_blend_epi32(active, idx, next);
+		}
+		const __m512 leaf = _mm512_mask_i32gather_ps(zero_f, all_lanes, _mm512_xor_si512(child, minus_one), tree.leaf_values(), 4);
+		_mm512_storeu_ps(out, _mm512_add_ps(_mm512_loadu_ps(out), leaf));
+	}
+#endif
+};
+
+namespace {
+const bool simd_traversal_registered = GBDT_predictor::register_engine("simd", SIMDTraversal::create);
+}
+
+}/*xgboost*/
+}
+
+#endif /* LC_MACHINELEARNING_XGBOOST_SIMDTRAVERSAL_HPP_ */
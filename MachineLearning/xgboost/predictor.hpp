@@ -13,12 +13,29 @@
 #ifndef LC_MACHINELEARNING_XGBOOST_PREDICTOR_HPP_
 #define LC_MACHINELEARNING_XGBOOST_PREDICTOR_HPP_
 #include "../../utility/StringUtil.hpp"
+#include "../../utility/Random.hpp"
+#include "../../utility/Timer.hpp"
+#include "../../utility/MappedFile.hpp"
+#include "../../utility/ThreadPool.hpp"
+#include "../../utility/HashMurmur3.hpp"
+#include "../../IO/BinaryIO.hpp"
+#include <stdint.h>
+#include <cstddef>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
 #include <fstream>
+#include <iterator>
 #include <iostream>
 #include <sstream>
 #include <iomanip>
 #include <vector>
 #include <string>
+#include <map>
+#include <memory>
+#include <functional>
 namespace LC {
 namespace xgboost {
 class Node {
@@ -32,33 +49,134 @@ public:
 	int split_feature_;
 	float split_threshold_;
 	float value_;
+	float cover_; ///< 训练时落入该节点的样本的二阶梯度之和（dump 时需指定 with_stats）， 没有时为0
 
 	bool isleaf;
 
 	// internal node
 	Node(int current, int left, int right, int miss, int split_feature, float threshold) :
 			current_(current), left_(left), right_(right), miss_(miss), split_feature_(split_feature), split_threshold_(
-					threshold), value_(0.0), isleaf(false) {
+					threshold), value_(0.0), cover_(0.0), isleaf(false) {
 	}
 
 	// leaf node
 	Node(int current = -1, float value = 0.0) :
 			current_(current), left_(-1), right_(-1), miss_(-1), split_feature_(-1), split_threshold_(0.0), value_(
-					value), isleaf(true) {
+					value), cover_(0.0), isleaf(true) {
+	}
+};
+
+/**
+ * Tree::compile() 生成的紧凑节点（12字节， 一个cache line可放5个， 而Node为32字节只能放2个）
+ * child >= 0 时为内部节点， 左孩子为 child， 右孩子为 child + 1（隐式兄弟）；
+ * child < 0 时为叶子， 叶子的值单独存放在 leaf_values_[~child] 中
+ */
+struct CompactNode {
+	enum {
+		FLAG_DEFAULT_LEFT = 1, ///< missing value 走左孩子
+		FLAG_LIKELY_LEFT = 2, ///< profile 中大多数样本走左孩子， 参见 Tree::reorder_by_profile
+		FLAG_LIKELY_RIGHT = 4 ///< profile 中大多数样本走右孩子
+	};
+
+	float threshold;
+	int32_t child;
+	uint16_t feature;
+	uint16_t flags;
+
+	inline bool is_leaf() const {
+		return child < 0;
+	}
+	inline int32_t missing_child() const {
+		return child + ((flags & FLAG_DEFAULT_LEFT) ? 0 : 1);
 	}
 };
 
 class Tree {
 public:
+	Tree() :
+			cn_(NULL), num_cn_(0), lv_(NULL), num_lv_(0), lid_(NULL), cov_(NULL), external_(false) {
+	}
+
+	Tree(const Tree& other) :
+			tree_(other.tree_), cnodes_(other.cnodes_), leaf_values_(other.leaf_values_), leaf_ids_(
+					other.leaf_ids_), covers_(other.covers_) {
+		bind_like(other);
+	}
+
+	Tree& operator=(const Tree& other) {
+		if (this == &other)
+			return *this;
+		tree_ = other.tree_;
+		cnodes_ = other.cnodes_;
+		leaf_values_ = other.leaf_values_;
+		leaf_ids_ = other.leaf_ids_;
+		covers_ = other.covers_;
+		bind_like(other);
+		return *this;
+	}
+
 	int add_line(const std::string &line) {
-		if (line.find("leaf") == std::string::npos) {
-			return add_internal_node(line);
+		return add_line(line.data(), line.size());
+	}
+
+	/**
+	 * 解析text dump中的一行（不含换行符）， 返回内部节点的分裂特征， 叶子节点返回-1
+	 */
+	int add_line(const char* line, size_t len) {
+		clear_compact();
+		double dv[MAX_NUMBERS_PER_LINE];
+		const int n = scan_numbers(line, line + len, dv);
+		static const char leaf[] = "leaf";
+		if (std::search(line, line + len, leaf, leaf + 4) == line + len) {
+			return add_internal_node(dv, n, line, len);
 		} else {
-			return add_leaf_node(line);
+			return add_leaf_node(dv, n, line, len);
+		}
+	}
+
+	/**
+	 * 与 LC::Str::str2doublevec_ignore_letters 的结果完全相同的数字扫描（跳过字母等非数字字符），
+	 * 但不构造 std::vector， 且对常见的短小数直接计算， 只有超出精确计算范围时才退回 strtod；
+	 * 返回该行中数字的个数， 只保存前 MAX_NUMBERS_PER_LINE 个
+	 */
+	static int scan_numbers(const char* p, const char* pend, double* out) {
+		int n = 0;
+		while (p < pend) {
+			while (*p != '-' && (*p < '0' || *p > '9')) {
+				p++;
+				if (p >= pend)
+					return n;
+			}
+			const char* end = p;
+			double d;
+			if (!scan_number(p, pend, d, end)) {
+				char* e;
+				d = std::strtod(p, &e);
+				end = e;
+			}
+			if (p == end)
+				return n;
+			if (n < MAX_NUMBERS_PER_LINE)
+				out[n] = d;
+			n++;
+			p = end + 1;
 		}
+		return n;
+	}
+
+	inline float predict(const std::vector<float> &fv, float missing = NAN) const {
+		return predict(fv.data(), missing);
 	}
 
-	float predict(const std::vector<float> &fv, float missing = NAN) const {
+	/**
+	 * 与predict(const std::vector<float>&, float)相同， 但直接读取连续内存中的一行特征， 供批量预测使用
+	 * @param fv 长度至少为 num_features 的特征
+	 * @param missing
+	 * @return
+	 */
+	float predict(const float* fv, float missing = NAN) const {
+		if (is_compiled())
+			return predict_compact(fv, missing);
 		if (tree_.empty())
 			return 0.0f;
 		const Node* pn = &tree_[0];
@@ -82,6 +200,12 @@ public:
 	 * @return
 	 */
 	inline float predict_no_missing_value(const std::vector<float> &fv) const {
+		return predict_no_missing_value(fv.data());
+	}
+
+	inline float predict_no_missing_value(const float* fv) const {
+		if (is_compiled())
+			return predict_compact_no_missing_value(fv);
 //		if (tree_.empty())
 //			return 0.0f;
 		const Node* pn = &tree_[0];
@@ -96,7 +220,240 @@ public:
 	}
 
 	inline unsigned int size() const {
-		return tree_.size();
+		return external_ ? num_cn_ : tree_.size();
+	}
+
+	/**
+	 * 将 tree_ 编译为 CompactNode 布局， 编译后 predict 系列函数将使用紧凑布局， 结果与编译前完全一致；
+	 * 节点按“父节点之后紧跟左右孩子对”的先序顺序排列。 已编译时直接返回（add_line 会清除编译结果）。
+	 * 特征序号超过 uint16 或 missing 分支既不是左孩子也不是右孩子时无法编译， 返回false， 仍使用原布局
+	 */
+	bool compile() {
+		if (external_ || is_compiled())
+			return true;
+		clear_compact();
+		if (tree_.empty())
+			return false;
+		for (unsigned int i = 0; i < tree_.size(); ++i) {
+			const Node& n = tree_[i];
+			if (n.isleaf)
+				continue;
+			if (n.split_feature_ > 0xFFFF || (n.miss_ != n.left_ && n.miss_ != n.right_))
+				return false;
+		}
+		cnodes_.resize(1);
+		covers_.resize(1);
+		compile_node(0, 0);
+		if (std::find_if(covers_.begin(), covers_.end(), [](float c) {return !(c > 0.0f);}) != covers_.end())
+			covers_.clear(); // dump 中没有 cover
+		bind_owned();
+		return true;
+	}
+
+	/**
+	 * 直接使用外部内存（如 mmap 的二进制模型文件）中的紧凑节点， 不做任何复制；
+	 * 调用者需要保证这段内存的生命周期长于该树。 绑定后 tree_ 为空， to_lua_script/to_java_code 不可用
+	 * @param leaf_ids 每个叶子在 text dump 中的节点编号， 可以为NULL
+	 * @param covers 每个紧凑节点的 cover， 可以为NULL
+	 */
+	void bind_external(const CompactNode* nodes, unsigned int num_nodes, const float* leaves,
+			unsigned int num_leaves, const int32_t* leaf_ids = NULL, const float* covers = NULL) {
+		tree_.clear();
+		cnodes_.clear();
+		leaf_values_.clear();
+		leaf_ids_.clear();
+		covers_.clear();
+		cn_ = nodes;
+		num_cn_ = num_nodes;
+		lv_ = leaves;
+		num_lv_ = num_leaves;
+		lid_ = leaf_ids;
+		cov_ = covers;
+		external_ = true;
+	}
+
+	inline bool is_compiled() const {
+		return num_cn_ > 0u;
+	}
+
+	///< 预测时实际访问的节点数据的大小
+	inline unsigned long long memory_bytes() const {
+		if (is_compiled())
+			return num_cn_ * sizeof(CompactNode) + num_lv_ * sizeof(float);
+		return tree_.size() * sizeof(Node);
+	}
+
+	inline const CompactNode* compact_nodes() const {
+		return cn_;
+	}
+
+	inline unsigned int num_compact_nodes() const {
+		return num_cn_;
+	}
+
+	inline const float* leaf_values() const {
+		return lv_;
+	}
+
+	inline unsigned int num_leaves() const {
+		return num_lv_;
+	}
+
+	/**
+	 * 第 i 个叶子（紧凑布局中的顺序）在 text dump 中的节点编号， 即 xgboost pred_leaf 的输出； 没有时为NULL
+	 */
+	inline const int32_t* leaf_node_ids() const {
+		return lid_;
+	}
+
+	/**
+	 * 每个紧凑节点的 cover， 与 compact_nodes() 一一对应； dump 中没有 cover 时为NULL
+	 */
+	inline const float* covers() const {
+		return cov_;
+	}
+
+	/**
+	 * 样本落入的叶子在 text dump 中的节点编号（与 xgboost 的 pred_leaf 相同）；
+	 * 没有节点编号（如旧版本的二进制模型）时返回该叶子在紧凑布局中的序号
+	 */
+	inline int predict_leaf_index(const float* fv, float missing = NAN) const {
+		if (!is_compiled()) {
+			if (tree_.empty())
+				return -1;
+			const Node* pn = &tree_[0];
+			const bool missing_is_nan = std::isnan(missing);
+			while (!pn->isleaf) {
+				const float x = fv[pn->split_feature_];
+				if ((missing_is_nan && std::isnan(x)) || x == missing) {
+					pn = &tree_[pn->miss_];
+				} else {
+					pn = &tree_[x < pn->split_threshold_ ? pn->left_ : pn->right_];
+				}
+			}
+			return pn->current_;
+		}
+		const int32_t leaf = ~cn_[find_leaf_compact(fv, missing)].child;
+		return lid_ != NULL ? lid_[leaf] : leaf;
+	}
+
+	/**
+	 * 累加 rows 中每行经过的紧凑节点的访问次数到 counts[节点下标]（需已编译）
+	 */
+	void profile_compact(const float* rows, size_t n_rows, size_t stride, float missing,
+			std::vector<uint64_t>& counts) const {
+		counts.resize(num_cn_, 0);
+		if (!is_compiled())
+			return;
+		const bool missing_is_nan = std::isnan(missing);
+		for (size_t r = 0; r < n_rows; ++r) {
+			const float* fv = rows + r * stride;
+			int32_t idx = 0;
+			counts[0]++;
+			while (!cn_[idx].is_leaf()) {
+				const CompactNode& n = cn_[idx];
+				const float x = fv[n.feature];
+				if ((missing_is_nan && std::isnan(x)) || x == missing) {
+					idx = n.missing_child();
+				} else {
+					idx = n.child + (x < n.threshold ? 0 : 1);
+				}
+				counts[idx]++;
+			}
+		}
+	}
+
+	/**
+	 * 按 profile_compact 统计的访问次数重排紧凑节点（profile-guided layout）：
+	 * 从根开始深度优先、 总是先放访问次数更多的孩子的子树， 使最常走的路径在内存中连续；
+	 * 同时对至少 hint_ratio 比例的样本走向同一侧的节点设置 FLAG_LIKELY_LEFT/FLAG_LIKELY_RIGHT， 供 CodeGen 生成分支提示。
+	 * 预测结果不变； bind_external 的树会复制为自有的节点
+	 */
+	bool reorder_by_profile(const std::vector<uint64_t>& counts, float hint_ratio = 0.8f) {
+		if (!is_compiled() || counts.size() != num_cn_)
+			return false;
+		std::vector<CompactNode> nodes(1);
+		std::vector<float> covers(cov_ != NULL ? 1 : 0);
+		relayout_node(0, 0, counts, hint_ratio, nodes, covers);
+		if (external_) {
+			leaf_values_.assign(lv_, lv_ + num_lv_);
+			if (lid_ != NULL)
+				leaf_ids_.assign(lid_, lid_ + num_lv_);
+		}
+		cnodes_.swap(nodes);
+		covers_.swap(covers);
+		bind_owned();
+		return true;
+	}
+
+	/**
+	 * 预测一行时访问的不同 cache line（64字节）的个数， 用于评估节点布局
+	 */
+	unsigned int cache_lines_touched(const float* fv, float missing = NAN) const {
+		if (!is_compiled())
+			return 0;
+		uintptr_t lines[64];
+		unsigned int num_lines = 0;
+		const bool missing_is_nan = std::isnan(missing);
+		int32_t idx = 0;
+		while (true) {
+			const uintptr_t line = (uintptr_t) (cn_ + idx) / 64u;
+			if (std::find(lines, lines + num_lines, line) == lines + num_lines && num_lines < 64u)
+				lines[num_lines++] = line;
+			const CompactNode& n = cn_[idx];
+			if (n.is_leaf())
+				break;
+			const float x = fv[n.feature];
+			if ((missing_is_nan && std::isnan(x)) || x == missing) {
+				idx = n.missing_child();
+			} else {
+				idx = n.child + (x < n.threshold ? 0 : 1);
+			}
+		}
+		return num_lines + 1; // 叶子的值单独存放， 另占一个 cache line
+	}
+
+	/**
+	 * 紧凑布局中样本落入的叶子节点的下标
+	 */
+	inline int32_t find_leaf_compact(const float* fv, float missing = NAN) const {
+		const CompactNode* nodes = cn_;
+		int32_t idx = 0;
+		const bool missing_is_nan = std::isnan(missing);
+		while (!nodes[idx].is_leaf()) {
+			const CompactNode& n = nodes[idx];
+			const float x = fv[n.feature];
+			if ((missing_is_nan && std::isnan(x)) || x == missing) {
+				idx = n.missing_child();
+			} else {
+				idx = n.child + (x < n.threshold ? 0 : 1);
+			}
+		}
+		return idx;
+	}
+
+	inline float predict_compact(const float* fv, float missing = NAN) const {
+		const CompactNode* nodes = cn_;
+		const CompactNode* pn = nodes;
+		const bool missing_is_nan = std::isnan(missing);
+		while (!pn->is_leaf()) {
+			const float x = fv[pn->feature];
+			if ((missing_is_nan && std::isnan(x)) || x == missing) {
+				pn = nodes + pn->missing_child();
+			} else {
+				pn = nodes + pn->child + (x < pn->threshold ? 0 : 1);
+			}
+		}
+		return lv_[~pn->child];
+	}
+
+	inline float predict_compact_no_missing_value(const float* fv) const {
+		const CompactNode* nodes = cn_;
+		const CompactNode* pn = nodes;
+		while (!pn->is_leaf()) {
+			pn = nodes + pn->child + (fv[pn->feature] >= pn->threshold ? 1 : 0);
+		}
+		return lv_[~pn->child];
 	}
 
 	void to_lua_script(std::stringstream& ss, Node* pn = NULL, int level = 1, int idx_start_from = 1, string indent =
@@ -160,17 +517,172 @@ public:
 	}
 private:
 	std::vector<Node> tree_;
+	std::vector<CompactNode> cnodes_;
+	std::vector<float> leaf_values_;
+	std::vector<int32_t> leaf_ids_; ///< 与 leaf_values_ 对应的 text dump 中的节点编号
+	std::vector<float> covers_; ///< 与 cnodes_ 对应的 cover， dump 中没有 cover 时为空
 
-	int add_leaf_node(const std::string &line) {
-//		std::cout << "add leaf node: " << line << std::endl;
-		//叶子结点， 如 "63:leaf=-0.379265"
-		std::vector<double> dv = LC::Str::str2doublevec_ignore_letters(line.data(), line.size());
+	// 预测时使用的紧凑节点， 指向 cnodes_/leaf_values_， 或 bind_external 绑定的外部内存
+	const CompactNode* cn_;
+	unsigned int num_cn_;
+	const float* lv_;
+	unsigned int num_lv_;
+	const int32_t* lid_;
+	const float* cov_;
+	bool external_;
+
+	void bind_owned() {
+		cn_ = cnodes_.empty() ? NULL : cnodes_.data();
+		num_cn_ = cnodes_.size();
+		lv_ = leaf_values_.empty() ? NULL : leaf_values_.data();
+		num_lv_ = leaf_values_.size();
+		lid_ = leaf_ids_.empty() ? NULL : leaf_ids_.data();
+		cov_ = covers_.empty() ? NULL : covers_.data();
+		external_ = false;
+	}
+
+	void bind_like(const Tree& other) {
+		if (other.external_) {
+			cn_ = other.cn_;
+			num_cn_ = other.num_cn_;
+			lv_ = other.lv_;
+			num_lv_ = other.num_lv_;
+			lid_ = other.lid_;
+			cov_ = other.cov_;
+			external_ = true;
+		} else {
+			bind_owned();
+		}
+	}
+
+	void clear_compact() {
+		cnodes_.clear();
+		leaf_values_.clear();
+		leaf_ids_.clear();
+		covers_.clear();
+		bind_owned();
+	}
+
+	void compile_node(int id, unsigned int slot) {
+		const Node& n = tree_[id];
+		covers_[slot] = n.cover_;
+		if (n.isleaf) {
+			cnodes_[slot].threshold = 0.0f;
+			cnodes_[slot].child = ~(int32_t) (leaf_values_.size());
+			cnodes_[slot].feature = 0;
+			cnodes_[slot].flags = 0;
+			leaf_values_.push_back(n.value_);
+			leaf_ids_.push_back(id);
+			return;
+		}
+		const unsigned int child = cnodes_.size();
+		cnodes_.resize(child + 2u);
+		covers_.resize(child + 2u);
+		cnodes_[slot].threshold = n.split_threshold_;
+		cnodes_[slot].child = (int32_t) child;
+		cnodes_[slot].feature = (uint16_t) n.split_feature_;
+		cnodes_[slot].flags = n.miss_ == n.left_ ? CompactNode::FLAG_DEFAULT_LEFT : 0;
+		compile_node(n.left_, child);
+		compile_node(n.right_, child + 1u);
+	}
+
+	void relayout_node(int32_t idx, unsigned int slot, const std::vector<uint64_t>& counts, float hint_ratio,
+			std::vector<CompactNode>& nodes, std::vector<float>& covers) const {
+		const CompactNode& n = cn_[idx];
+		nodes[slot] = n;
+		if (cov_ != NULL)
+			covers[slot] = cov_[idx];
+		if (n.is_leaf())
+			return;
+		const unsigned int child = nodes.size();
+		nodes.resize(child + 2u);
+		if (cov_ != NULL)
+			covers.resize(child + 2u);
+		const uint64_t left_count = counts[n.child], right_count = counts[n.child + 1];
+		uint16_t flags = n.flags & ~(CompactNode::FLAG_LIKELY_LEFT | CompactNode::FLAG_LIKELY_RIGHT);
+		const double total = (double) left_count + right_count;
+		if (total > 0 && left_count >= hint_ratio * total)
+			flags |= CompactNode::FLAG_LIKELY_LEFT;
+		else if (total > 0 && right_count >= hint_ratio * total)
+			flags |= CompactNode::FLAG_LIKELY_RIGHT;
+		nodes[slot].child = (int32_t) child;
+		nodes[slot].flags = flags;
+		if (right_count > left_count) {
+			relayout_node(n.child + 1, child + 1u, counts, hint_ratio, nodes, covers);
+			relayout_node(n.child, child, counts, hint_ratio, nodes, covers);
+		} else {
+			relayout_node(n.child, child, counts, hint_ratio, nodes, covers);
+			relayout_node(n.child + 1, child + 1u, counts, hint_ratio, nodes, covers);
+		}
+	}
+
+	static const int MAX_NUMBERS_PER_LINE = 8;
+
+	/**
+	 * 快速路径： 形如 -123.456e-7、有效数字不超过19位且 |10的指数| <= 22 的数，
+	 * 此时尾数和10的幂都可以精确地用double表示， 一次乘除得到的就是正确舍入的结果， 与strtod相同；
+	 * 其他情况返回false， 由调用者使用strtod
+	 */
+	static inline bool scan_number(const char* p, const char* pend, double& d, const char*& end) {
+		static const double pow10[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12, 1e13,
+				1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+		const char* q = p;
+		const bool neg = q < pend && *q == '-';
+		if (neg)
+			++q;
+		uint64_t mantissa = 0;
+		int digits = 0, exp10 = 0;
+		const char* digits_begin = q;
+		while (q < pend && *q >= '0' && *q <= '9') {
+			mantissa = mantissa * 10 + (*q++ - '0');
+			digits += mantissa > 0 ? 1 : 0;
+		}
+		bool has_digits = q > digits_begin;
+		if (q < pend && *q == '.') {
+			++q;
+			const char* frac_begin = q;
+			while (q < pend && *q >= '0' && *q <= '9') {
+				mantissa = mantissa * 10 + (*q++ - '0');
+				digits += mantissa > 0 ? 1 : 0;
+				exp10--;
+			}
+			has_digits |= q > frac_begin;
+		}
+		if (!has_digits || digits > 19)
+			return false;
+		if (q < pend && (*q == 'e' || *q == 'E')) {
+			const char* e = q + 1;
+			bool eneg = false;
+			if (e < pend && (*e == '-' || *e == '+'))
+				eneg = *e++ == '-';
+			if (e < pend && *e >= '0' && *e <= '9') {
+				int ev = 0;
+				while (e < pend && *e >= '0' && *e <= '9' && ev < 10000)
+					ev = ev * 10 + (*e++ - '0');
+				if (e < pend && *e >= '0' && *e <= '9')
+					return false;
+				exp10 += eneg ? -ev : ev;
+				q = e;
+			}
+		}
+		if (mantissa > (1ULL << 53) || exp10 < -22 || exp10 > 22)
+			return false;
+		d = (double) mantissa;
+		d = exp10 < 0 ? d / pow10[-exp10] : d * pow10[exp10];
+		if (neg)
+			d = -d;
+		end = q;
+		return true;
+	}
 
-		if (dv.size() != 2u)
-			throw std::string("invalid xgboost leaf node: ") + line;
+	int add_leaf_node(const double* dv, int n, const char* line, size_t len) {
+//		std::cout << "add leaf node: " << line << std::endl;
+		//叶子结点， 如 "63:leaf=-0.379265"， with_stats 时为 "63:leaf=-0.379265,cover=12.5"
+		if (n != 2 && n != 3)
+			throw std::string("invalid xgboost leaf node: ") + std::string(line, len);
 		int id = (int) (dv[0]);
 		if (id < 0)
-			throw std::string("invalid xgboost leaf node: ") + line;
+			throw std::string("invalid xgboost leaf node: ") + std::string(line, len);
 		float value = (float) (dv[1]);
 
 		unsigned int min_size = id + 1;
@@ -178,16 +690,17 @@ private:
 			tree_.resize(min_size);
 		}
 		tree_[id] = Node(id, value);
+		if (n == 3)
+			tree_[id].cover_ = (float) (dv[2]);
 		return -1;
 	}
 
-	int add_internal_node(const std::string &line) {
+	int add_internal_node(const double* dv, int n, const char* line, size_t len) {
 //		std::cout << "add branch node: " << line << std::endl;
 
-		//中间节点，如   "1:[f19<41.5] yes=3,no=4,missing=3"
-		std::vector<double> dv = LC::Str::str2doublevec_ignore_letters(line.data(), line.size());
-		if (dv.size() != 6u)
-			throw std::string("invalid xgboost branch node: ") + line;
+		//中间节点，如   "1:[f19<41.5] yes=3,no=4,missing=3"， with_stats 时之后还有 ",gain=120.5,cover=80"
+		if (n != 6 && n != 8)
+			throw std::string("invalid xgboost branch node: ") + std::string(line, len);
 		int id = (int) (dv[0]);
 		auto split_feature = (int) (dv[1]);
 		auto threshold = (float) (dv[2]);
@@ -196,111 +709,1690 @@ private:
 		auto missing = (int) (dv[5]);
 
 		if (id < 0 || split_feature < 0 || left < 0 || right < 0 || missing < 0)
-			throw std::string("invalid xgboost branch node: ") + line;
+			throw std::string("invalid xgboost branch node: ") + std::string(line, len);
 		unsigned int min_size = id + 1;
 		if (tree_.size() < min_size) {
 			tree_.resize(min_size);
 		}
 
 		tree_[id] = Node(id, left, right, missing, split_feature, threshold);
+		if (n == 8)
+			tree_[id].cover_ = (float) (dv[7]);
 
 		return split_feature;
 	}
 };
 
-class GBDT_predictor {
+/**
+ * 单棵树的 TreeSHAP（path-dependent feature perturbation）， 参见 Lundberg et al. "Consistent Individualized
+ * Feature Attribution for Tree Ensembles", 2018 中的 Algorithm 2， 与 xgboost 的 pred_contribs 相同。
+ * 直接在 Tree 编译后的紧凑布局上计算， 需要每个节点的 cover（Tree::covers()）
+ */
+class TreeSHAP {
+public:
+	struct PathElement {
+		int feature_index;
+		float zero_fraction;
+		float one_fraction;
+		float pweight;
+	};
+
+	/**
+	 * @param tree 已编译且带有 cover 的树， 需要在 TreeSHAP 的生命周期内有效（只保存指针）
+	 */
+	TreeSHAP(const Tree& tree) :
+			nodes_(tree.compact_nodes()), leaves_(tree.leaf_values()), covers_(tree.covers()), max_depth_(0) {
+		mean_values_.resize(tree.num_compact_nodes());
+		if (!mean_values_.empty())
+			fill_mean_values(0, 0);
+	}
+
+	/**
+	 * 树的期望输出（按 cover 加权的叶子值的平均）， 即没有任何特征信息时的预测
+	 */
+	inline float expected_value() const {
+		return mean_values_.empty() ? 0.0f : mean_values_[0];
+	}
+
+	/**
+	 * 将该树对各特征的贡献累加到 phi[feature] 中（不含 expected_value）
+	 * @param path 临时空间， 可在多次调用间复用以避免分配
+	 */
+	void contributions(const float* fv, float missing, float* phi, std::vector<PathElement>& path) const {
+		if (mean_values_.empty())
+			return;
+		path.resize((max_depth_ + 2) * (max_depth_ + 3) / 2);
+		recurse(fv, missing, std::isnan(missing), phi, 0, path.data(), 0, 1.0f, 1.0f, -1);
+	}
 
 private:
-	std::vector<Tree> trees_;
-	int num_features_;
-public:
-	inline int num_features() const {
-		return num_features_;
+	const CompactNode* nodes_;
+	const float* leaves_;
+	const float* covers_;
+	std::vector<float> mean_values_;
+	unsigned int max_depth_;
+
+	float fill_mean_values(int32_t idx, unsigned int depth) {
+		const CompactNode& n = nodes_[idx];
+		max_depth_ = std::max(max_depth_, depth);
+		if (n.is_leaf())
+			return mean_values_[idx] = leaves_[~n.child];
+		const float left = fill_mean_values(n.child, depth + 1);
+		const float right = fill_mean_values(n.child + 1, depth + 1);
+		return mean_values_[idx] = (left * covers_[n.child] + right * covers_[n.child + 1]) / covers_[idx];
 	}
-	inline unsigned int num_trees() const {
-		return trees_.size();
+
+	static void extend_path(PathElement* path, unsigned int depth, float zero_fraction, float one_fraction,
+			int feature_index) {
+		path[depth].feature_index = feature_index;
+		path[depth].zero_fraction = zero_fraction;
+		path[depth].one_fraction = one_fraction;
+		path[depth].pweight = depth == 0 ? 1.0f : 0.0f;
+		for (int i = (int) depth - 1; i >= 0; --i) {
+			path[i + 1].pweight += one_fraction * path[i].pweight * (i + 1) / (float) (depth + 1);
+			path[i].pweight = zero_fraction * path[i].pweight * (depth - i) / (float) (depth + 1);
+		}
 	}
-	inline unsigned int num_nodes() const {
-		unsigned int n = 0;
-		for (unsigned int i = 0; i < trees_.size(); ++i) {
-			n += trees_[i].size();
+
+	static void unwind_path(PathElement* path, unsigned int depth, unsigned int path_index) {
+		const float one_fraction = path[path_index].one_fraction;
+		const float zero_fraction = path[path_index].zero_fraction;
+		float next_one_portion = path[depth].pweight;
+		for (int i = (int) depth - 1; i >= 0; --i) {
+			if (one_fraction != 0.0f) {
+				const float tmp = path[i].pweight;
+				path[i].pweight = next_one_portion * (depth + 1) / (float) ((i + 1) * one_fraction);
+				next_one_portion = tmp - path[i].pweight * zero_fraction * (depth - i) / (float) (depth + 1);
+			} else {
+				path[i].pweight = (path[i].pweight * (depth + 1)) / (float) (zero_fraction * (depth - i));
+			}
+		}
+		for (unsigned int i = path_index; i < depth; ++i) {
+			path[i].feature_index = path[i + 1].feature_index;
+			path[i].zero_fraction = path[i + 1].zero_fraction;
+			path[i].one_fraction = path[i + 1].one_fraction;
 		}
-		return n;
 	}
 
-	inline bool is_valid() const {
-		return !trees_.empty();
+	/**
+	 * 去掉 path_index 之后路径的权重之和（不修改路径）
+	 */
+	static float unwound_path_sum(const PathElement* path, unsigned int depth, unsigned int path_index) {
+		const float one_fraction = path[path_index].one_fraction;
+		const float zero_fraction = path[path_index].zero_fraction;
+		float next_one_portion = path[depth].pweight;
+		float total = 0.0f;
+		for (int i = (int) depth - 1; i >= 0; --i) {
+			if (one_fraction != 0.0f) {
+				const float tmp = next_one_portion * (depth + 1) / (float) ((i + 1) * one_fraction);
+				total += tmp;
+				next_one_portion = path[i].pweight - tmp * zero_fraction * ((depth - i) / (float) (depth + 1));
+			} else if (zero_fraction != 0.0f) {
+				total += (path[i].pweight / zero_fraction) / ((depth - i) / (float) (depth + 1));
+			}
+		}
+		return total;
 	}
 
-	string toString() const {
-		std::stringstream ss;
-		ss << "GBDT: num_features: " << num_features() << "; \tnum_trees: " << num_trees() << "; \tnum_nodes: "
-				<< num_nodes() << std::endl;
-		return ss.str();
+	void recurse(const float* fv, float missing, bool missing_is_nan, float* phi, int32_t idx,
+			PathElement* parent_path, unsigned int depth, float parent_zero_fraction, float parent_one_fraction,
+			int parent_feature_index) const {
+		// 每一层使用 parent_path 之后的一段新空间， 子节点的递归不会破坏当前层的路径
+		PathElement* path = parent_path + depth;
+		if (depth > 0)
+			std::copy(parent_path, parent_path + depth, path);
+		extend_path(path, depth, parent_zero_fraction, parent_one_fraction, parent_feature_index);
+
+		const CompactNode& n = nodes_[idx];
+		if (n.is_leaf()) {
+			const float value = leaves_[~n.child];
+			for (unsigned int i = 1; i <= depth; ++i) {
+				const float w = unwound_path_sum(path, depth, i);
+				phi[path[i].feature_index] += w * (path[i].one_fraction - path[i].zero_fraction) * value;
+			}
+			return;
+		}
+
+		const float x = fv[n.feature];
+		int32_t hot;
+		if ((missing_is_nan && std::isnan(x)) || x == missing) {
+			hot = n.missing_child();
+		} else {
+			hot = n.child + (x < n.threshold ? 0 : 1);
+		}
+		const int32_t cold = hot == n.child ? n.child + 1 : n.child;
+		const float w = covers_[idx];
+		const float hot_zero_fraction = covers_[hot] / w;
+		const float cold_zero_fraction = covers_[cold] / w;
+		float incoming_zero_fraction = 1.0f;
+		float incoming_one_fraction = 1.0f;
+
+		// 同一特征在路径上出现过时， 先将其从路径中去掉， 再与本节点合并
+		unsigned int path_index = 0;
+		for (; path_index <= depth; ++path_index) {
+			if (path[path_index].feature_index == (int) n.feature)
+				break;
+		}
+		if (path_index != depth + 1) {
+			incoming_zero_fraction = path[path_index].zero_fraction;
+			incoming_one_fraction = path[path_index].one_fraction;
+			unwind_path(path, depth, path_index);
+			depth -= 1;
+		}
+
+		recurse(fv, missing, missing_is_nan, phi, hot, path, depth + 1, hot_zero_fraction * incoming_zero_fraction,
+				incoming_one_fraction, n.feature);
+		recurse(fv, missing, missing_is_nan, phi, cold, path, depth + 1, cold_zero_fraction * incoming_zero_fraction,
+				0.0f, n.feature);
 	}
+};
 
-	GBDT_predictor() :
-			num_features_(-1) {
+/**
+ * GBDT_predictor::save_binary 生成的二进制模型文件的头部， 文件布局（各段起始位置均按64字节对齐）：
+ * header | uint64_t node_begin[num_trees + 1], uint64_t leaf_begin[num_trees + 1] | CompactNode[num_nodes] | float[num_leaves]
+ * 第 t 棵树的节点为 [node_begin[t], node_begin[t + 1])， 叶子为 [leaf_begin[t], leaf_begin[t + 1])；
+ * checksum 为 header 之后所有内容的校验和。 使用本机字节序， endian 字段用于检测不匹配的字节序。
+ * version 2 增加了 num_class 和 objective； version 1 的文件中这两个字段位于对齐填充中（全为0）， 按默认值处理。
+ * version 3 在 float[num_leaves] 之后增加了可选的 int32_t leaf_ids[num_leaves] 和 float covers[num_nodes]， 偏移为0表示没有。
+ * version 4 的 checksum 也包括 header（计算时 checksum 字段为0）， 之前的版本只校验 header 之后的内容
+ */
+struct GBDT_binary_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	int32_t num_features;
+	uint32_t num_trees;
+	uint64_t num_nodes;
+	uint64_t num_leaves;
+	uint64_t tree_table_offset;
+	uint64_t nodes_offset;
+	uint64_t leaves_offset;
+	uint64_t file_size;
+	uint64_t checksum;
+	int32_t num_class;
+	uint32_t reserved;
+	char objective[32];
+	uint64_t leaf_ids_offset;
+	uint64_t covers_offset;
+};
 
+/**
+ * 级联（early exit）预测的检查点： 累加完前 num_trees 棵树后， margin 小于 threshold 的行不再计算之后的树
+ */
+struct CascadeCheckpoint {
+	unsigned int num_trees;
+	float threshold;
+
+	CascadeCheckpoint(unsigned int num_trees = 0, float threshold = -INFINITY) :
+			num_trees(num_trees), threshold(threshold) {
 	}
+};
 
-	GBDT_predictor(const string& filename, bool verbose = false) :
-			num_features_(-1) {
-		std::string line;
-		std::ifstream infile(filename.c_str());
-		if (!infile) {
-			std::cout << "can not open gbdt model file: " << filename << std::endl;
-			return;
+/**
+ * 级联预测的统计， 由调用者传入并在多次调用间累加
+ */
+struct CascadeStats {
+	uint64_t rows;
+	uint64_t trees_evaluated;
+	uint64_t early_exits;
+
+	CascadeStats() :
+			rows(0), trees_evaluated(0), early_exits(0) {
+	}
+
+	inline double avg_trees() const {
+		return rows > 0 ? (double) trees_evaluated / rows : 0.0;
+	}
+};
+
+/**
+ * GBDT的预测引擎接口， 引擎只负责计算margin（各棵树叶子值之和， 多分类模型不使用引擎）， 需要保证const方法线程安全；
+ * 引擎通过 GBDT_predictor::register_engine 注册后， 可在加载模型时按名字选择
+ */
+class GBDT_engine {
+public:
+	virtual ~GBDT_engine() {
+	}
+	virtual std::string name() const = 0;
+	virtual void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing) const = 0;
+};
+
+class GBDT_predictor {
+public:
+	typedef std::function<std::shared_ptr<GBDT_engine>(const GBDT_predictor&)> EngineFactory;
+
+private:
+	std::vector<Tree> trees_;
+	int num_features_;
+	int num_class_; ///< 第 i 棵树属于第 i % num_class_ 类
+	string objective_;
+	int transform_; ///< objective_ 对应的 Transform
+	std::shared_ptr<GBDT_engine> engine_; ///< 为空时使用逐树遍历
+	std::shared_ptr<MappedFile> mapped_; ///< load_binary 时各棵树直接使用该文件中的节点
+	std::vector<CascadeCheckpoint> cascade_; ///< 按 num_trees 升序， 参见 set_cascade
+
+	unsigned int num_threads_; ///< predict_margin_batch 使用的线程数， 参见 set_num_threads
+	std::shared_ptr<ThreadPool> pool_; ///< num_threads_ > 1 时使用， 复制出的 GBDT_predictor 共享同一个线程池
+
+	unsigned int batch_row_block_; ///< predict_batch 中每个row block的行数
+	unsigned int batch_tree_block_bytes_; ///< predict_batch 中每个tree block的节点总字节数， 以保证一组树常驻 L1/L2
+
+	/**
+	 * 将 margin 变换为输出的方式， 由 objective 决定
+	 */
+	enum Transform {
+		TRANSFORM_IDENTITY, TRANSFORM_SIGMOID, TRANSFORM_EXP, TRANSFORM_SOFTMAX
+	};
+
+	static int objective_transform(const string& objective, int num_class) {
+		if (objective == "binary:logistic" || objective == "reg:logistic")
+			return TRANSFORM_SIGMOID;
+		if (objective == "multi:softprob" || objective == "multi:softmax") {
+			if (num_class < 2)
+				throw std::string("num_class should be >= 2 for objective ") + objective;
+			return TRANSFORM_SOFTMAX;
 		}
-//		// omit first line
-//		std::getline(infile, line);
-		Tree tree;
-		while (std::getline(infile, line)) {
-			if (line.find("booster[") != std::string::npos) { //e.g. "booster[0]:"
+		if (num_class != 1)
+			throw std::string("num_class should be 1 for objective ") + objective;
+		if (objective == "reg:squarederror" || objective == "reg:linear" || objective == "binary:logitraw"
+				|| objective == "rank:pairwise" || objective == "rank:ndcg" || objective == "rank:map")
+			return TRANSFORM_IDENTITY;
+		if (objective == "count:poisson" || objective == "reg:gamma" || objective == "reg:tweedie")
+			return TRANSFORM_EXP;
+		throw std::string("unsupported gbdt objective: ") + objective;
+	}
 
-				if (tree.size() > 0u) {
-					if (verbose)
-						std::cout << "current tree size: " << tree.size() << std::endl;
+	inline void check_single_output() const {
+		if (num_class_ != 1)
+			throw std::string("multi-class gbdt model, use predict_batch instead");
+	}
 
-					trees_.emplace_back(tree);
-					if (verbose)
-						std::cout << "num_trees: " << trees_.size() << std::endl;
-				} else {
-					if (verbose)
-						std::cout << "new tree: " << line << std::endl;
-					tree = Tree();
-				}
-			} else {
-				int split_feature = tree.add_line(line);
-				if (split_feature > num_features_)
-					num_features_ = split_feature;
+	static inline size_t binary_header_size(uint32_t version) {
+		if (version == 1)
+			return offsetof(GBDT_binary_header, num_class);
+		if (version == 2)
+			return offsetof(GBDT_binary_header, leaf_ids_offset);
+		return sizeof(GBDT_binary_header);
+	}
+
+	/**
+	 * 检查一棵树的紧凑节点的下标都在范围内： 内部节点的孩子在自身之后（保证遍历会结束）， 叶子的下标小于 num_leaves
+	 */
+	static bool valid_compact_nodes(const CompactNode* nodes, uint64_t num_nodes, uint64_t num_leaves,
+			int num_features) {
+		for (uint64_t i = 0; i < num_nodes; ++i) {
+			const CompactNode& n = nodes[i];
+			if (n.is_leaf()) {
+				if ((uint64_t) ~n.child >= num_leaves)
+					return false;
+			} else if ((uint64_t) n.child <= i || (uint64_t) n.child + 1 >= num_nodes
+					|| (num_features >= 0 && n.feature >= num_features)) {
+				return false;
 			}
 		}
-		if (tree.size() > 0u) {
-//			std::cout << "current tree size: " << tree.size() << std::endl;
-			trees_.emplace_back(tree);
-//			std::cout << "num_trees: " << trees_.size() << std::endl;
-		}
-		if (num_features_ >= 0)
-			num_features_ += 1;
+		return true;
 	}
 
-	float predict(std::vector<float> &fv, float missing = NAN) const {
-		float score = 0.0f;
-		for (unsigned int i = 0; i < trees_.size(); ++i) {
-			score += trees_[i].predict(fv, missing);
+	/**
+	 * version 4 起 checksum 包括 header， 计算时 header 中的 checksum 字段为0
+	 */
+	static uint64_t binary_file_checksum(const GBDT_binary_header& header, size_t header_size, const char* payload,
+			size_t payload_size) {
+		uint64_t h = 0;
+		if (header.version >= 4) {
+			GBDT_binary_header copy = header;
+			copy.checksum = 0;
+			h = binary_checksum((const char*) &copy, header_size);
 		}
-//		return score;
-		return 1.0f / (1.0f + std::exp(-score));
+		return binary_checksum(payload, payload_size, h);
 	}
 
-	inline float predict_no_missing_value(std::vector<float> &fv) const {
-		float score = 0.0f;
-		for (unsigned int i = 0; i < trees_.size(); ++i) {
-			score += trees_[i].predict_no_missing_value(fv);
+	static inline uint64_t align_binary_offset(uint64_t offset) {
+		return (offset + 63u) / 64u * 64u;
+	}
+
+	static const size_t SPARSE_SCRATCH_FLOATS = 1 << 18; ///< 稀疏预测时每个线程的稠密缓冲上限（1MB）
+
+	/**
+	 * 稀疏预测使用的线程局部稠密缓冲， 除正在预测的行之外所有元素都等于 fill；
+	 * missing 改变时才需要整体重新填充
+	 */
+	struct SparseScratch {
+		std::vector<float> data;
+		float fill;
+
+		SparseScratch() :
+				fill(NAN) {
+		}
+
+		void prepare(size_t size, float missing) {
+			if (std::memcmp(&fill, &missing, sizeof(float)) != 0) {
+				fill = missing;
+				std::fill(data.begin(), data.end(), fill);
+			}
+			if (data.size() < size)
+				data.resize(size, fill);
+		}
+	};
+
+	static SparseScratch& sparse_scratch() {
+		static thread_local SparseScratch scratch;
+		return scratch;
+	}
+
+	/**
+	 * 逐行解析 [p, pend) 中一棵树的所有节点（空行跳过）， 返回最大的分裂特征
+	 */
+	static int parse_tree(const char* p, const char* pend, Tree& tree) {
+		int max_feature = -1;
+		while (p < pend) {
+			const char* eol = std::find(p, pend, '\n');
+			const char* end = eol;
+			while (end > p && (end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+				--end;
+			if (end > p)
+				max_feature = std::max(max_feature, tree.add_line(p, end - p));
+			p = eol + 1;
+		}
+		return max_feature;
+	}
+
+	static const size_t PARALLEL_MIN_TREE_EVALS = 1 << 14; ///< 小于该计算量（行数×树数）时不值得多线程
+
+	/**
+	 * 单线程计算 [t_begin, t_end) 这些树的 margin 之和， 按 tree block × row block 的顺序遍历， out 为 n_rows * num_class_
+	 */
+	void predict_margin_trees(const float* rows, size_t n_rows, size_t stride, float* out, float missing,
+			unsigned int t_begin, unsigned int t_stop) const {
+		const size_t K = num_class_;
+		std::fill(out, out + n_rows * K, 0.0f);
+		while (t_begin < t_stop) {
+			const unsigned int t_end = std::min(next_tree_block_end(t_begin), t_stop);
+			for (size_t r_begin = 0; r_begin < n_rows; r_begin += batch_row_block_) {
+				const size_t r_end = std::min(n_rows, r_begin + batch_row_block_);
+				for (unsigned int t = t_begin; t < t_end; ++t) {
+					const Tree& tree = trees_[t];
+					float* class_out = out + t % K;
+					for (size_t r = r_begin; r < r_end; ++r) {
+						class_out[r * K] += tree.predict(rows + r * stride, missing);
+					}
+				}
+			}
+			t_begin = t_end;
+		}
+	}
+
+	/**
+	 * 单线程的 predict_margin_batch
+	 */
+	void predict_margin_rows(const float* rows, size_t n_rows, size_t stride, float* out, float missing) const {
+		if (engine_ && num_class_ == 1)
+			engine_->predict_margin_batch(rows, n_rows, stride, out, missing);
+		else
+			predict_margin_trees(rows, n_rows, stride, out, missing, 0, trees_.size());
+	}
+
+	inline unsigned int next_tree_block_end(unsigned int begin) const {
+		unsigned int end = begin;
+		unsigned long long bytes = 0;
+		while (end < trees_.size()) {
+			bytes += trees_[end].memory_bytes();
+			if (bytes > batch_tree_block_bytes_ && end > begin)
+				break;
+			++end;
+		}
+		return end;
+	}
+public:
+	inline int num_features() const {
+		return num_features_;
+	}
+	inline unsigned int num_trees() const {
+		return trees_.size();
+	}
+	inline unsigned int num_nodes() const {
+		unsigned int n = 0;
+		for (unsigned int i = 0; i < trees_.size(); ++i) {
+			n += trees_[i].size();
+		}
+		return n;
+	}
+
+	inline bool is_valid() const {
+		return !trees_.empty();
+	}
+
+	string toString() const {
+		std::stringstream ss;
+		ss << "GBDT: num_features: " << num_features() << "; \tnum_trees: " << num_trees() << "; \tnum_nodes: "
+				<< num_nodes() << std::endl;
+		return ss.str();
+	}
+
+	GBDT_predictor() :
+			num_features_(-1), num_class_(1), objective_("binary:logistic"), transform_(TRANSFORM_SIGMOID), num_threads_(
+					1), batch_row_block_(64), batch_tree_block_bytes_(256 * 1024) {
+
+	}
+
+	/**
+	 * @param filename xgboost的text dump
+	 * @param verbose
+	 * @param engine 预测引擎的名字， 为空时逐树遍历， 参见 set_engine
+	 */
+	GBDT_predictor(const string& filename, bool verbose = false, const string& engine = "") :
+			num_features_(-1), num_class_(1), objective_("binary:logistic"), transform_(TRANSFORM_SIGMOID), num_threads_(
+					1), batch_row_block_(64), batch_tree_block_bytes_(256 * 1024) {
+		std::ifstream infile(filename.c_str());
+		if (!infile) {
+			std::cout << "can not open gbdt model file: " << filename << std::endl;
+			return;
+		}
+		if (is_binary_model(filename)) {
+			infile.close();
+			load_binary(filename);
+		} else {
+			load(infile, verbose);
+		}
+		set_engine(engine);
+	}
+
+	/**
+	 * 从xgboost的text dump中读取模型， 如 booster.dump_model(filename)的输出
+	 */
+	GBDT_predictor(std::istream& in, bool verbose = false, const string& engine = "") :
+			num_features_(-1), num_class_(1), objective_("binary:logistic"), transform_(TRANSFORM_SIGMOID), num_threads_(
+					1), batch_row_block_(64), batch_tree_block_bytes_(256 * 1024) {
+		load(in, verbose);
+		set_engine(engine);
+	}
+
+	inline const std::vector<Tree>& trees() const {
+		return trees_;
+	}
+
+	static const uint32_t BINARY_VERSION = 4;
+
+	static const char* binary_magic() {
+		return "LCGBDT\0\0";
+	}
+
+	static bool is_binary_model(const string& filename) {
+		std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+		char magic[8];
+		return in.read(magic, 8) && std::memcmp(magic, binary_magic(), 8) == 0;
+	}
+
+	/**
+	 * @param h 之前内容的校验和， 用于分段计算
+	 */
+	static uint64_t binary_checksum(const char* p, size_t n, uint64_t h = 0) {
+		const size_t chunk = 1u << 20; // MurmurHash3 的长度参数为int， 分块计算
+		for (size_t off = 0; off < n; off += chunk) {
+			uint64_t out[2];
+			LC::Murmur3::MurmurHash3_x64_128(p + off, (int) std::min(chunk, n - off), (uint32_t) h, out);
+			h = out[0] ^ (h << 1 | h >> 63);
+		}
+		return h;
+	}
+
+	/**
+	 * 保存为带版本号和校验和的二进制格式（见 GBDT_binary_header）， 之后可以用 load_binary 零解析、零拷贝地加载
+	 */
+	void save_binary(const string& filename) const {
+		std::vector<Tree> trees = trees_;
+		std::vector<uint64_t> node_begin(1, 0), leaf_begin(1, 0);
+		bool has_leaf_ids = true, has_covers = true;
+		for (unsigned int t = 0; t < trees.size(); ++t) {
+			if (!trees[t].is_compiled() && !trees[t].compile())
+				throw std::string("can not compile tree for binary model: ") + LC::Str::num2str(t);
+			node_begin.push_back(node_begin.back() + trees[t].num_compact_nodes());
+			leaf_begin.push_back(leaf_begin.back() + trees[t].num_leaves());
+			has_leaf_ids &= trees[t].leaf_node_ids() != NULL;
+			has_covers &= trees[t].covers() != NULL;
+		}
+
+		GBDT_binary_header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(header.magic, binary_magic(), 8);
+		header.version = BINARY_VERSION;
+		header.endian = 0x01020304u;
+		header.num_features = num_features_;
+		header.num_class = num_class_;
+		if (objective_.size() >= sizeof(header.objective))
+			throw std::string("objective too long for binary model: ") + objective_;
+		std::memcpy(header.objective, objective_.data(), objective_.size());
+		header.num_trees = trees.size();
+		header.num_nodes = node_begin.back();
+		header.num_leaves = leaf_begin.back();
+		header.tree_table_offset = align_binary_offset(sizeof(header));
+		header.nodes_offset = align_binary_offset(header.tree_table_offset + 2 * node_begin.size() * sizeof(uint64_t));
+		header.leaves_offset = align_binary_offset(header.nodes_offset + header.num_nodes * sizeof(CompactNode));
+		header.file_size = header.leaves_offset + header.num_leaves * sizeof(float);
+		if (has_leaf_ids) {
+			header.leaf_ids_offset = align_binary_offset(header.file_size);
+			header.file_size = header.leaf_ids_offset + header.num_leaves * sizeof(int32_t);
+		}
+		if (has_covers) {
+			header.covers_offset = align_binary_offset(header.file_size);
+			header.file_size = header.covers_offset + header.num_nodes * sizeof(float);
+		}
+
+		std::string payload(header.file_size - sizeof(header), '\0');
+		char* base = &payload[0] - sizeof(header);
+		std::memcpy(base + header.tree_table_offset, node_begin.data(), node_begin.size() * sizeof(uint64_t));
+		std::memcpy(base + header.tree_table_offset + node_begin.size() * sizeof(uint64_t), leaf_begin.data(),
+				leaf_begin.size() * sizeof(uint64_t));
+		for (unsigned int t = 0; t < trees.size(); ++t) {
+			std::memcpy(base + header.nodes_offset + node_begin[t] * sizeof(CompactNode), trees[t].compact_nodes(),
+					trees[t].num_compact_nodes() * sizeof(CompactNode));
+			std::memcpy(base + header.leaves_offset + leaf_begin[t] * sizeof(float), trees[t].leaf_values(),
+					trees[t].num_leaves() * sizeof(float));
+			if (has_leaf_ids)
+				std::memcpy(base + header.leaf_ids_offset + leaf_begin[t] * sizeof(int32_t), trees[t].leaf_node_ids(),
+						trees[t].num_leaves() * sizeof(int32_t));
+			if (has_covers)
+				std::memcpy(base + header.covers_offset + node_begin[t] * sizeof(float), trees[t].covers(),
+						trees[t].num_compact_nodes() * sizeof(float));
+		}
+		header.checksum = binary_file_checksum(header, sizeof(header), payload.data(), payload.size());
+
+		LC::BinaryFileIO bf(filename.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+		bf.writeBinaryNumbers((const char*) &header, sizeof(header));
+		bf.writeBinaryNumbers(payload.data(), payload.size());
+		if (!bf)
+			throw std::string("fail to write binary gbdt model: ") + filename;
+	}
+
+	/**
+	 * mmap save_binary 生成的文件并直接使用其中的节点， 不做解析也不复制；
+	 * 同一台机器上加载同一个文件的多个进程共享相同的物理页
+	 * @param filename
+	 * @param verify_checksum 为true时校验整个文件（会读入所有页）， 否则只检查节点的下标（会读入节点所在的页）
+	 * @param populate 预先读入所有页， 参见 MappedFile
+	 */
+	void load_binary(const string& filename, bool verify_checksum = true, bool populate = false) {
+		std::shared_ptr<MappedFile> mapped = std::make_shared<MappedFile>(filename, populate);
+		if (mapped->size() < binary_header_size(1))
+			throw std::string("invalid binary gbdt model (too small): ") + filename;
+		const GBDT_binary_header& stored = *mapped->at<GBDT_binary_header>(0);
+		if (std::memcmp(stored.magic, binary_magic(), 8) != 0)
+			throw std::string("invalid binary gbdt model (magic): ") + filename;
+		if (stored.version < 1 || stored.version > BINARY_VERSION)
+			throw std::string("unsupported binary gbdt model version: ") + LC::Str::num2str((int) stored.version);
+		if (stored.endian != 0x01020304u)
+			throw std::string("binary gbdt model has different endianness: ") + filename;
+		// 旧版本的 header 较短， 之后的字段按0处理
+		const size_t header_size = binary_header_size(stored.version);
+		if (mapped->size() < header_size)
+			throw std::string("invalid binary gbdt model (too small): ") + filename;
+		GBDT_binary_header header;
+		std::memset(&header, 0, sizeof(header));
+		std::memcpy(&header, &stored, header_size);
+		if (header.file_size != mapped->size() || header.tree_table_offset < header_size
+				|| header.tree_table_offset + 2 * (header.num_trees + 1ull) * sizeof(uint64_t) > header.nodes_offset
+				|| header.nodes_offset + header.num_nodes * sizeof(CompactNode) > header.leaves_offset
+				|| header.leaves_offset + header.num_leaves * sizeof(float) > header.file_size
+				|| (header.leaf_ids_offset != 0
+						&& (header.leaf_ids_offset < header.leaves_offset
+								|| header.leaf_ids_offset + header.num_leaves * sizeof(int32_t) > header.file_size))
+				|| (header.covers_offset != 0
+						&& (header.covers_offset < header.leaves_offset
+								|| header.covers_offset + header.num_nodes * sizeof(float) > header.file_size)))
+			throw std::string("invalid binary gbdt model (layout): ") + filename;
+		if (verify_checksum
+				&& binary_file_checksum(header, header_size, mapped->data() + header_size,
+						mapped->size() - header_size) != header.checksum)
+			throw std::string("invalid binary gbdt model (checksum): ") + filename;
+
+		const uint64_t* node_begin = mapped->at<uint64_t>(header.tree_table_offset);
+		const uint64_t* leaf_begin = node_begin + header.num_trees + 1;
+		const CompactNode* nodes = mapped->at<CompactNode>(header.nodes_offset);
+		const float* leaves = mapped->at<float>(header.leaves_offset);
+		const int32_t* leaf_ids = header.leaf_ids_offset != 0 ? mapped->at<int32_t>(header.leaf_ids_offset) : NULL;
+		const float* covers = header.covers_offset != 0 ? mapped->at<float>(header.covers_offset) : NULL;
+		std::vector<Tree> trees(header.num_trees);
+		for (unsigned int t = 0; t < header.num_trees; ++t) {
+			if (node_begin[t] > node_begin[t + 1] || node_begin[t + 1] > header.num_nodes
+					|| leaf_begin[t] > leaf_begin[t + 1] || leaf_begin[t + 1] > header.num_leaves)
+				throw std::string("invalid binary gbdt model (tree table): ") + filename;
+			if (!verify_checksum
+					&& !valid_compact_nodes(nodes + node_begin[t], node_begin[t + 1] - node_begin[t],
+							leaf_begin[t + 1] - leaf_begin[t], header.num_features))
+				throw std::string("invalid binary gbdt model (nodes): ") + filename;
+			trees[t].bind_external(nodes + node_begin[t], node_begin[t + 1] - node_begin[t], leaves + leaf_begin[t],
+					leaf_begin[t + 1] - leaf_begin[t], leaf_ids != NULL ? leaf_ids + leaf_begin[t] : NULL,
+					covers != NULL ? covers + node_begin[t] : NULL);
+		}
+		if (header.num_class > 0 && header.objective[0] != '\0')
+			set_objective(string(header.objective, strnlen(header.objective, sizeof(header.objective))),
+					header.num_class);
+		trees_.swap(trees);
+		num_features_ = header.num_features;
+		mapped_ = mapped;
+		engine_.reset();
+		cascade_.clear(); // 阈值是按之前的模型标定的
+	}
+
+	static std::map<string, EngineFactory>& engine_factories() {
+		static std::map<string, EngineFactory> factories;
+		return factories;
+	}
+
+	/**
+	 * 注册预测引擎， 一般在引擎的头文件中完成， 如 QuickScorer.hpp 注册了 "quickscorer"
+	 */
+	static bool register_engine(const string& name, EngineFactory factory) {
+		engine_factories()[name] = factory;
+		return true;
+	}
+
+	/**
+	 * 按名字选择预测引擎， "" 或 "traversal" 表示逐树遍历（默认）
+	 */
+	void set_engine(const string& name) {
+		if (name.empty() || name == "traversal") {
+			engine_.reset();
+			return;
+		}
+		std::map<string, EngineFactory>::iterator it = engine_factories().find(name);
+		if (it == engine_factories().end())
+			throw std::string("unregistered GBDT engine: ") + name;
+		engine_ = it->second(*this);
+	}
+
+	inline void set_engine(std::shared_ptr<GBDT_engine> engine) {
+		engine_ = engine;
+	}
+
+	inline string engine_name() const {
+		return engine_ ? engine_->name() : string("traversal");
+	}
+
+	/**
+	 * 解析xgboost的text dump。 整个文件读入内存后按 "booster[" 所在的行切分为各棵树，
+	 * 由多个线程并行解析（每棵树互不依赖）， 最后按原顺序拼接， 结果与单线程解析完全相同
+	 * 与 load_binary 相同， 会替换之前加载的模型， 并清除已设置的引擎（引擎中是旧模型的树）和级联的检查点
+	 * @param num_threads 为0时使用 ThreadPool::default_num_threads()； 文件较小时总是单线程
+	 */
+	void load(std::istream& infile, bool verbose = false, unsigned int num_threads = 0) {
+		trees_.clear();
+		num_features_ = -1;
+		mapped_.reset();
+		engine_.reset();
+		cascade_.clear();
+		std::string text((std::istreambuf_iterator<char>(infile)), std::istreambuf_iterator<char>());
+
+		// 每个segment为 [begin, end)， 从 "booster[" 所在行的下一行开始（第一个segment从文件开头开始）
+		std::vector<std::pair<size_t, size_t> > segments;
+		size_t seg_begin = 0;
+		for (size_t pos = text.find("booster["); pos != std::string::npos; pos = text.find("booster[", pos)) {
+			const size_t prev_eol = text.rfind('\n', pos);
+			const size_t line_begin = prev_eol == std::string::npos ? 0 : prev_eol + 1;
+			size_t line_end = text.find('\n', pos);
+			line_end = line_end == std::string::npos ? text.size() : line_end + 1;
+			segments.push_back(std::make_pair(seg_begin, std::max(seg_begin, line_begin)));
+			if (verbose)
+				std::cout << "new tree: " << text.substr(line_begin, line_end - line_begin);
+			seg_begin = line_end;
+			pos = line_end;
+		}
+		segments.push_back(std::make_pair(seg_begin, text.size()));
+
+		std::vector<Tree> trees(segments.size());
+		std::vector<int> max_feature(segments.size(), -1);
+		std::vector<std::string> errors(segments.size());
+		std::function<void(size_t, size_t)> parse = [&](size_t b, size_t e) {
+			for (size_t i = b; i < e; ++i) {
+				try {
+					max_feature[i] = parse_tree(text.data() + segments[i].first, text.data() + segments[i].second,
+							trees[i]);
+				} catch (const std::string& err) {
+					errors[i] = err;
+				}
+			}
+		};
+
+		static const size_t MIN_BYTES_PER_THREAD = 1 << 20;
+		if (num_threads == 0)
+			num_threads = ThreadPool::default_num_threads();
+		num_threads = std::min<size_t>(num_threads, text.size() / MIN_BYTES_PER_THREAD);
+		if (num_threads <= 1 || segments.size() < 2) {
+			parse(0, segments.size());
+		} else {
+			ThreadPool pool(num_threads);
+			pool.parallel_for(0, segments.size(), parse, 1, num_threads * 4);
+		}
+
+		for (size_t i = 0; i < segments.size(); ++i) {
+			if (!errors[i].empty())
+				throw errors[i];
+			if (max_feature[i] > num_features_)
+				num_features_ = max_feature[i];
+			if (trees[i].size() > 0u) {
+				if (verbose)
+					std::cout << "current tree size: " << trees[i].size() << std::endl;
+				trees_.push_back(trees[i]);
+			}
+		}
+		if (verbose)
+			std::cout << "num_trees: " << trees_.size() << std::endl;
+		if (num_features_ >= 0)
+			num_features_ += 1;
+	}
+
+	/**
+	 * 单个输出的模型（num_class() == 1）的预测， 按 objective 变换 margin（默认 binary:logistic， 即sigmoid）；
+	 * 多分类模型请使用 predict_batch
+	 */
+	float predict(std::vector<float> &fv, float missing = NAN) const {
+		check_single_output();
+		float score = 0.0f;
+		if (engine_) {
+			engine_->predict_margin_batch(fv.data(), 1, fv.size(), &score, missing);
+		} else {
+			for (unsigned int i = 0; i < trees_.size(); ++i) {
+				score += trees_[i].predict(fv, missing);
+			}
 		}
-		return 1.0f / (1.0f + std::exp(-score));
 //		return score;
+		return transform_margin(score);
+	}
+
+	/**
+	 * 调用者需保证 fv 中没有 missing value， 此时与 predict(fv) 的结果相同。
+	 * 输入中有 NAN 时结果与是否设置引擎有关： 逐树遍历时 NAN 走 yes 分支（见 Tree::predict_no_missing_value），
+	 * 设置了引擎时按 missing=NAN 计算， 走树的 missing 分支； 可能有 NAN 时请使用 predict
+	 */
+	inline float predict_no_missing_value(std::vector<float> &fv) const {
+		check_single_output();
+		float score = 0.0f;
+		if (engine_) {
+			engine_->predict_margin_batch(fv.data(), 1, fv.size(), &score, NAN);
+		} else {
+			for (unsigned int i = 0; i < trees_.size(); ++i) {
+				score += trees_[i].predict_no_missing_value(fv);
+			}
+		}
+		return transform_margin(score);
+//		return score;
+	}
+
+	inline int num_class() const {
+		return num_class_;
+	}
+
+	inline const string& objective() const {
+		return objective_;
+	}
+
+	/**
+	 * 设置模型的 objective 和类别数（xgboost 的 text dump 中没有这两项）， 决定 predict 系列函数对 margin 的变换：
+	 * binary:logistic, reg:logistic -> sigmoid； multi:softprob, multi:softmax -> 每行 num_class 个概率的 softmax
+	 * （multi:softmax 同样输出概率， 取 argmax 由调用者完成）；
+	 * reg:squarederror, reg:linear, binary:logitraw, rank:* -> 原样输出； count:poisson, reg:gamma, reg:tweedie -> exp。
+	 * 多分类时第 i 棵树属于第 i % num_class 类， 所有类的 margin 在同一次遍历中累加
+	 */
+	void set_objective(const string& objective, int num_class = 1) {
+		transform_ = objective_transform(objective, num_class);
+		objective_ = objective;
+		num_class_ = num_class;
+	}
+
+	/**
+	 * 单个输出的模型按 objective 变换一个 margin， 如 CompiledModel::predict_margin 的结果
+	 */
+	inline float transform_margin(float margin) const {
+		switch (transform_) {
+		case TRANSFORM_SIGMOID:
+			return 1.0f / (1.0f + std::exp(-margin));
+		case TRANSFORM_EXP:
+			return std::exp(margin);
+		default:
+			return margin;
+		}
+	}
+
+	/**
+	 * 对 n_rows 行、 每行 num_class() 个连续存储的 margin 原地做 objective 对应的变换
+	 */
+	void transform_batch(float* margins, size_t n_rows) const {
+		const size_t n = n_rows * num_class_;
+		switch (transform_) {
+		case TRANSFORM_SIGMOID:
+			for (size_t i = 0; i < n; ++i)
+				margins[i] = 1.0f / (1.0f + std::exp(-margins[i]));
+			break;
+		case TRANSFORM_EXP:
+			for (size_t i = 0; i < n; ++i)
+				margins[i] = std::exp(margins[i]);
+			break;
+		case TRANSFORM_SOFTMAX:
+			for (size_t r = 0; r < n_rows; ++r) {
+				float* m = margins + r * num_class_;
+				const float max_margin = *std::max_element(m, m + num_class_);
+				float sum = 0.0f;
+				for (int k = 0; k < num_class_; ++k) {
+					m[k] = std::exp(m[k] - max_margin);
+					sum += m[k];
+				}
+				const float inv_sum = 1.0f / sum;
+				for (int k = 0; k < num_class_; ++k)
+					m[k] *= inv_sum;
+			}
+			break;
+		default:
+			break;
+		}
+	}
+
+	/**
+	 * 将所有树编译为 CompactNode 布局， 参见 Tree::compile()
+	 * @return 成功编译的树的个数
+	 */
+	unsigned int compile() {
+		unsigned int n = 0;
+		for (unsigned int i = 0; i < trees_.size(); ++i) {
+			n += trees_[i].compile() ? 1u : 0u;
+		}
+		return n;
+	}
+
+	inline bool is_compiled() const {
+		for (unsigned int i = 0; i < trees_.size(); ++i) {
+			if (!trees_[i].is_compiled())
+				return false;
+		}
+		return !trees_.empty();
+	}
+
+	/**
+	 * 设置批量预测时的分块大小：每次让 row_block 行依次经过一组节点总大小不超过 tree_block_bytes 的树，
+	 * 使这组树在处理这些行时一直留在 L1/L2 中
+	 */
+	void set_batch_block_size(unsigned int row_block, unsigned int tree_block_bytes) {
+		batch_row_block_ = row_block > 0u ? row_block : 1u;
+		batch_tree_block_bytes_ = tree_block_bytes;
+	}
+
+	/**
+	 * 设置 predict_margin_batch（以及基于它的 predict_batch 等）使用的线程数， 默认为1， 即在调用线程中计算；
+	 * 为0时使用 ThreadPool::default_num_threads()。 复制出的 GBDT_predictor 共享同一个线程池
+	 */
+	void set_num_threads(unsigned int num_threads) {
+		num_threads_ = num_threads > 0 ? num_threads : ThreadPool::default_num_threads();
+		pool_.reset();
+		if (num_threads_ > 1)
+			pool_ = std::make_shared<ThreadPool>(num_threads_);
+	}
+
+	inline unsigned int num_threads() const {
+		return num_threads_;
+	}
+
+	/**
+	 * 批量计算 margin（未经过 objective 变换的得分）， 按 tree block × row block 的顺序遍历；
+	 * 每一行的树的累加顺序与 predict 相同， 因此结果与逐行调用 predict 完全一致。
+	 * 多分类模型不使用引擎， 每行输出 num_class() 个 margin。
+	 * 设置了多线程（set_num_threads）时： 行数不少于 线程数 × row block 时按行切分；
+	 * 否则（没有引擎时）按树切分并归约， 以降低单个小批量请求的延迟， 此时与单线程的结果可能有最后几位的差别
+	 * @param rows 行优先存储的特征， 第 r 行从 rows + r * stride 开始
+	 * @param n_rows
+	 * @param stride 相邻两行之间的 float 个数， 不小于 num_features()
+	 * @param out 长度为 n_rows * num_class() 的输出， 第 r 行第 k 类为 out[r * num_class() + k]
+	 * @param missing
+	 */
+	void predict_margin_batch(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing = NAN) const {
+		const size_t K = num_class_;
+		if (!pool_ || n_rows * trees_.size() < PARALLEL_MIN_TREE_EVALS) {
+			predict_margin_rows(rows, n_rows, stride, out, missing);
+		} else if (n_rows >= (size_t) num_threads_ * batch_row_block_ || (engine_ && num_class_ == 1)) {
+			// 大批量： 按 row block 切分， 每个线程计算一段连续的行， 结果与单线程完全相同
+			pool_->parallel_for(0, n_rows, [&](size_t b, size_t e) {
+				predict_margin_rows(rows + b * stride, e - b, stride, out + b * K, missing);
+			}, batch_row_block_, num_threads_);
+		} else {
+			// 小批量： 按树切分， 每个线程计算一段连续的树的部分和， 最后按树的顺序归约（与单线程的结果可能有舍入误差）
+			const size_t num_chunks = std::min<size_t>(num_threads_, trees_.size());
+			std::vector<std::vector<float> > partial(num_chunks, std::vector<float>(n_rows * K));
+			pool_->parallel_for(0, num_chunks, [&](size_t b, size_t e) {
+				for (size_t c = b; c < e; ++c) {
+					predict_margin_trees(rows, n_rows, stride, partial[c].data(), missing,
+							trees_.size() * c / num_chunks, trees_.size() * (c + 1) / num_chunks);
+				}
+			}, 1, num_chunks);
+			std::copy(partial[0].begin(), partial[0].end(), out);
+			for (size_t c = 1; c < num_chunks; ++c) {
+				for (size_t i = 0; i < n_rows * K; ++i)
+					out[i] += partial[c][i];
+			}
+		}
+	}
+
+	/**
+	 * predict_margin_batch 之后按 objective 变换， 输出 n_rows * num_class() 个值
+	 */
+	void predict_batch(const float* rows, size_t n_rows, size_t stride, float* out, float missing = NAN) const {
+		predict_margin_batch(rows, n_rows, stride, out, missing);
+		transform_batch(out, n_rows);
+	}
+
+	/**
+	 * predict_batch 的无missing value版本， 参见 Tree::predict_no_missing_value；
+	 * 与 predict_no_missing_value 相同， rows 中有 NAN 时结果与是否设置引擎有关
+	 */
+	void predict_batch_no_missing_value(const float* rows, size_t n_rows, size_t stride, float* out) const {
+		if (engine_ || num_class_ != 1) {
+			predict_batch(rows, n_rows, stride, out);
+			return;
+		}
+		std::fill(out, out + n_rows, 0.0f);
+		for (unsigned int t_begin = 0; t_begin < trees_.size();) {
+			const unsigned int t_end = next_tree_block_end(t_begin);
+			for (size_t r_begin = 0; r_begin < n_rows; r_begin += batch_row_block_) {
+				const size_t r_end = std::min(n_rows, r_begin + batch_row_block_);
+				for (unsigned int t = t_begin; t < t_end; ++t) {
+					const Tree& tree = trees_[t];
+					for (size_t r = r_begin; r < r_end; ++r) {
+						out[r] += tree.predict_no_missing_value(rows + r * stride);
+					}
+				}
+			}
+			t_begin = t_end;
+		}
+		transform_batch(out, n_rows);
+	}
+
+	/**
+	 * 稀疏输入的 margin， 未出现的特征按 missing 处理（走 missing 分支）；
+	 * 不会为每次请求分配并填充 num_features() 长度的稠密向量， 而是使用线程局部的稠密缓冲，
+	 * 只写入并在预测后恢复出现过的特征， 因此与特征维度无关（index >= num_features() 的特征不会被任何树使用， 直接忽略）
+	 * @param indices 特征下标， 可以无序， 重复时以最后一个为准
+	 * @param values
+	 * @param nnz
+	 * @param missing
+	 */
+	float predict_margin_sparse(const int* indices, const float* values, size_t nnz, float missing = NAN) const {
+		check_single_output();
+		const size_t row_ptr[2] = { 0, nnz };
+		float margin;
+		predict_margin_batch_csr(row_ptr, indices, values, 1, &margin, missing);
+		return margin;
+	}
+
+	float predict_sparse(const std::vector<std::pair<int, float> >& fv, float missing = NAN) const {
+		check_single_output();
+		const size_t row_ptr[2] = { 0, fv.size() };
+		std::vector<int> indices(fv.size());
+		std::vector<float> values(fv.size());
+		for (unsigned int i = 0; i < fv.size(); ++i) {
+			indices[i] = fv[i].first;
+			values[i] = fv[i].second;
+		}
+		float score;
+		predict_batch_csr(row_ptr, indices.data(), values.data(), 1, &score, missing);
+		return score;
+	}
+
+	/**
+	 * CSR 格式的批量预测： 第 r 行的特征为 indices/values 的 [row_ptr[r], row_ptr[r + 1])， 输出与 predict_margin_batch 相同；
+	 * 每次将一组行展开到线程局部的稠密缓冲后调用 predict_margin_batch， 因此也会使用 set_engine 设置的引擎
+	 */
+	void predict_margin_batch_csr(const size_t* row_ptr, const int* indices, const float* values, size_t n_rows,
+			float* out, float missing = NAN) const {
+		const size_t stride = std::max(num_features_, 1);
+		const size_t block = std::max<size_t>(1, std::min<size_t>(batch_row_block_, SPARSE_SCRATCH_FLOATS / stride));
+		SparseScratch& scratch = sparse_scratch();
+		scratch.prepare(block * stride, missing);
+		float* dense = scratch.data.data();
+		for (size_t r_begin = 0; r_begin < n_rows; r_begin += block) {
+			const size_t r_end = std::min(n_rows, r_begin + block);
+			for (size_t r = r_begin; r < r_end; ++r) {
+				float* row = dense + (r - r_begin) * stride;
+				for (size_t i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+					if (indices[i] >= 0 && (size_t) indices[i] < stride)
+						row[indices[i]] = values[i];
+				}
+			}
+			predict_margin_batch(dense, r_end - r_begin, stride, out + r_begin * num_class_, missing);
+			for (size_t r = r_begin; r < r_end; ++r) {
+				float* row = dense + (r - r_begin) * stride;
+				for (size_t i = row_ptr[r]; i < row_ptr[r + 1]; ++i) {
+					if (indices[i] >= 0 && (size_t) indices[i] < stride)
+						row[indices[i]] = scratch.fill;
+				}
+			}
+		}
+	}
+
+	void predict_batch_csr(const size_t* row_ptr, const int* indices, const float* values, size_t n_rows, float* out,
+			float missing = NAN) const {
+		predict_margin_batch_csr(row_ptr, indices, values, n_rows, out, missing);
+		transform_batch(out, n_rows);
+	}
+
+	/**
+	 * 设置级联预测的检查点（按 num_trees 严格升序）， 只影响 predict_cascade 系列函数
+	 */
+	void set_cascade(const std::vector<CascadeCheckpoint>& checkpoints) {
+		for (unsigned int i = 0; i < checkpoints.size(); ++i) {
+			if (checkpoints[i].num_trees > trees_.size()
+					|| (i > 0 && checkpoints[i].num_trees <= checkpoints[i - 1].num_trees))
+				throw std::string("invalid cascade checkpoint: ") + LC::Str::num2str(checkpoints[i].num_trees);
+		}
+		cascade_ = checkpoints;
+	}
+
+	inline const std::vector<CascadeCheckpoint>& cascade() const {
+		return cascade_;
+	}
+
+	/**
+	 * 单行的级联预测： 与 predict 相同的逐树累加， 在每个检查点处 margin 低于阈值时提前返回（已累加部分的变换结果）
+	 */
+	float predict_cascade(const std::vector<float>& fv, float missing = NAN, CascadeStats* stats = NULL) const {
+		check_single_output();
+		float score = 0.0f;
+		unsigned int t = 0;
+		for (unsigned int c = 0; c <= cascade_.size(); ++c) {
+			const unsigned int t_end = std::min<unsigned int>(c < cascade_.size() ? cascade_[c].num_trees : trees_.size(),
+					trees_.size());
+			for (; t < t_end; ++t) {
+				score += trees_[t].predict(fv.data(), missing);
+			}
+			if (c < cascade_.size() && score < cascade_[c].threshold) {
+				if (stats != NULL)
+					stats->early_exits++;
+				break;
+			}
+		}
+		if (stats != NULL) {
+			stats->rows++;
+			stats->trees_evaluated += t;
+		}
+		return transform_margin(score);
+	}
+
+	/**
+	 * 批量的级联预测： 在相邻两个检查点之间按 tree block × row block 累加仍然存活的行， 每个检查点处淘汰低于阈值的行；
+	 * 未被淘汰的行结果与 predict_margin_batch 完全相同， 被淘汰的行输出已累加部分的 margin。 不使用引擎
+	 */
+	void predict_margin_batch_cascade(const float* rows, size_t n_rows, size_t stride, float* out, float missing = NAN,
+			CascadeStats* stats = NULL) const {
+		check_single_output();
+		std::fill(out, out + n_rows, 0.0f);
+		std::vector<size_t> active(n_rows);
+		for (size_t r = 0; r < n_rows; ++r)
+			active[r] = r;
+		unsigned int t_begin = 0;
+		uint64_t trees_evaluated = 0;
+		for (unsigned int c = 0; c <= cascade_.size() && !active.empty(); ++c) {
+			const unsigned int t_stop = std::min<unsigned int>(
+					c < cascade_.size() ? cascade_[c].num_trees : trees_.size(), trees_.size());
+			while (t_begin < t_stop) {
+				const unsigned int t_end = std::min(next_tree_block_end(t_begin), t_stop);
+				for (size_t a_begin = 0; a_begin < active.size(); a_begin += batch_row_block_) {
+					const size_t a_end = std::min(active.size(), a_begin + batch_row_block_);
+					for (unsigned int t = t_begin; t < t_end; ++t) {
+						const Tree& tree = trees_[t];
+						for (size_t a = a_begin; a < a_end; ++a) {
+							out[active[a]] += tree.predict(rows + active[a] * stride, missing);
+						}
+					}
+				}
+				trees_evaluated += (uint64_t) (t_end - t_begin) * active.size();
+				t_begin = t_end;
+			}
+			if (c < cascade_.size()) {
+				const float threshold = cascade_[c].threshold;
+				size_t kept = 0;
+				for (size_t a = 0; a < active.size(); ++a) {
+					if (!(out[active[a]] < threshold))
+						active[kept++] = active[a];
+				}
+				if (stats != NULL)
+					stats->early_exits += active.size() - kept;
+				active.resize(kept);
+			}
+		}
+		if (stats != NULL) {
+			stats->rows += n_rows;
+			stats->trees_evaluated += trees_evaluated;
+		}
+	}
+
+	void predict_batch_cascade(const float* rows, size_t n_rows, size_t stride, float* out, float missing = NAN,
+			CascadeStats* stats = NULL) const {
+		predict_margin_batch_cascade(rows, n_rows, stride, out, missing, stats);
+		transform_batch(out, n_rows);
+	}
+
+	/**
+	 * 在样本上标定各检查点的阈值并设置为当前的级联：
+	 * 按全部树的 margin 取前 top_fraction 的行作为需要保留的行， 在样本上所有检查点合计最多误淘汰 miss_rate 比例的这些行
+	 * （miss_rate=0 时不误淘汰）： 误淘汰的名额平均分给各检查点， 每个检查点的阈值取前面的检查点之后仍然保留的这些行
+	 * 在该处的部分 margin 中第 k 小的值， k 为截至该检查点可用的名额
+	 * @param checkpoint_trees 检查点处已累加的树的个数， 严格升序
+	 */
+	void calibrate_cascade(const float* rows, size_t n_rows, size_t stride,
+			const std::vector<unsigned int>& checkpoint_trees, float top_fraction, float miss_rate = 0.0f,
+			float missing = NAN) {
+		check_single_output();
+		std::vector<CascadeCheckpoint> checkpoints;
+		for (unsigned int c = 0; c < checkpoint_trees.size(); ++c)
+			checkpoints.push_back(CascadeCheckpoint(checkpoint_trees[c]));
+		set_cascade(checkpoints); // 先检查参数
+		if (n_rows == 0)
+			return;
+
+		// partial[c][r]： 第 r 行在第 c 个检查点处的部分 margin， 最后一项为全部树的 margin
+		std::vector<std::vector<float> > partial(checkpoints.size() + 1, std::vector<float>(n_rows, 0.0f));
+		for (size_t r = 0; r < n_rows; ++r) {
+			float score = 0.0f;
+			unsigned int t = 0;
+			for (unsigned int c = 0; c <= checkpoints.size(); ++c) {
+				const unsigned int t_end = c < checkpoints.size() ? checkpoints[c].num_trees : trees_.size();
+				for (; t < t_end; ++t)
+					score += trees_[t].predict(rows + r * stride, missing);
+				partial[c][r] = score;
+			}
+		}
+
+		std::vector<size_t> order(n_rows);
+		for (size_t r = 0; r < n_rows; ++r)
+			order[r] = r;
+		const std::vector<float>& final_margin = partial.back();
+		std::sort(order.begin(), order.end(), [&final_margin](size_t a, size_t b) {
+			return final_margin[a] > final_margin[b];
+		});
+		const size_t num_top = std::max<size_t>(1,
+				std::min<size_t>(n_rows, (size_t) std::ceil(top_fraction * n_rows)));
+		const size_t budget = std::min<size_t>(num_top - 1, (size_t) (std::max(miss_rate, 0.0f) * num_top));
+		std::vector<size_t> alive(order.begin(), order.begin() + num_top); // 尚未被淘汰的需要保留的行
+		size_t used = 0;
+		for (unsigned int c = 0; c < checkpoints.size(); ++c) {
+			const size_t k = budget * (c + 1) / checkpoints.size() - used;
+			std::vector<float> top(alive.size());
+			for (size_t i = 0; i < alive.size(); ++i)
+				top[i] = partial[c][alive[i]];
+			std::nth_element(top.begin(), top.begin() + k, top.end());
+			const float threshold = top[k];
+			checkpoints[c].threshold = threshold;
+			size_t kept = 0;
+			for (size_t i = 0; i < alive.size(); ++i) {
+				if (!(partial[c][alive[i]] < threshold))
+					alive[kept++] = alive[i];
+			}
+			used += alive.size() - kept;
+			alive.resize(kept);
+		}
+		set_cascade(checkpoints);
+	}
+
+	/**
+	 * 从 libsvm 格式的样本文件（每行为 "label index:value index:value ..."， 未出现的特征为 missing）标定级联， 参见 calibrate_cascade
+	 */
+	void calibrate_cascade_from_file(const string& filename, const std::vector<unsigned int>& checkpoint_trees,
+			float top_fraction, float miss_rate = 0.0f, float missing = NAN) {
+		std::ifstream infile(filename.c_str());
+		if (!infile)
+			throw std::string("can not open cascade sample file: ") + filename;
+		const size_t stride = std::max(num_features_, 1);
+		std::vector<float> rows;
+		std::string line;
+		while (std::getline(infile, line)) {
+			std::vector<std::string> items = LC::Str::split(line, ' ');
+			if (items.size() < 2u)
+				continue;
+			rows.resize(rows.size() + stride, missing);
+			float* row = rows.data() + rows.size() - stride;
+			for (unsigned int i = 1; i < items.size(); ++i) {
+				std::vector<std::string> kv = LC::Str::split(items[i], ':');
+				if (kv.size() != 2u)
+					continue;
+				const int index = std::atoi(kv[0].c_str());
+				if (index >= 0 && (size_t) index < stride)
+					row[index] = (float) std::strtod(kv[1].c_str(), NULL);
+			}
+		}
+		calibrate_cascade(rows.data(), rows.size() / stride, stride, checkpoint_trees, top_fraction, miss_rate,
+				missing);
+	}
+
+	/**
+	 * profile-guided 的节点布局优化： 用一批有代表性的线上样本统计每棵树各分支的访问频率，
+	 * 按 Tree::reorder_by_profile 重排节点（热路径连续）并标记分支提示（CodeGen 会生成 __builtin_expect）；
+	 * 预测结果不变。 已设置的引擎不受影响， 需要时重新 set_engine
+	 */
+	void optimize_layout(const float* rows, size_t n_rows, size_t stride, float missing = NAN,
+			float hint_ratio = 0.8f) {
+		std::vector<uint64_t> counts;
+		for (unsigned int t = 0; t < trees_.size(); ++t) {
+			if (!trees_[t].compile())
+				continue;
+			counts.assign(trees_[t].num_compact_nodes(), 0);
+			trees_[t].profile_compact(rows, n_rows, stride, missing, counts);
+			trees_[t].reorder_by_profile(counts, hint_ratio);
+		}
+	}
+
+	/**
+	 * 每行预测平均访问的不同 cache line 数（所有树之和）， 用于比较 optimize_layout 前后的布局
+	 */
+	double avg_cache_lines_touched(const float* rows, size_t n_rows, size_t stride, float missing = NAN) const {
+		uint64_t lines = 0;
+		for (size_t r = 0; r < n_rows; ++r) {
+			for (unsigned int t = 0; t < trees_.size(); ++t)
+				lines += trees_[t].cache_lines_touched(rows + r * stride, missing);
+		}
+		return n_rows > 0 ? (double) lines / n_rows : 0.0;
+	}
+
+	/**
+	 * 批量计算每行在每棵树上落入的叶子（与 xgboost 的 pred_leaf 相同， 为 text dump 中的节点编号）， 供 GBDT+LR 等使用；
+	 * 使用编译后的紧凑布局和与 predict_margin_batch 相同的分块顺序
+	 * @param out 长度为 n_rows * num_trees() 的输出， 第 r 行第 t 棵树为 out[r * num_trees() + t]
+	 */
+	void predict_leaf_indices(const float* rows, size_t n_rows, size_t stride, int* out, float missing = NAN) const {
+		const size_t T = trees_.size();
+		for (unsigned int t_begin = 0; t_begin < trees_.size();) {
+			const unsigned int t_end = next_tree_block_end(t_begin);
+			for (size_t r_begin = 0; r_begin < n_rows; r_begin += batch_row_block_) {
+				const size_t r_end = std::min(n_rows, r_begin + batch_row_block_);
+				for (unsigned int t = t_begin; t < t_end; ++t) {
+					const Tree& tree = trees_[t];
+					for (size_t r = r_begin; r < r_end; ++r) {
+						out[r * T + t] = tree.predict_leaf_index(rows + r * stride, missing);
+					}
+				}
+			}
+			t_begin = t_end;
+		}
+	}
+
+	/**
+	 * 用 TreeSHAP（path-dependent， 参见 TreeSHAP）计算每个特征对 margin 的贡献， 需要 dump 时带有 cover（with_stats）。
+	 * 每行每类输出 num_features() + 1 个值， 最后一个为 bias（各棵树的期望输出之和）， 每行每类的和等于该类的 margin
+	 * @param out 长度为 n_rows * num_class() * (num_features() + 1) 的输出， 第 r 行第 k 类第 f 个特征为
+	 *        out[(r * num_class() + k) * (num_features() + 1) + f]
+	 */
+	void predict_contributions(const float* rows, size_t n_rows, size_t stride, float* out,
+			float missing = NAN) const {
+		const size_t F = std::max(num_features_, 0);
+		const size_t K = num_class_;
+		std::vector<Tree> compiled; // 未编译的树在此编译， TreeSHAP 只保存指针， 不能再扩容
+		compiled.reserve(trees_.size());
+		std::vector<TreeSHAP> shaps;
+		shaps.reserve(trees_.size());
+		for (unsigned int t = 0; t < trees_.size(); ++t) {
+			const Tree* tree = &trees_[t];
+			if (!tree->is_compiled()) {
+				compiled.push_back(*tree);
+				if (!compiled.back().compile())
+					throw std::string("TreeSHAP: can not compile tree ") + LC::Str::num2str(t);
+				tree = &compiled.back();
+			}
+			if (tree->covers() == NULL)
+				throw std::string("TreeSHAP: no cover in tree ") + LC::Str::num2str(t) + ", dump the model with_stats";
+			shaps.push_back(TreeSHAP(*tree));
+		}
+		std::fill(out, out + n_rows * K * (F + 1), 0.0f);
+		std::vector<TreeSHAP::PathElement> path;
+		for (size_t r = 0; r < n_rows; ++r) {
+			for (unsigned int t = 0; t < shaps.size(); ++t) {
+				float* phi = out + (r * K + t % K) * (F + 1);
+				shaps[t].contributions(rows + r * stride, missing, phi, path);
+				phi[F] += shaps[t].expected_value();
+			}
+		}
+	}
+
+	/**
+	 * 生成一个随机的xgboost text dump（满二叉树）， 用于benchmark和测试
+	 * @param with_stats 为true时与 xgboost dump_model(with_stats=True) 一样输出 gain 和 cover
+	 */
+	static string random_model_dump(int num_trees, int max_depth, int num_features, int seed = 0,
+			bool with_stats = false) {
+		LC::RandomUniform<int, float> rnd(seed);
+		LC::RandomUniform<int, float> rnd_stats(seed + 1); // 单独的随机数， with_stats 不影响树的结构和取值
+		rnd_stats.set_param_f(1.0f, 100.0f);
+		std::stringstream ss;
+		ss << std::setprecision(9);
+		const int num_internal = (1 << max_depth) - 1;
+		std::vector<float> cover(num_internal * 2 + 1);
+		for (int t = 0; t < num_trees; ++t) {
+			ss << "booster[" << t << "]:" << std::endl;
+			for (int id = num_internal * 2; id >= 0; --id)
+				cover[id] = id >= num_internal ? rnd_stats.randf() : cover[2 * id + 1] + cover[2 * id + 2];
+			for (int id = 0; id < num_internal * 2 + 1; ++id) {
+				int depth = 0;
+				while ((2 << depth) - 1 <= id)
+					++depth;
+				for (int i = 0; i < depth; ++i)
+					ss << '\t';
+				if (id < num_internal) {
+					rnd.set_param_i(0, num_features - 1);
+					int f = rnd.randi();
+					rnd.set_param_i(0, 1);
+					int yes = 2 * id + 1, no = 2 * id + 2;
+					rnd.set_param_f(0.0f, 1.0f);
+					ss << id << ":[f" << f << "<" << rnd.randf() << "] yes=" << yes << ",no=" << no << ",missing="
+							<< (rnd.randi() ? yes : no);
+					if (with_stats)
+						ss << ",gain=" << rnd_stats.randf() << ",cover=" << cover[id];
+					ss << std::endl;
+				} else {
+					rnd.set_param_f(-0.1f, 0.1f);
+					ss << id << ":leaf=" << rnd.randf();
+					if (with_stats)
+						ss << ",cover=" << cover[id];
+					ss << std::endl;
+				}
+			}
+		}
+		return ss.str();
+	}
+
+	/**
+	 * 比较逐行 predict 与 predict_batch 在随机模型上的吞吐（rows/sec）
+	 */
+	static void benchmark_predict_batch(int num_trees = 1000, int max_depth = 6, int num_features = 200,
+			int n_rows = 500, int repeat = 20) {
+		std::stringstream dump(random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		std::cout << "\n---benchmark LC::xgboost::GBDT_predictor::predict_batch" << std::endl;
+		std::cout << gbdt.toString();
+
+		LC::RandomUniform<int, float> rnd(1);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i)
+			rows[i] = rnd.randf();
+		std::vector<float> out_row(n_rows), out_batch(n_rows);
+
+		LC::TimerAccurate timer;
+		for (int k = 0; k < repeat; ++k) {
+			for (int r = 0; r < n_rows; ++r) {
+				std::vector<float> fv(rows.begin() + r * num_features, rows.begin() + (r + 1) * num_features);
+				out_row[r] = gbdt.predict(fv);
+			}
+		}
+		double t_row = timer.getElapsedTimeAndRestart();
+		for (int k = 0; k < repeat; ++k) {
+			gbdt.predict_batch(rows.data(), n_rows, num_features, out_batch.data());
+		}
+		double t_batch = timer.getElapsedTimeAndRestart();
+		float max_diff = 0.0f;
+		for (int r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(out_row[r] - out_batch[r]));
+
+		gbdt.compile();
+		timer.restart();
+		for (int k = 0; k < repeat; ++k) {
+			gbdt.predict_batch(rows.data(), n_rows, num_features, out_batch.data());
+		}
+		double t_compiled = timer.getElapsedTimeAndRestart();
+		for (int r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(out_row[r] - out_batch[r]));
+
+		std::cout << "per-row predict: " << n_rows * repeat / t_row << " rows/sec" << std::endl;
+		std::cout << "predict_batch:   " << n_rows * repeat / t_batch << " rows/sec" << std::endl;
+		std::cout << "predict_batch (compiled): " << n_rows * repeat / t_compiled << " rows/sec" << std::endl;
+		std::cout << "max abs diff: " << max_diff << std::endl;
+	}
+
+	/**
+	 * 多线程 predict_margin_batch 在 1~max_threads 个线程下的扩展性：
+	 * 大批量（按行切分）的吞吐， 以及单个小批量请求（按树切分）的延迟
+	 */
+	static void benchmark_parallel_predict_batch(int num_trees = 1000, int max_depth = 6, int num_features = 200,
+			int n_large = 20000, int n_small = 16, unsigned int max_threads = 32, int repeat = 20) {
+		std::stringstream dump(random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		gbdt.compile();
+		std::cout << "\n---benchmark LC::xgboost::GBDT_predictor parallel predict_margin_batch" << std::endl;
+		std::cout << gbdt.toString();
+		std::cout << "hardware threads: " << ThreadPool::default_num_threads() << std::endl;
+
+		LC::RandomUniform<int, float> rnd(7);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows((size_t) n_large * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i)
+			rows[i] = rnd.randf();
+		std::vector<float> expected(n_large), out(n_large);
+		gbdt.predict_margin_batch(rows.data(), n_large, num_features, expected.data());
+
+		double base_large = 0.0, base_small = 0.0;
+		for (unsigned int threads = 1; threads <= max_threads; threads *= 2) {
+			gbdt.set_num_threads(threads);
+			LC::TimerAccurate timer;
+			gbdt.predict_margin_batch(rows.data(), n_large, num_features, out.data());
+			const double t_large = timer.getElapsedTimeAndRestart();
+			float max_diff = 0.0f;
+			for (int r = 0; r < n_large; ++r)
+				max_diff = std::max(max_diff, std::abs(expected[r] - out[r]));
+			timer.restart();
+			for (int k = 0; k < repeat; ++k)
+				gbdt.predict_margin_batch(rows.data(), n_small, num_features, out.data());
+			const double t_small = timer.getElapsedTimeAndRestart() / repeat;
+			if (threads == 1) {
+				base_large = t_large;
+				base_small = t_small;
+			}
+			std::cout << "threads: " << threads << "\tlarge batch: " << n_large / t_large << " rows/sec (x"
+					<< base_large / t_large << ")\tsmall batch: " << t_small * 1e6 << " us (x" << base_small / t_small
+					<< ")\tmax abs diff: " << max_diff << std::endl;
+		}
+	}
+
+	/**
+	 * 在偏斜的数据（特征集中在 [0, skew) 内）上比较 optimize_layout 前后的平均 cache line 数和吞吐
+	 */
+	static void benchmark_optimize_layout(int num_trees = 500, int max_depth = 8, int num_features = 100,
+			int n_rows = 2000, float skew = 0.2f, int repeat = 10) {
+		std::stringstream dump(random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		gbdt.compile();
+		std::cout << "\n---benchmark LC::xgboost::GBDT_predictor::optimize_layout" << std::endl;
+		std::cout << gbdt.toString();
+
+		LC::RandomUniform<int, float> rnd(5);
+		rnd.set_param_f(0.0f, skew);
+		std::vector<float> rows(n_rows * num_features);
+		for (unsigned int i = 0; i < rows.size(); ++i)
+			rows[i] = rnd.randf();
+		std::vector<float> before(n_rows), after(n_rows);
+
+		const double lines_before = gbdt.avg_cache_lines_touched(rows.data(), n_rows, num_features);
+		LC::TimerAccurate timer;
+		for (int k = 0; k < repeat; ++k)
+			gbdt.predict_margin_batch(rows.data(), n_rows, num_features, before.data());
+		const double t_before = timer.getElapsedTimeAndRestart();
+
+		gbdt.optimize_layout(rows.data(), n_rows / 2, num_features); // 用一半的行做 profile
+		const double lines_after = gbdt.avg_cache_lines_touched(rows.data(), n_rows, num_features);
+		timer.restart();
+		for (int k = 0; k < repeat; ++k)
+			gbdt.predict_margin_batch(rows.data(), n_rows, num_features, after.data());
+		const double t_after = timer.getElapsedTimeAndRestart();
+
+		float max_diff = 0.0f;
+		for (int r = 0; r < n_rows; ++r)
+			max_diff = std::max(max_diff, std::abs(before[r] - after[r]));
+		std::cout << "cache lines per row: " << lines_before << " -> " << lines_after << std::endl;
+		std::cout << "predict_margin_batch: " << n_rows * repeat / t_before << " -> " << n_rows * repeat / t_after
+				<< " rows/sec" << std::endl;
+		std::cout << "max abs diff: " << max_diff << std::endl;
+	}
+
+	static std::vector<float> random_rows(int n_rows, int num_features, int seed, float missing_ratio = 0.0f) {
+		LC::RandomUniform<int, float> rnd(seed);
+		rnd.set_param_f(0.0f, 1.0f);
+		std::vector<float> rows((size_t) n_rows * num_features);
+		for (size_t i = 0; i < rows.size(); ++i) {
+			rows[i] = rnd.randf();
+			if (rows[i] < missing_ratio)
+				rows[i] = NAN;
+		}
+		return rows;
+	}
+
+	static float max_abs_diff(const std::vector<float>& a, const std::vector<float>& b) {
+		float max_diff = 0.0f;
+		for (size_t i = 0; i < a.size() && i < b.size(); ++i)
+			max_diff = std::max(max_diff, std::abs(a[i] - b[i]));
+		return max_diff;
+	}
+
+	/**
+	 * save_binary / load_binary 的往返测试， 并检查被修改的 header 和节点能被发现
+	 */
+	static void testBinaryModel(const string& filename = "/tmp/lc_gbdt_binary_test.bin", int num_trees = 100,
+			int max_depth = 6, int num_features = 50, int n_rows = 1000) {
+		std::cout << "\n---test LC::xgboost::GBDT_predictor binary model" << std::endl;
+		std::stringstream dump(random_model_dump(num_trees, max_depth, num_features, 0, true));
+		GBDT_predictor gbdt(dump);
+		gbdt.set_objective("reg:squarederror");
+		gbdt.save_binary(filename);
+		const std::vector<float> rows = random_rows(n_rows, num_features, 11, 0.05f);
+		std::vector<float> expected(n_rows), actual(n_rows);
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, expected.data());
+		for (int verify = 1; verify >= 0; --verify) {
+			GBDT_predictor loaded;
+			loaded.load_binary(filename, verify != 0);
+			loaded.predict_margin_batch(rows.data(), n_rows, num_features, actual.data());
+			std::cout << "verify_checksum=" << verify << ": trees " << loaded.num_trees() << "/" << gbdt.num_trees()
+					<< ", features " << loaded.num_features() << "/" << gbdt.num_features() << ", objective "
+					<< loaded.objective() << ", max abs diff: " << max_abs_diff(expected, actual) << std::endl;
+		}
+
+		std::string bytes;
+		{
+			std::ifstream in(filename.c_str(), std::ios::in | std::ios::binary);
+			bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+		}
+		GBDT_binary_header header;
+		std::memcpy(&header, bytes.data(), sizeof(header));
+		const string corrupted = filename + ".corrupted";
+		for (int c = 0; c < 2; ++c) {
+			std::string modified = bytes;
+			if (c == 0) // header 中的 num_features
+				modified[offsetof(GBDT_binary_header, num_features)] ^= 1;
+			else // 第一棵树根节点的孩子指向自身
+				std::memset(&modified[header.nodes_offset + offsetof(CompactNode, child)], 0, sizeof(int32_t));
+			{
+				std::ofstream out(corrupted.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+				out.write(modified.data(), modified.size());
+			}
+			GBDT_predictor loaded;
+			try {
+				loaded.load_binary(corrupted, c == 0);
+				std::cout << "ERROR: corrupted " << (c == 0 ? "header" : "node") << " not detected" << std::endl;
+			} catch (const std::string& e) {
+				std::cout << "corrupted " << (c == 0 ? "header" : "node") << " detected: " << e << std::endl;
+			}
+		}
+		std::remove(corrupted.c_str());
+	}
+
+	/**
+	 * 级联预测的测试： 没有检查点时与 predict / predict_batch 相同； 标定后在标定样本上需要保留的行被误淘汰的比例不超过 miss_rate
+	 */
+	static void testCascade(int num_trees = 200, int max_depth = 6, int num_features = 50, int n_rows = 5000,
+			float top_fraction = 0.1f, float miss_rate = 0.05f) {
+		std::cout << "\n---test LC::xgboost::GBDT_predictor cascade" << std::endl;
+		std::stringstream dump(random_model_dump(num_trees, max_depth, num_features));
+		GBDT_predictor gbdt(dump);
+		const std::vector<float> rows = random_rows(n_rows, num_features, 13, 0.05f);
+
+		std::vector<float> expected(n_rows), actual(n_rows), cascade(n_rows);
+		gbdt.predict_batch(rows.data(), n_rows, num_features, expected.data());
+		gbdt.set_cascade(std::vector<CascadeCheckpoint>());
+		CascadeStats stats;
+		gbdt.predict_batch_cascade(rows.data(), n_rows, num_features, cascade.data(), NAN, &stats);
+		for (int r = 0; r < n_rows; ++r) {
+			std::vector<float> fv(rows.begin() + r * num_features, rows.begin() + (r + 1) * num_features);
+			actual[r] = gbdt.predict_cascade(fv, NAN, &stats);
+		}
+		std::cout << "no checkpoints: max abs diff (row): " << max_abs_diff(expected, actual) << ", (batch): "
+				<< max_abs_diff(expected, cascade) << ", early exits: " << stats.early_exits << std::endl;
+
+		std::vector<unsigned int> checkpoint_trees;
+		checkpoint_trees.push_back(num_trees / 10);
+		checkpoint_trees.push_back(num_trees / 4);
+		checkpoint_trees.push_back(num_trees / 2);
+		gbdt.calibrate_cascade(rows.data(), n_rows, num_features, checkpoint_trees, top_fraction, miss_rate);
+		std::vector<float> margin(n_rows);
+		gbdt.predict_margin_batch(rows.data(), n_rows, num_features, margin.data());
+		std::vector<size_t> order(n_rows);
+		for (int r = 0; r < n_rows; ++r)
+			order[r] = r;
+		std::sort(order.begin(), order.end(), [&margin](size_t a, size_t b) {
+			return margin[a] > margin[b];
+		});
+		const size_t num_top = std::max<size_t>(1, (size_t) std::ceil(top_fraction * n_rows));
+		size_t misses = 0;
+		for (size_t i = 0; i < num_top; ++i) {
+			const size_t r = order[i];
+			std::vector<float> fv(rows.begin() + r * num_features, rows.begin() + (r + 1) * num_features);
+			CascadeStats row_stats;
+			gbdt.predict_cascade(fv, NAN, &row_stats);
+			misses += row_stats.early_exits;
+		}
+		stats = CascadeStats();
+		gbdt.predict_margin_batch_cascade(rows.data(), n_rows, num_features, cascade.data(), NAN, &stats);
+		std::cout << "calibrated: miss rate " << (double) misses / num_top << " (<= " << miss_rate << "), avg trees "
+				<< stats.avg_trees() << "/" << num_trees << ", early exits " << stats.early_exits << "/" << n_rows
+				<< std::endl;
+	}
+
+	/**
+	 * predict_contributions 的每行（每类）贡献之和应等于 margin； predict_leaf_indices（编译后、 optimize_layout 后）
+	 * 应与未编译的树逐节点遍历得到的叶子相同
+	 */
+	static void testContributions(int num_trees = 60, int max_depth = 5, int num_features = 30, int n_rows = 500) {
+		std::cout << "\n---test LC::xgboost::GBDT_predictor contributions & leaf indices" << std::endl;
+		const std::vector<float> rows = random_rows(n_rows, num_features, 17, 0.1f);
+		const string dump_text = random_model_dump(num_trees, max_depth, num_features, 0, true);
+		for (int num_class = 1; num_class <= 3; num_class += 2) {
+			std::stringstream dump(dump_text);
+			GBDT_predictor gbdt(dump);
+			if (num_class > 1)
+				gbdt.set_objective("multi:softprob", num_class);
+			const size_t F = gbdt.num_features() + 1;
+			std::vector<float> margin((size_t) n_rows * num_class), phi((size_t) n_rows * num_class * F);
+			gbdt.predict_margin_batch(rows.data(), n_rows, num_features, margin.data());
+			gbdt.predict_contributions(rows.data(), n_rows, num_features, phi.data());
+			std::vector<float> sum(margin.size(), 0.0f);
+			for (size_t i = 0; i < sum.size(); ++i) {
+				for (size_t f = 0; f < F; ++f)
+					sum[i] += phi[i * F + f];
+			}
+			std::cout << "num_class=" << num_class << ": max |sum(contributions) - margin|: "
+					<< max_abs_diff(sum, margin) << std::endl;
+		}
+
+		std::stringstream dump(dump_text);
+		GBDT_predictor gbdt(dump);
+		std::vector<int> expected((size_t) n_rows * num_trees), actual(expected.size());
+		for (int r = 0; r < n_rows; ++r) {
+			for (int t = 0; t < num_trees; ++t)
+				expected[(size_t) r * num_trees + t] = gbdt.trees()[t].predict_leaf_index(&rows[(size_t) r * num_features]);
+		}
+		gbdt.compile();
+		gbdt.predict_leaf_indices(rows.data(), n_rows, num_features, actual.data());
+		size_t mismatches = 0;
+		for (size_t i = 0; i < expected.size(); ++i)
+			mismatches += expected[i] != actual[i];
+		gbdt.optimize_layout(rows.data(), n_rows, num_features);
+		gbdt.predict_leaf_indices(rows.data(), n_rows, num_features, actual.data());
+		size_t mismatches_optimized = 0;
+		for (size_t i = 0; i < expected.size(); ++i)
+			mismatches_optimized += expected[i] != actual[i];
+		std::cout << "leaf index mismatches: compiled " << mismatches << ", optimize_layout " << mismatches_optimized
+				<< " (of " << expected.size() << ")" << std::endl;
 	}
 
 	string to_lua_script(int level = 0, int idx_start_from = 1, string indent = "  ", string var_name = "score") {
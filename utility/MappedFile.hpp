@@ -0,0 +1,82 @@
+/*
+ * MappedFile.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef LC_UTILITY_MAPPEDFILE_HPP_
+#define LC_UTILITY_MAPPEDFILE_HPP_
+
+#include <string>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace LC {
+
+/**
+ * 只读、共享（MAP_SHARED）地 mmap 整个文件， 析构时 munmap；
+ * 同一台机器上多个进程 mmap 同一个文件时共享相同的物理页， 热更新时也可以直接命中 page cache。
+ * 不可复制， 需要共享时用 std::shared_ptr<MappedFile>
+ */
+class MappedFile {
+	const char* data_;
+	size_t size_;
+
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+public:
+	/**
+	 * @param filename
+	 * @param populate 为true时预先读入所有页（MAP_POPULATE）， 避免首次预测时的 page fault
+	 */
+	MappedFile(const std::string& filename, bool populate = false) :
+			data_(NULL), size_(0) {
+		int fd = ::open(filename.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::string("can not open file for mmap: ") + filename;
+		struct stat st;
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw std::string("can not stat file for mmap: ") + filename;
+		}
+		size_ = st.st_size;
+		if (size_ > 0) {
+			int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+			if (populate)
+				flags |= MAP_POPULATE;
+#endif
+			void* p = ::mmap(NULL, size_, PROT_READ, flags, fd, 0);
+			if (p == MAP_FAILED) {
+				::close(fd);
+				throw std::string("mmap failed: ") + filename;
+			}
+			data_ = (const char*) p;
+		}
+		::close(fd); // mmap 之后关闭 fd 不影响映射
+	}
+
+	~MappedFile() {
+		if (data_ != NULL)
+			::munmap((void*) data_, size_);
+	}
+
+	inline const char* data() const {
+		return data_;
+	}
+
+	inline size_t size() const {
+		return size_;
+	}
+
+	template<typename T>
+	inline const T* at(size_t offset) const {
+		return reinterpret_cast<const T*>(data_ + offset);
+	}
+};
+
+}
+
+#endif /* LC_UTILITY_MAPPEDFILE_HPP_ */
@@ -0,0 +1,124 @@
+/*
+ * ThreadPool.hpp
+ *
+ *  Created on: Oct 18, 2026
+ */
+
+#ifndef LC_UTILITY_THREADPOOL_HPP_
+#define LC_UTILITY_THREADPOOL_HPP_
+
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+namespace LC {
+
+/**
+ * 固定线程数的线程池， 析构时等待队列中的任务全部完成。
+ * 任务中的异常通过 submit 返回的 future 传递给调用者。
+ * 注意：不要在池内的线程中调用 parallel_for 并等待， 否则可能死锁
+ */
+class ThreadPool {
+	std::vector<std::thread> workers_;
+	std::queue<std::function<void()> > tasks_;
+	std::mutex mutex_;
+	std::condition_variable cv_;
+	bool stop_;
+
+	ThreadPool(const ThreadPool&);
+	ThreadPool& operator=(const ThreadPool&);
+
+	void work() {
+		while (true) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(mutex_);
+				while (!stop_ && tasks_.empty())
+					cv_.wait(lock);
+				if (tasks_.empty())
+					return;
+				task = std::move(tasks_.front());
+				tasks_.pop();
+			}
+			task();
+		}
+	}
+public:
+	/**
+	 * @param num_threads 为0时使用 std::thread::hardware_concurrency()
+	 */
+	explicit ThreadPool(unsigned int num_threads = 0) :
+			stop_(false) {
+		if (num_threads == 0)
+			num_threads = default_num_threads();
+		for (unsigned int i = 0; i < num_threads; ++i)
+			workers_.push_back(std::thread(&ThreadPool::work, this));
+	}
+
+	~ThreadPool() {
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			stop_ = true;
+		}
+		cv_.notify_all();
+		for (unsigned int i = 0; i < workers_.size(); ++i)
+			workers_[i].join();
+	}
+
+	static unsigned int default_num_threads() {
+		unsigned int n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	inline unsigned int size() const {
+		return workers_.size();
+	}
+
+	template<typename F>
+	std::future<typename std::result_of<F()>::type> submit(F f) {
+		typedef typename std::result_of<F()>::type R;
+		std::shared_ptr<std::packaged_task<R()> > task = std::make_shared<std::packaged_task<R()> >(f);
+		std::future<R> result = task->get_future();
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			tasks_.push([task]() {(*task)();});
+		}
+		cv_.notify_one();
+		return result;
+	}
+
+	/**
+	 * 将 [begin, end) 切分为不超过 max_chunks 个、每个至少 min_chunk_size 的连续区间并行执行 f(chunk_begin, chunk_end)，
+	 * 等待全部完成； 若有任务抛出异常， 在所有任务结束后重新抛出第一个异常
+	 * @param max_chunks 为0时使用线程数
+	 */
+	void parallel_for(size_t begin, size_t end, const std::function<void(size_t, size_t)>& f, size_t min_chunk_size =
+			1, size_t max_chunks = 0) {
+		if (end <= begin)
+			return;
+		if (max_chunks == 0)
+			max_chunks = std::max<size_t>(workers_.size(), 1);
+		const size_t n = end - begin;
+		const size_t num_chunks = std::max<size_t>(1, std::min(max_chunks, n / std::max<size_t>(min_chunk_size, 1)));
+		std::vector<std::future<void> > futures;
+		for (size_t c = 0; c < num_chunks; ++c) {
+			const size_t b = begin + n * c / num_chunks;
+			const size_t e = begin + n * (c + 1) / num_chunks;
+			futures.push_back(submit([&f, b, e]() {f(b, e);}));
+		}
+		for (size_t c = 0; c < futures.size(); ++c)
+			futures[c].wait();
+		for (size_t c = 0; c < futures.size(); ++c)
+			futures[c].get();
+	}
+};
+
+}
+
+#endif /* LC_UTILITY_THREADPOOL_HPP_ */